@@ -12,9 +12,24 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "annotated_string.h"
+#include <limits>
 #include "log.h"
 
 std::atomic<uint16_t> Site::id_gen_{1};
+constexpr uint16_t Site::kSpareSites;
+
+bool Site::ReserveThrough(uint16_t site_id) {
+  // id_gen_ would wrap to 0 past the last site
+  if (site_id > std::numeric_limits<uint16_t>::max() - kSpareSites) {
+    return false;
+  }
+  uint16_t next = id_gen_.load(std::memory_order_relaxed);
+  while (next <= site_id &&
+         !id_gen_.compare_exchange_weak(next, site_id + 1,
+                                        std::memory_order_relaxed)) {
+  }
+  return true;
+}
 
 AnnotatedString::AnnotatedString() {
   chars_ = chars_
@@ -92,6 +107,28 @@ void AnnotatedString::MakeDeleteAttributesBySite(CommandSet* commands,
   });
 }
 
+absl::optional<Attribute::DataCase> AnnotatedString::CommandAttributeType(
+    const Command& cmd) const {
+  const Attribute::DataCase* dc = nullptr;
+  switch (cmd.command_case()) {
+    case Command::kDecl:
+      return cmd.decl().data_case();
+    case Command::kDelDecl:
+      dc = attributes_.Lookup(cmd.id());
+      break;
+    case Command::kMark:
+      dc = attributes_.Lookup(cmd.mark().attribute());
+      break;
+    case Command::kDelMark:
+      dc = annotations_.Lookup(cmd.id());
+      break;
+    default:
+      break;
+  }
+  if (!dc) return absl::nullopt;
+  return *dc;
+}
+
 AnnotatedString AnnotatedString::Integrate(const CommandSet& commands) const {
   AnnotatedString s = *this;
   for (const auto& cmd : commands.commands()) {
@@ -218,7 +255,7 @@ void AnnotatedString::IntegrateDelChar(ID id) {
                        .Add(self->prev, LineBreak{prev->prev, self->next})
                        .Add(self->next, LineBreak{self->prev, next->next});
   }
-  Log() << "Del char " << id.id;
+  LOG(VERBOSE) << "Del char " << id.id;
   chars_ = chars_.Add(id, CharInfo{false, cdel->chr, cdel->next, cdel->prev,
                                    cdel->after, cdel->before, AVL<ID>()});
 }
@@ -15,6 +15,7 @@
 
 #include <stdint.h>
 #include <atomic>
+#include <map>
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "avl.h"
@@ -67,6 +68,13 @@ class Site {
 
   bool CreatedID(ID id) const { return id.site == id_; }
 
+  // content made by another process (restored from disk, say) holds ids
+  // from sites up to site_id: never hand those sites out here. False (and
+  // nothing reserved) if that would leave fewer than kSpareSites to hand out:
+  // the content can't be used as is.
+  static bool ReserveThrough(uint16_t site_id);
+  static constexpr uint16_t kSpareSites = 1024;
+
  private:
   Site(uint16_t id) : id_(id) {}
   const uint16_t id_;
@@ -74,6 +82,9 @@ class Site {
   static std::atomic<uint16_t> id_gen_;
 };
 
+// how many command sets from each site (by site id) a replica has integrated
+typedef std::map<int, uint64_t> VersionVector;
+
 class AnnotatedString {
  public:
   AnnotatedString();
@@ -122,6 +133,11 @@ class AnnotatedString {
 
   void MakeDeleteAttributesBySite(CommandSet* commands, const Site& site);
 
+  // the type of attribute a decl/mark command (or its deletion) concerns, as
+  // seen by this string before integrating it
+  absl::optional<Attribute::DataCase> CommandAttributeType(
+      const Command& cmd) const;
+
   AnnotatedString Integrate(const CommandSet& commands) const;
   void Integrate(const Command& command);
 
@@ -136,16 +152,51 @@ class AnnotatedString {
   std::string Render() const { return Render(Begin(), End()); }
   std::string Render(ID begin, ID end) const;
 
+  // id has been integrated (it may since have been deleted)
+  bool Contains(ID id) const { return chars_.Lookup(id) != nullptr; }
+
   bool SameContentIdentity(const AnnotatedString& other) const {
     return chars_.SameIdentity(other.chars_);
   }
 
+  // the same lines, though perhaps not the same text in them
+  bool SameLineIdentity(const AnnotatedString& other) const {
+    return line_breaks_.SameIdentity(other.line_breaks_);
+  }
+
   bool SameTotalIdentity(const AnnotatedString& other) const {
     return chars_.SameIdentity(other.chars_) &&
            attributes_by_type_.SameIdentity(other.attributes_by_type_) &&
            annotations_by_type_.SameIdentity(other.annotations_by_type_);
   }
 
+  // F(ID id) for each character inserted since the string was since, or
+  // deleted or given new neighbours since; costs about the size of the
+  // change rather than the size of the string
+  template <class F>
+  void ForEachTextChange(const AnnotatedString& since, F&& f) const {
+    chars_.ForEachDifference(since.chars_, [&](ID id) {
+      const CharInfo* now = chars_.Lookup(id);
+      if (now == nullptr) return;
+      const CharInfo* then = since.chars_.Lookup(id);
+      if (then != nullptr && then->visible == now->visible &&
+          then->next == now->next && then->prev == now->prev) {
+        return;
+      }
+      f(id);
+    });
+  }
+
+  // F(ID line_start, bool added) for each line start added or removed since
+  // the string was since; costs about the size of the change
+  template <class F>
+  void ForEachLineChange(const AnnotatedString& since, F&& f) const {
+    line_breaks_.ForEachDifference(since.line_breaks_, [&](ID id) {
+      const bool now = line_breaks_.Lookup(id) != nullptr;
+      if (now != (since.line_breaks_.Lookup(id) != nullptr)) f(id, now);
+    });
+  }
+
   // F(ID annid, ID begin, ID end, const Attribute& attr)
   template <class F>
   void ForEachAnnotation(Attribute::DataCase type, F&& f) const {
@@ -223,6 +274,9 @@ class AnnotatedString {
     ID id() const { return pos_; }
     char value() const { return cur_->chr; }
     bool is_visible() const { return cur_->visible; }
+    // ids of the annotations on this character; unchanged annotations keep
+    // the same set (see AVL::SameIdentity)
+    const AVL<ID>& annotation_ids() const { return cur_->annotations; }
 
     void MoveNext() {
       pos_ = cur_->next;
@@ -253,7 +307,7 @@ class AnnotatedString {
         // Log() << "EXAM " << id.id << " on " << pos_.id;
         const auto* dc = str_->annotations_.Lookup(id);
         if (!dc) {
-          Log() << "no dc for " << id.id;
+          LOG(INFO) << "no dc for " << id.id;
           return;
         }
         const Annotation& ann =
@@ -261,7 +315,7 @@ class AnnotatedString {
         const Attribute* attr =
             str_->attributes_by_type_.Lookup(*dc)->Lookup(ann.attribute());
         if (!attr) {
-          Log() << "failed attr lookup";
+          LOG(INFO) << "failed attr lookup";
           return;
         }
         // Log() << attr->DebugString();
@@ -53,7 +53,7 @@ int Application::RunMode(const std::string& mode, int argc, char** argv) {
   }
   auto it = m.find(mode);
   if (it == m.end()) {
-    Log() << "Bad application mode: " << mode;
+    LOG(ERROR) << "Bad application mode: " << mode;
     return 1;
   }
   return it->second(argc, argv)->Run();
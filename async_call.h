@@ -0,0 +1,180 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <grpc++/completion_queue.h>
+#include <grpc++/server_context.h>
+#include <grpc++/support/async_stream.h>
+#include <deque>
+#include <functional>
+#include "absl/synchronization/mutex.h"
+
+// What the async server puts on its completion queues: each tag is told
+// whether its operation went through.
+class AsyncTag {
+ public:
+  virtual void Complete(bool ok) = 0;
+
+ protected:
+  ~AsyncTag() {}
+};
+
+// Completes tags from cq until it's shut down and drained; run by each of
+// the server's polling threads.
+inline void PollCompletionQueue(grpc::CompletionQueue* cq) {
+  void* tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) static_cast<AsyncTag*>(tag)->Complete(ok);
+}
+
+// One bidirectional streaming call on the async API, with nothing blocking:
+// reads are issued one at a time and handed to OnRead, and messages queued
+// with Write from any thread go out one at a time behind each other. The
+// call deletes itself once it has finished.
+//
+// A derived class's constructor asks the service for a call with
+// request_tag(); once one arrives it gets OnStart (where it should ask for
+// the next), then OnRead for each message, then OnEnd exactly once when the
+// client is done or OnRead fails. After OnEnd anything queued is flushed
+// and the call finished.
+template <class W, class R>
+class AsyncBidiCall {
+ protected:
+  AsyncBidiCall()
+      : stream_(&ctx_),
+        request_(this, &AsyncBidiCall::Requested),
+        read_(this, &AsyncBidiCall::ReadDone),
+        write_(this, &AsyncBidiCall::WriteDone),
+        finish_(this, &AsyncBidiCall::FinishDone) {}
+  virtual ~AsyncBidiCall() {}
+
+  virtual void OnStart() = 0;
+  // a non-OK status ends the call with it
+  virtual grpc::Status OnRead(const R& msg) = 0;
+  virtual void OnEnd() = 0;
+  // with mu_ held, once the write queue is empty: something else to send
+  // (commands merged while the last write was out, say)
+  virtual bool NextWrite(W* msg, grpc::WriteOptions* options)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return false;
+  }
+
+  void* request_tag() { return static_cast<AsyncTag*>(&request_); }
+
+  void Write(W msg, grpc::WriteOptions options) {
+    Produce([&]() { queue_.emplace_back(std::move(msg), options); });
+  }
+
+  // runs add under mu_ (to stage something for NextWrite), then writes it
+  // if the stream's idle
+  void Produce(std::function<void()> add) {
+    absl::MutexLock lock(&mu_);
+    add();
+    Pump();
+  }
+
+  grpc::ServerContext ctx_;
+  grpc::ServerAsyncReaderWriter<W, R> stream_;
+  absl::Mutex mu_;
+
+ private:
+  class Tag final : public AsyncTag {
+   public:
+    Tag(AsyncBidiCall* call, void (AsyncBidiCall::*fn)(bool))
+        : call_(call), fn_(fn) {}
+    void Complete(bool ok) override { (call_->*fn_)(ok); }
+
+   private:
+    AsyncBidiCall* const call_;
+    void (AsyncBidiCall::*const fn_)(bool);
+  };
+
+  void* tag(Tag* t) { return static_cast<AsyncTag*>(t); }
+
+  void Requested(bool ok) {
+    // the server is shutting down
+    if (!ok) {
+      delete this;
+      return;
+    }
+    OnStart();
+    stream_.Read(&in_, tag(&read_));
+  }
+
+  void ReadDone(bool ok) {
+    grpc::Status status;
+    if (ok) {
+      status = OnRead(in_);
+      if (status.ok()) {
+        stream_.Read(&in_, tag(&read_));
+        return;
+      }
+    }
+    OnEnd();
+    absl::MutexLock lock(&mu_);
+    finishing_ = true;
+    status_ = status;
+    Pump();
+  }
+
+  void WriteDone(bool ok) {
+    absl::MutexLock lock(&mu_);
+    writing_ = false;
+    if (!ok && !broken_) {
+      // the client's gone: make sure the read fails too
+      broken_ = true;
+      queue_.clear();
+      ctx_.TryCancel();
+    }
+    Pump();
+  }
+
+  void FinishDone(bool ok) { delete this; }
+
+  // start the next write, or once everything's written and reads are
+  // done, finish
+  void Pump() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    if (writing_ || finished_) return;
+    W msg;
+    grpc::WriteOptions options;
+    if (!broken_) {
+      if (!queue_.empty()) {
+        msg = std::move(queue_.front().first);
+        options = queue_.front().second;
+        queue_.pop_front();
+        writing_ = true;
+      } else if (NextWrite(&msg, &options)) {
+        writing_ = true;
+      }
+    }
+    if (writing_) {
+      stream_.Write(msg, options, tag(&write_));
+    } else if (finishing_) {
+      finished_ = true;
+      stream_.Finish(status_, tag(&finish_));
+    }
+  }
+
+  Tag request_;
+  Tag read_;
+  Tag write_;
+  Tag finish_;
+  R in_;
+  std::deque<std::pair<W, grpc::WriteOptions>> queue_ GUARDED_BY(mu_);
+  bool writing_ GUARDED_BY(mu_) = false;
+  bool broken_ GUARDED_BY(mu_) = false;
+  bool finishing_ GUARDED_BY(mu_) = false;
+  bool finished_ GUARDED_BY(mu_) = false;
+  grpc::Status status_ GUARDED_BY(mu_);
+};
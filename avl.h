@@ -15,6 +15,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <vector>
 
 template <class K, class V = void>
 class AVL {
@@ -44,6 +45,64 @@ class AVL {
 
   bool SameIdentity(AVL avl) const { return root_ == avl.root_; }
 
+  // F(const K& key) for each key added, removed or (perhaps) changed in
+  // value between other and this, in key order; entries copied along the
+  // path of a change count as changed. Subtrees the two share are skipped,
+  // so this costs about the size of the change times the height
+  template <class F>
+  void ForEachDifference(const AVL &other, F &&f) const {
+    // pending (in-order) work per tree: whole subtrees, or single entries
+    struct Item {
+      const Node *node;
+      bool single;
+    };
+    std::vector<Item> a, b;
+    auto push = [](std::vector<Item> *v, const NodePtr &n) {
+      if (n) v->push_back(Item{n.get(), false});
+    };
+    auto expand = [push](std::vector<Item> *v) {
+      const Node *n = v->back().node;
+      v->pop_back();
+      push(v, n->right);
+      v->push_back(Item{n, true});
+      push(v, n->left);
+    };
+    push(&a, other.root_);
+    push(&b, root_);
+    while (!a.empty() || !b.empty()) {
+      if (a.empty() || b.empty()) {
+        auto *v = a.empty() ? &b : &a;
+        if (!v->back().single) {
+          expand(v);
+        } else {
+          f(v->back().node->kv.first);
+          v->pop_back();
+        }
+        continue;
+      }
+      Item &x = a.back();
+      Item &y = b.back();
+      if (!x.single && !y.single && x.node == y.node) {
+        a.pop_back();
+        b.pop_back();
+      } else if (!x.single && (y.single || x.node->height >= y.node->height)) {
+        expand(&a);
+      } else if (!y.single) {
+        expand(&b);
+      } else if (x.node->kv.first < y.node->kv.first) {
+        f(x.node->kv.first);
+        a.pop_back();
+      } else if (y.node->kv.first < x.node->kv.first) {
+        f(y.node->kv.first);
+        b.pop_back();
+      } else {
+        if (x.node != y.node) f(y.node->kv.first);
+        a.pop_back();
+        b.pop_back();
+      }
+    }
+  }
+
  private:
   struct Node;
   typedef std::shared_ptr<Node> NodePtr;
@@ -21,3 +21,25 @@ TEST(AvlTest, Lookup) {
   EXPECT_EQ(nullptr, avl.Lookup(2));
   EXPECT_EQ(42, *avl.Lookup(1));
 }
+
+TEST(AvlTest, ForEachDifference) {
+  AVL<int, int> base;
+  for (int i = 0; i < 1000; i++) base = base.Add(i * 2, i);
+  auto diff = [](const AVL<int, int>& a, const AVL<int, int>& b) {
+    std::vector<int> keys;
+    b.ForEachDifference(a, [&keys](int k) { keys.push_back(k); });
+    return keys;
+  };
+  EXPECT_EQ(std::vector<int>{}, diff(base, base));
+  auto changed = base.Add(7, 0).Add(500, 1).Remove(1000);
+  // nodes copied along the changed paths are reported too
+  for (const auto& keys : {diff(base, changed), diff(changed, base)}) {
+    EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+    for (int k : {7, 500, 1000}) {
+      EXPECT_NE(keys.end(), std::find(keys.begin(), keys.end(), k));
+    }
+    EXPECT_LT(keys.size(), 100u);
+  }
+  AVL<int, int> empty;
+  EXPECT_EQ(1000u, diff(empty, base).size());
+}
@@ -0,0 +1,123 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include "absl/strings/str_cat.h"
+#include "buffer.h"
+
+// stands in for libclang/clang-format: chews on the whole buffer after every
+// change and then re-annotates all of it
+class HeavyCollaborator final : public SyncCollaborator {
+ public:
+  HeavyCollaborator(const Buffer* buffer, const char* name,
+                    CollaboratorPriority priority)
+      : SyncCollaborator(name, absl::Seconds(0), absl::Seconds(0), priority),
+        ed_(buffer->site()) {}
+
+  EditResponse Edit(const EditNotification& notification,
+                    const CancellationToken& cancel) override {
+    EditResponse r;
+    if (notification.shutdown) {
+      r.done = true;
+      return r;
+    }
+    pass_++;
+    AnnotationEditor::ScopedEdit edit(&ed_, &r.content_updates);
+    Attribute attr;
+    attr.mutable_tags()->add_tags(absl::StrCat("pass", pass_ % 2));
+    AnnotatedString::Iterator it(notification.content,
+                                 AnnotatedString::Begin());
+    it.MoveNext();
+    ID line_start = it.id();
+    while (!it.is_end()) {
+      if (it.value() == '\n') {
+        ed_.Mark(line_start, it.id(), attr);
+        it.MoveNext();
+        line_start = it.id();
+      } else {
+        it.MoveNext();
+      }
+    }
+    return r;
+  }
+
+ private:
+  AnnotationEditor ed_;
+  int pass_ = 0;
+};
+
+static std::string GenLines(const std::string& base, int n) {
+  std::string out;
+  for (int i = 0; i < n; i++) {
+    out.append(base);
+    out += '\n';
+  }
+  return out;
+}
+
+// time from a keystroke being pushed until it is committed to the buffer,
+// with state.range(0) heavy collaborators of priority state.range(1) running
+static void BM_KeystrokeCommitLatency(benchmark::State& state) {
+  Site init_site;
+  AnnotatedString initial;
+  ID last = initial.Insert(&init_site,
+                           GenLines("i += 123456789;", 500),
+                           AnnotatedString::Begin());
+  auto buffer = Buffer::Builder()
+                    .SetFilename("bm_buffer.cc")
+                    .SetInitialString(initial)
+                    .Make();
+  static const char* const kNames[] = {"heavy0", "heavy1", "heavy2",
+                                      "heavy3"};
+  for (int i = 0; i < state.range(0); i++) {
+    buffer->MakeCollaborator<HeavyCollaborator>(
+        kNames[i], static_cast<CollaboratorPriority>(state.range(1)));
+  }
+
+  std::vector<double> latencies;
+  for (auto _ : state) {
+    CommandSet cmds;
+    last = AnnotatedString::MakeRawInsert(&cmds, buffer->site(), "x", last,
+                                          AnnotatedString::End());
+    auto start = std::chrono::steady_clock::now();
+    buffer->PushChanges(&cmds, true);
+    auto end = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(end - start).count();
+    state.SetIterationTime(elapsed);
+    latencies.push_back(elapsed);
+    // typing cadence: give the collaborators a chance to pile in
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    if (latencies.empty()) return 0.0;
+    return latencies[std::min(latencies.size() - 1,
+                              static_cast<size_t>(p * latencies.size()))] *
+           1e6;
+  };
+  state.counters["p50_us"] = percentile(0.5);
+  state.counters["p99_us"] = percentile(0.99);
+  state.counters["max_us"] = percentile(1.0);
+}
+BENCHMARK(BM_KeystrokeCommitLatency)
+    ->Args({0, static_cast<int>(CollaboratorPriority::BACKGROUND)})
+    ->Args({1, static_cast<int>(CollaboratorPriority::BACKGROUND)})
+    ->Args({4, static_cast<int>(CollaboratorPriority::BACKGROUND)})
+    ->Args({4, static_cast<int>(CollaboratorPriority::INTERACTIVE)})
+    ->UseManualTime()
+    ->Iterations(200);
+
+BENCHMARK_MAIN()
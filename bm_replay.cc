@@ -0,0 +1,156 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include "buffer.h"
+#include "edit_trace.h"
+#include "project.h"
+
+DEFINE_string(replay_trace, "", "Edit trace to replay (see --edit_trace_dir)");
+DEFINE_bool(replay_collaborators, false,
+            "Also replay the pushed edits through a Buffer running the "
+            "server's collaborators (run from inside the traced project)");
+
+// every allocation the process makes, so replays can report how many each
+// command costs
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+namespace {
+
+struct LoadedTrace {
+  EditTraceHeader header;
+  std::vector<EditTraceRecord> records;
+  int64_t commands = 0;
+  // just what was pushed directly, for replaying with collaborators (which
+  // make their own edits again)
+  std::vector<const EditTraceRecord*> pushed;
+};
+
+const LoadedTrace& Load() {
+  static const LoadedTrace* trace = []() {
+    LoadedTrace* t = new LoadedTrace();
+    EditTraceReader reader(FLAGS_replay_trace);
+    t->header = reader.header();
+    EditTraceRecord record;
+    while (reader.Next(&record)) {
+      t->commands += record.commands().commands_size();
+      t->records.emplace_back(std::move(record));
+    }
+    for (const auto& r : t->records) {
+      if (r.source() == "push") t->pushed.push_back(&r);
+    }
+    return t;
+  }();
+  return *trace;
+}
+
+void ReportAllocations(benchmark::State& state, uint64_t allocs,
+                       int64_t commands) {
+  state.SetItemsProcessed(commands * state.iterations());
+  state.counters["allocs"] = benchmark::Counter(
+      allocs, benchmark::Counter::kAvgIterations);
+  state.counters["allocs_per_cmd"] =
+      commands ? static_cast<double>(allocs) / state.iterations() / commands
+               : 0;
+}
+
+}  // namespace
+
+// every command set the buffer published, integrated one after another the
+// way Buffer does
+static void BM_ReplayIntegrate(benchmark::State& state) {
+  const LoadedTrace& trace = Load();
+  uint64_t allocs = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    AnnotatedString content =
+        AnnotatedString::FromProto(trace.header.initial());
+    uint64_t start = allocations.load();
+    state.ResumeTiming();
+    for (const auto& record : trace.records) {
+      content = content.Integrate(record.commands());
+    }
+    state.PauseTiming();
+    allocs += allocations.load() - start;
+    benchmark::DoNotOptimize(content);
+    state.ResumeTiming();
+  }
+  ReportAllocations(state, allocs, trace.commands);
+}
+
+// the pushed edits, through a buffer with the server's collaborators running
+// against them
+static void BM_ReplayBuffer(benchmark::State& state) {
+  const LoadedTrace& trace = Load();
+  Project project(trace.header.filename(), false);
+  int64_t commands = 0;
+  for (const auto* record : trace.pushed) {
+    commands += record->commands().commands_size();
+  }
+  uint64_t allocs = 0;
+  for (auto _ : state) {
+    uint64_t start = allocations.load();
+    // synthetic: collaborators that would write the file back don't run
+    auto buffer =
+        Buffer::Builder()
+            .SetFilename(trace.header.filename())
+            .SetProject(&project)
+            .SetSynthetic()
+            .SetInitialString(
+                AnnotatedString::FromProto(trace.header.initial()))
+            .Make();
+    for (const auto* record : trace.pushed) {
+      buffer->PushChanges(&record->commands(), true, record->origin_site());
+    }
+    buffer.reset();
+    allocs += allocations.load() - start;
+  }
+  ReportAllocations(state, allocs, commands);
+}
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_replay_trace.empty()) {
+    std::cerr << "--replay_trace is required\n";
+    return 1;
+  }
+  const LoadedTrace& trace = Load();
+  std::cerr << trace.header.filename() << ": " << trace.records.size()
+            << " command sets, " << trace.commands << " commands, "
+            << trace.pushed.size() << " pushed\n";
+  benchmark::RegisterBenchmark("BM_ReplayIntegrate", BM_ReplayIntegrate)
+      ->Unit(benchmark::kMillisecond);
+  if (FLAGS_replay_collaborators) {
+    benchmark::RegisterBenchmark("BM_ReplayBuffer", BM_ReplayBuffer)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime()
+        ->Iterations(1);
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,178 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <benchmark/benchmark.h>
+#include <grpc++/create_channel.h>
+#include <grpc++/security/server_credentials.h>
+#include <grpc++/server.h>
+#include <grpc++/server_builder.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include "absl/strings/str_cat.h"
+#include "proto/project_service.grpc.pb.h"
+#include "shm_stream.h"
+
+typedef std::unique_ptr<
+    grpc::ClientReaderWriterInterface<EditMessage, EditMessage>>
+    EditStreamPtr;
+
+enum Transport { GRPC, SHM };
+
+// sends back every edit it's given, over either transport
+class EchoServer : public ProjectService::Service {
+ public:
+  EchoServer()
+      : dir_(absl::StrCat("/tmp/bm_transport.", getpid())) {
+    mkdir(dir_.c_str(), 0700);
+    server_ = grpc::ServerBuilder()
+                  .RegisterService(this)
+                  .AddListeningPort(GrpcAddress(),
+                                    grpc::InsecureServerCredentials())
+                  .BuildAndStart();
+    shm_listener_.reset(
+        new ShmListener(ShmAddress(), [](std::unique_ptr<ShmChannel> channel) {
+          std::thread([channel = std::move(channel)]() mutable {
+            ShmServerReaderWriter<EditMessage, EditMessage> stream(
+                std::move(channel));
+            Echo(&stream);
+          }).detach();
+        }));
+    stub_ = ProjectService::NewStub(grpc::CreateChannel(
+        GrpcAddress(), grpc::InsecureChannelCredentials()));
+  }
+
+  ~EchoServer() {
+    shm_listener_.reset();
+    server_->Shutdown();
+    rmdir(dir_.c_str());
+  }
+
+  grpc::Status Edit(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<EditMessage, EditMessage>* stream) override {
+    Echo(stream);
+    return grpc::Status::OK;
+  }
+
+  EditStreamPtr Connect(Transport transport, grpc::ClientContext* ctx) {
+    if (transport == SHM) {
+      return EditStreamPtr(new ShmClientReaderWriter<EditMessage, EditMessage>(
+          ShmChannel::Connect(ShmAddress(), 1 << 20)));
+    }
+    return stub_->Edit(ctx);
+  }
+
+ private:
+  static void Echo(
+      grpc::ServerReaderWriterInterface<EditMessage, EditMessage>* stream) {
+    EditMessage msg;
+    while (stream->Read(&msg)) stream->Write(msg);
+  }
+
+  std::string GrpcAddress() const { return absl::StrCat("unix:", dir_, "/g"); }
+  std::string ShmAddress() const { return absl::StrCat(dir_, "/s"); }
+
+  const std::string dir_;
+  std::unique_ptr<grpc::Server> server_;
+  std::unique_ptr<ShmListener> shm_listener_;
+  std::unique_ptr<ProjectService::Stub> stub_;
+};
+
+static EchoServer* Server() {
+  static EchoServer* server = new EchoServer();
+  return server;
+}
+
+static EditMessage Paste(size_t bytes) {
+  EditMessage msg;
+  auto* cmd = msg.mutable_commands()->add_commands();
+  cmd->set_id(1);
+  cmd->mutable_insert()->set_characters(std::string(bytes, 'x'));
+  return msg;
+}
+
+static void Hangup(EditStreamPtr stream) {
+  stream->WritesDone();
+  EditMessage msg;
+  while (stream->Read(&msg)) {
+  }
+  stream->Finish();
+}
+
+// one keystroke out to the server and back, at typing cadence
+static void BM_KeystrokeRoundTrip(benchmark::State& state) {
+  grpc::ClientContext ctx;
+  EditStreamPtr stream =
+      Server()->Connect(static_cast<Transport>(state.range(0)), &ctx);
+  const EditMessage keystroke = Paste(1);
+  std::vector<double> latencies;
+  for (auto _ : state) {
+    EditMessage echo;
+    auto start = std::chrono::steady_clock::now();
+    stream->Write(keystroke);
+    if (!stream->Read(&echo)) {
+      state.SkipWithError("stream broke");
+      break;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(end - start).count();
+    state.SetIterationTime(elapsed);
+    latencies.push_back(elapsed);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  Hangup(std::move(stream));
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    if (latencies.empty()) return 0.0;
+    return latencies[std::min(latencies.size() - 1,
+                              static_cast<size_t>(p * latencies.size()))] *
+           1e6;
+  };
+  state.counters["p50_us"] = percentile(0.5);
+  state.counters["p99_us"] = percentile(0.99);
+}
+BENCHMARK(BM_KeystrokeRoundTrip)
+    ->Arg(GRPC)
+    ->Arg(SHM)
+    ->UseManualTime()
+    ->Iterations(500);
+
+// a paste of state.range(1) bytes out to the server and back (gRPC refuses
+// messages over 4MB by default)
+static void BM_PasteThroughput(benchmark::State& state) {
+  grpc::ClientContext ctx;
+  EditStreamPtr stream =
+      Server()->Connect(static_cast<Transport>(state.range(0)), &ctx);
+  const EditMessage paste = Paste(state.range(1));
+  for (auto _ : state) {
+    EditMessage echo;
+    stream->Write(paste);
+    if (!stream->Read(&echo)) {
+      state.SkipWithError("stream broke");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+  Hangup(std::move(stream));
+}
+BENCHMARK(BM_PasteThroughput)
+    ->Args({GRPC, 64 << 10})
+    ->Args({SHM, 64 << 10})
+    ->Args({GRPC, 1 << 20})
+    ->Args({SHM, 1 << 20})
+    ->UseRealTime();
+
+BENCHMARK_MAIN()
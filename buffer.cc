@@ -13,9 +13,16 @@
 // limitations under the License.
 #include "buffer.h"
 #include <unordered_map>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
 #include "log.h"
+#include "timer_wheel.h"
+#include "trace.h"
 
 namespace {
 
@@ -38,21 +45,98 @@ class CollaboratorRegistry {
   std::vector<std::function<void(Buffer*)> > collabs_;
 };
 
+// registers a condition variable to be signalled by Buffer::WakeWaiters for
+// as long as a thread waits on it (construct and destroy with mu_ held)
+class StateWaiter {
+ public:
+  // collaborator waiters are only woken by changes the collaborator is
+  // interested in
+  StateWaiter(std::map<absl::CondVar*, const Collaborator*>* waiters,
+              const Collaborator* collaborator)
+      : waiters_(waiters) {
+    waiters_->emplace(&cv_, collaborator);
+  }
+  ~StateWaiter() { waiters_->erase(&cv_); }
+
+  StateWaiter(const StateWaiter&) = delete;
+  StateWaiter& operator=(const StateWaiter&) = delete;
+
+  absl::CondVar* cv() { return &cv_; }
+  void Wait(absl::Mutex* mu) { cv_.Wait(mu); }
+
+ private:
+  std::map<absl::CondVar*, const Collaborator*>* const waiters_;
+  absl::CondVar cv_;
+};
+
+// classify commands against the string they'll be integrated into
+ChangeSummary SummarizeCommands(const AnnotatedString& base,
+                                const CommandSet* commands) {
+  ChangeSummary summary;
+  if (!commands) return summary;
+  for (const auto& cmd : commands->commands()) {
+    switch (cmd.command_case()) {
+      case Command::kInsert:
+      case Command::kDelete:
+        summary.text = true;
+        break;
+      default:
+        if (auto dc = base.CommandAttributeType(cmd)) {
+          summary.attributes.insert(*dc);
+        }
+        break;
+    }
+  }
+  return summary;
+}
+
+// lower the OS scheduling priority of collaborator threads doing non
+// interactive work (and any subprocesses they spawn), and label the thread
+// in traces
+void StartCollaboratorThread(const std::string& thread_name,
+                             CollaboratorPriority priority) {
+  Trace::SetThreadName(thread_name);
+#ifdef __linux__
+  static const int kNice[kNumCollaboratorPriorities] = {0, 5, 10};
+  int nice = kNice[static_cast<int>(priority)];
+  if (nice != 0) {
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), nice);
+  }
+#endif
+}
+
 }  // namespace
 
 Buffer::Buffer(Project* project, const boost::filesystem::path& filename,
                absl::optional<AnnotatedString> initial_string,
-               absl::optional<int> site_id, bool synthetic)
+               absl::optional<int> site_id,
+               absl::optional<int> evicted_site_id, bool synthetic,
+               size_t command_log_size)
     : project_(project),
       synthetic_(synthetic),
+      restored_(evicted_site_id.has_value()),
+      collaborators_started_(false),
+      evicted_site_id_(evicted_site_id),
       version_(0),
+      content_version_(0),
       updating_(false),
+      speculating_(false),
+      update_waiters_(),
       last_used_(absl::Now() - absl::Seconds(1000000)),
       filename_(filename),
       site_(site_id) {
   if (initial_string) state_.content = *initial_string;
-  init_thread_ =
-      std::thread([this]() { CollaboratorRegistry::Get().Run(this); });
+  if (command_log_size) command_log_.reset(new CommandLog(command_log_size));
+  if (!FLAGS_edit_trace_dir.empty() && !synthetic_) {
+    edit_trace_ = EditTraceWriter::Open(
+        EditTracePath(FLAGS_edit_trace_dir, filename_), filename_,
+        state_.content);
+  }
+  init_thread_ = std::thread([this]() {
+    CollaboratorRegistry::Get().Run(this);
+    absl::MutexLock lock(&mu_);
+    collaborators_started_ = true;
+  });
 }
 
 void Buffer::RegisterCollaborator(
@@ -60,16 +144,115 @@ void Buffer::RegisterCollaborator(
   CollaboratorRegistry::Get().Register(maybe_init_collaborator);
 }
 
+void Buffer::AddLazyCollaborator(const std::string& output,
+                                 std::function<void()> make_collaborator) {
+  {
+    absl::MutexLock lock(&mu_);
+    lazy_outputs_.insert(output);
+    auto it = subscribers_.find(output);
+    if (it == subscribers_.end() || it->second == 0) {
+      unstarted_collaborators_.emplace(output, std::move(make_collaborator));
+      return;
+    }
+  }
+  make_collaborator();
+}
+
+std::unique_ptr<Buffer::Subscription> Buffer::Subscribe(
+    const std::string& output) const {
+  std::function<void()> make_collaborator;
+  bool first = false;
+  {
+    absl::MutexLock lock(&mu_);
+    if (++subscribers_[output] == 1) {
+      first = true;
+      auto it = unstarted_collaborators_.find(output);
+      if (it != unstarted_collaborators_.end()) {
+        make_collaborator = std::move(it->second);
+        unstarted_collaborators_.erase(it);
+      }
+      // unpark
+      WakeWaiters();
+    }
+  }
+  if (make_collaborator) make_collaborator();
+  if (first) NotifySubscriptionObserver();
+  return std::unique_ptr<Subscription>(new Subscription(this, output));
+}
+
+Buffer::Subscription::~Subscription() {
+  bool last;
+  {
+    absl::MutexLock lock(&buffer_->mu_);
+    last = --buffer_->subscribers_[output_] == 0;
+  }
+  if (last) buffer_->NotifySubscriptionObserver();
+}
+
+void Buffer::SetSubscriptionObserver(
+    std::function<void(const std::set<std::string>& outputs)> f) const {
+  {
+    absl::MutexLock lock(&subscription_observer_mu_);
+    subscription_observer_ = std::move(f);
+  }
+  NotifySubscriptionObserver();
+}
+
+void Buffer::NotifySubscriptionObserver() const {
+  absl::MutexLock observer_lock(&subscription_observer_mu_);
+  if (!subscription_observer_) return;
+  // taken under the observer's lock, so changes are seen in order
+  std::set<std::string> outputs;
+  {
+    absl::MutexLock lock(&mu_);
+    for (const auto& s : subscribers_) {
+      if (s.second > 0) outputs.insert(s.first);
+    }
+  }
+  subscription_observer_(outputs);
+}
+
+void Buffer::WakeWaiters() const {
+  for (auto& waiter : state_waiters_) waiter.first->Signal();
+}
+
+void Buffer::WakeWaiters(const std::set<const Collaborator*>& interested) {
+  for (auto& waiter : state_waiters_) {
+    if (waiter.second == nullptr || interested.count(waiter.second)) {
+      waiter.first->Signal();
+    }
+  }
+}
+
+std::set<const Collaborator*> Buffer::MarkInterested(
+    const ChangeSummary& change) {
+  std::set<const Collaborator*> interested;
+  const absl::Time now = absl::Now();
+  for (auto& c : collaborators_) {
+    if (!change.InterestedBy(c->interest())) continue;
+    interested.insert(c.get());
+    wanted_version_[c.get()] = version_;
+    if (!Parked(c.get())) c->MarkPending(now);
+  }
+  return interested;
+}
+
+bool Buffer::Parked(const Collaborator* collaborator) const {
+  if (lazy_outputs_.count(collaborator->name()) == 0) return false;
+  auto it = subscribers_.find(collaborator->name());
+  return it == subscribers_.end() || it->second == 0;
+}
+
 Buffer::~Buffer() {
   const auto note = absl::StrCat("Buffer ", filename_.string(), " shutdown: ");
-  Log() << note << "Waiting for init thread";
+  LOG(INFO) << note << "Waiting for init thread";
   init_thread_.join();
 
-  UpdateState(nullptr, false,
+  UpdateState(nullptr, false, nullptr,
               [](EditNotification& state) { state.shutdown = true; });
 
   for (auto& t : collaborator_threads_) {
-    Log() << note << "Waiting for " << t.first;
+    LOG(INFO) << note << "Waiting for " << t.first;
     t.second.join();
   }
 }
@@ -87,22 +270,27 @@ void Buffer::AddCollaborator(AsyncCollaboratorPtr&& collaborator) {
   absl::MutexLock lock(&mu_);
   AsyncCollaborator* raw = collaborator.get();
   collaborators_.emplace_back(std::move(collaborator));
+  wanted_version_[raw] = version_;
   collaborator_threads_.emplace(
       absl::StrCat(raw->name(), ".pull"), std::thread([this, raw]() {
+        StartCollaboratorThread(absl::StrCat(raw->name(), ".pull"),
+                                raw->priority());
         try {
           RunPull(raw);
         } catch (std::exception& e) {
-          Log() << raw->name() << " collaborator pull broke: " << e.what();
+          LOG(ERROR) << raw->name() << " collaborator pull broke: " << e.what();
         }
         absl::MutexLock lock(&mu_);
         done_collaborators_.insert(raw);
       }));
   collaborator_threads_.emplace(
       absl::StrCat(raw->name(), ".push"), std::thread([this, raw]() {
+        StartCollaboratorThread(absl::StrCat(raw->name(), ".push"),
+                                raw->priority());
         try {
           RunPush(raw);
         } catch (std::exception& e) {
-          Log() << raw->name() << " collaborator push broke: " << e.what();
+          LOG(ERROR) << raw->name() << " collaborator push broke: " << e.what();
         }
       }));
 }
@@ -113,7 +301,13 @@ void Buffer::AddCollaborator(AsyncCommandCollaboratorPtr&& collaborator) {
     Listener(Buffer* buffer, AsyncCommandCollaborator* collab)
         : BufferListener(buffer), collab_(collab) {}
 
-    void Update(const CommandSet* updates) { collab_->Push(updates); }
+    void Update(const CommandSet* updates, const VersionVector& version) {
+      collab_->Push(updates);
+    }
+    void UpdatePresence(int site_id,
+                        const absl::optional<SitePresence>& presence) {
+      collab_->PushPresence(site_id, presence);
+    }
 
    private:
     AsyncCommandCollaborator* const collab_;
@@ -126,38 +320,62 @@ void Buffer::AddCollaborator(AsyncCommandCollaboratorPtr&& collaborator) {
   collaborator_threads_.emplace(
       absl::StrCat(raw->name(), ".listener"),
       std::thread([this, raw, listener]() {
-        Log() << raw->name() << " START LISTENER";
-        listener->Start([](const AnnotatedString&) {});
-        mu_.LockWhen(absl::Condition(&this->state_.shutdown));
+        LOG(INFO) << raw->name() << " START LISTENER";
+        listener->Start([](const AnnotatedString&, const CommandLog*) {});
+        mu_.Lock();
+        {
+          StateWaiter waiter(&state_waiters_, nullptr);
+          while (!state_.shutdown) waiter.Wait(&mu_);
+        }
         mu_.Unlock();
-        Log() << raw->name() << " DELETE LISTENER";
+        LOG(INFO) << raw->name() << " DELETE LISTENER";
         delete listener;
-        Log() << raw->name() << " SHUTDOWN";
+        LOG(INFO) << raw->name() << " SHUTDOWN";
         raw->Push(nullptr);
       }));
   collaborator_threads_.emplace(
       absl::StrCat(raw->name(), ".publisher"),
       std::thread([this, raw, listener]() {
+        StartCollaboratorThread(absl::StrCat(raw->name(), ".publisher"),
+                                raw->priority());
         try {
           bool shutdown = false;
           while (!shutdown) {
             CommandSet commands;
-            Log() << raw->name() << " PULL";
+            LOG(VERBOSE) << raw->name() << " PULL";
             shutdown = !raw->Pull(&commands);
-            Log() << raw->name() << " PULL -> shutdown=" << shutdown;
-            PublishToListeners(&commands, listener);
-            UpdateState(raw, false, [&](EditNotification& state) {
-              Log() << raw->name() << " integrating";
+            LOG(VERBOSE) << raw->name() << " PULL -> shutdown=" << shutdown;
+            PublishToListeners(&commands, listener, site_.site_id(),
+                               raw->name());
+            UpdateState(raw, false, &commands, [&](EditNotification& state) {
+              LOG(VERBOSE) << raw->name() << " integrating";
               state.content = state.content.Integrate(commands);
-              Log() << raw->name() << " integrating done";
+              LOG(VERBOSE) << raw->name() << " integrating done";
             });
           }
         } catch (std::exception& e) {
-          Log() << raw->name() << " collaborator pull broke: " << e.what();
+          LOG(ERROR) << raw->name() << " collaborator pull broke: " << e.what();
         }
         absl::MutexLock lock(&mu_);
         done_collaborators_.insert(raw);
         declared_no_edit_collaborators_.insert(raw);
+        WakeWaiters();
+      }));
+  collaborator_threads_.emplace(
+      absl::StrCat(raw->name(), ".presence"),
+      std::thread([this, raw, listener]() {
+        StartCollaboratorThread(absl::StrCat(raw->name(), ".presence"),
+                                raw->priority());
+        try {
+          int site_id;
+          absl::optional<SitePresence> presence;
+          while (raw->PullPresence(&site_id, &presence)) {
+            UpdatePresence(site_id, presence, listener);
+          }
+        } catch (std::exception& e) {
+          LOG(ERROR) << raw->name() << " collaborator presence broke: "
+                     << e.what();
+        }
       }));
 }
 
@@ -165,12 +383,15 @@ void Buffer::AddCollaborator(SyncCollaboratorPtr&& collaborator) {
   absl::MutexLock lock(&mu_);
   SyncCollaborator* raw = collaborator.get();
   collaborators_.emplace_back(std::move(collaborator));
+  wanted_version_[raw] = version_;
   collaborator_threads_.emplace(
       absl::StrCat(raw->name(), ".collaborator"), std::thread([this, raw]() {
+        StartCollaboratorThread(absl::StrCat(raw->name(), ".collaborator"),
+                                raw->priority());
         try {
           RunSync(raw);
         } catch (std::exception& e) {
-          Log() << raw->name() << " collaborator sync broke: " << e.what();
+          LOG(ERROR) << raw->name() << " collaborator sync broke: " << e.what();
         }
         absl::MutexLock lock(&mu_);
         done_collaborators_.insert(raw);
@@ -179,63 +400,94 @@ void Buffer::AddCollaborator(SyncCollaboratorPtr&& collaborator) {
 
 namespace {
 struct Shutdown {};
+// how many times a non-interactive update may be overtaken before it blocks
+// interactive edits to get through
+constexpr int kMaxSpeculativeUpdates = 3;
 }  // namespace
 
 EditNotification Buffer::NextNotification(Collaborator* collaborator,
-                                          uint64_t* last_processed) {
+                                          uint64_t* last_processed,
+                                          CancellationToken* cancel) {
   auto all_edits_complete = [this]() {
     mu_.AssertHeld();
     return state_.shutdown &&
            declared_no_edit_collaborators_.size() == collaborators_.size();
   };
+  auto changed = [&]() {
+    mu_.AssertHeld();
+    return wanted_version_[collaborator] > *last_processed;
+  };
   auto processable = [&]() {
     mu_.AssertHeld();
-    Log() << filename_.string() << ":" << collaborator->name()
-          << ": v=" << version_ << " last=" << *last_processed
-          << " shutdown=" << state_.shutdown << " no_edits="
-          << NamesFromCollaborators(declared_no_edit_collaborators_)
-          << " from=" << NamesFromCollaborators(collaborators_);
-    return version_ != *last_processed || all_edits_complete();
+    LOG(VERBOSE) << filename_.string() << ":" << collaborator->name()
+                 << ": v=" << version_
+                 << " wanted=" << wanted_version_[collaborator]
+                 << " last=" << *last_processed
+                 << " shutdown=" << state_.shutdown << " no_edits="
+                 << NamesFromCollaborators(declared_no_edit_collaborators_)
+                 << " from=" << NamesFromCollaborators(collaborators_);
+    return (changed() && (state_.shutdown || !Parked(collaborator))) ||
+           all_edits_complete();
   };
-  // wait until something interesting to work on
-  mu_.LockWhen(absl::Condition(&processable));
-  if (version_ != *last_processed) {
-    absl::Time first_saw_change = absl::Now();
-    if (!state_.shutdown) {
+  // wait until something interesting to work on: only rechecked when the
+  // state changes, rather than on every release of mu_
+  mu_.Lock();
+  {
+    StateWaiter waiter(&state_waiters_, collaborator);
+    while (!processable()) waiter.Wait(&mu_);
+  }
+  if (changed()) {
+    if (!state_.shutdown && *last_processed != 0) {
+      // debounce: hold the notification until the buffer has been idle long
+      // enough, or we've waited long enough since first seeing the change
+      absl::Time first_saw_change = absl::Now();
       absl::Time last_used_at_start;
       do {
-        Log() << collaborator->name() << " last_used: " << last_used_;
         last_used_at_start = last_used_;
-        absl::Duration idle_time = absl::Now() - last_used_;
-        absl::Duration time_from_change = absl::Now() - first_saw_change;
-        Log() << collaborator->name() << " idle_time: " << idle_time
-              << " time_from_change: " << time_from_change;
-        if (*last_processed != 0 &&
-            mu_.AwaitWithTimeout(
-                absl::Condition(&state_.shutdown),
-                std::max(collaborator->push_delay_from_idle() - idle_time,
-                         collaborator->push_delay_from_start() -
-                             time_from_change))) {
-          break;
-        }
-      } while (last_used_ != last_used_at_start && !state_.shutdown);
+        absl::Time deadline =
+            std::max(last_used_ + collaborator->push_delay_from_idle(),
+                     first_saw_change + collaborator->push_delay_from_start());
+        if (!AwaitDeadline(collaborator, deadline)) break;
+      } while (last_used_ != last_used_at_start);
     }
     *last_processed = version_;
     EditNotification notification = state_;
+    notification.acked = acked_[collaborator];
+    if (cancel) in_flight_[collaborator] = *cancel;
     collaborator->MarkRequest();
     mu_.Unlock();
-    Log() << collaborator->name() << " notify";
+    LOG(VERBOSE) << collaborator->name() << " notify";
     return notification;
   } else {
     assert(all_edits_complete());
     done_collaborators_.insert(collaborator);
     mu_.Unlock();
-    Log() << filename_.string() << ":" << collaborator->name()
-          << " throws shutdown from NextNotification";
+    LOG(INFO) << filename_.string() << ":" << collaborator->name()
+              << " throws shutdown from NextNotification";
     throw Shutdown();
   }
 }
 
+bool Buffer::AwaitDeadline(const Collaborator* collaborator,
+                           absl::Time deadline) {
+  if (deadline <= absl::Now()) return !state_.shutdown;
+  bool expired = false;
+  StateWaiter waiter(&state_waiters_, collaborator);
+  TimerWheel::Handle timer = TimerWheel::Get()->Schedule(
+      deadline, [this, &expired, &waiter]() {
+        absl::MutexLock lock(&mu_);
+        expired = true;
+        waiter.cv()->Signal();
+      });
+  while (!expired && !state_.shutdown) waiter.Wait(&mu_);
+  if (expired) return !state_.shutdown;
+  // the timer may be waiting on mu_ to fire, so cancel without holding it
+  mu_.Unlock();
+  TimerWheel::Get()->Cancel(timer);
+  mu_.Lock();
+  return false;
+}
+
 static bool HasUpdates(const EditResponse& response) {
   return response.become_loaded || response.referenced_file_changed ||
          !response.content_updates.commands().empty();
@@ -248,46 +500,127 @@ void IntegrateResponse(const EditResponse& response, EditNotification* state) {
 }
 
 void Buffer::UpdateState(Collaborator* collaborator, bool become_used,
+                         const CommandSet* commands,
                          std::function<void(EditNotification& state)> f) {
-  auto updatable = [this]() {
+  // edits made directly on the buffer (not by a collaborator) come from the
+  // user
+  const CollaboratorPriority priority =
+      collaborator ? collaborator->priority()
+                   : CollaboratorPriority::INTERACTIVE;
+  const int rank = static_cast<int>(priority);
+  const bool interactive = priority == CollaboratorPriority::INTERACTIVE;
+  auto not_updating = [this]() {
     mu_.AssertHeld();
     return !updating_;
   };
+  auto updatable = [this, rank, interactive]() {
+    mu_.AssertHeld();
+    if (updating_) return false;
+    if (interactive) return true;
+    if (speculating_) return false;
+    for (int p = 0; p < rank; p++) {
+      if (update_waiters_[p] != 0) return false;
+    }
+    return true;
+  };
 
-  // get the update lock
-  mu_.LockWhen(absl::Condition(&updatable));
+  // get the update lock, letting more urgent waiters go first
+  mu_.Lock();
+  update_waiters_[rank]++;
+  mu_.Await(absl::Condition(&updatable));
+  update_waiters_[rank]--;
   if (collaborator) collaborator->MarkChange();
-  updating_ = true;
-  auto state = state_;
-  mu_.Unlock();
 
-  f(state);
+  // interactive edits are small, so they hold the update lock while applying.
+  // everything else is applied speculatively: an interactive edit may commit
+  // in the meantime, in which case the (pure) update is redone on top of it
+  bool exclusive = interactive;
+  if (exclusive) {
+    updating_ = true;
+  } else {
+    speculating_ = true;
+  }
+  EditNotification state;
+  ChangeSummary change;
+  absl::Duration integrate_time;
+  for (int attempt = 1;; attempt++) {
+    const uint64_t base_version = content_version_;
+    EditNotification base = state_;
+    mu_.Unlock();
+    // (an overtaken attempt is released here, outside mu_)
+    state = std::move(base);
+    change = SummarizeCommands(state.content, commands);
+
+    absl::Time integrate_start = absl::Now();
+    f(state);
+    integrate_time += absl::Now() - integrate_start;
+
+    if (exclusive) {
+      mu_.Lock();
+    } else {
+      mu_.LockWhen(absl::Condition(&not_updating));
+    }
+    if (content_version_ == base_version) break;
+    if (!exclusive && attempt >= kMaxSpeculativeUpdates) {
+      // overtaken too often: stop interactive edits for one last pass
+      mu_.Await(absl::Condition(&not_updating));
+      exclusive = true;
+      updating_ = true;
+    }
+  }
 
   // commit the update and advance time
-  mu_.Lock();
+  LOG(VERBOSE) << filename_.string() << ":"
+               << (collaborator ? collaborator->name() : "<nil>")
+               << " updates version";
 
-  Log() << filename_.string() << ":"
-        << (collaborator ? collaborator->name() : "<nil>")
-        << " updates version";
-
-  updating_ = false;
+  if (exclusive) updating_ = false;
+  if (!interactive) speculating_ = false;
   version_++;
+  content_version_++;
+  if (collaborator) {
+    collaborator->mutable_stats()->integrate.Add(integrate_time);
+    if (commands && !commands->commands().empty()) acked_[collaborator]++;
+  }
+  change.always = state.fully_loaded != state_.fully_loaded || state.shutdown;
+  change.referenced_files =
+      state.referenced_file_version != state_.referenced_file_version;
+  // only collaborators interested in the change are woken and have their
+  // passes over the old state cancelled
+  std::set<const Collaborator*> interested = MarkInterested(change);
 
   if (!done_collaborators_.empty()) {
-    Log() << "DONE: " << NamesFromCollaborators(done_collaborators_);
+    LOG(VERBOSE) << "DONE: " << NamesFromCollaborators(done_collaborators_);
   }
 
   declared_no_edit_collaborators_ = done_collaborators_;
-  state_ = state;
+  if (state.shutdown != state_.shutdown ||
+      !state.content.SameContentIdentity(state_.content)) {
+    for (auto it = in_flight_.begin(); it != in_flight_.end();) {
+      if (interested.count(it->first)) {
+        it->second.Cancel();
+        it = in_flight_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  // presence may have moved on since the update started
+  state.presence = state_.presence;
+  // the previous state is released once we leave, not while holding mu_
+  std::swap(state_, state);
   if (become_used) {
     last_used_ = absl::Now();
   }
+  WakeWaiters(interested);
   mu_.Unlock();
 }
 
-void Buffer::PushChanges(const CommandSet* commands, bool become_used) {
-  PublishToListeners(commands, nullptr);
-  UpdateState(nullptr, become_used,
+void Buffer::PushChanges(const CommandSet* commands, bool become_used,
+                         int origin_site) {
+  TraceSpan span("Buffer::PushChanges");
+  PublishToListeners(commands, nullptr, origin_site, "push");
+  UpdateState(nullptr, become_used, commands,
               [become_used, commands](EditNotification& state) {
                 state.content = state.content.Integrate(*commands);
               });
@@ -300,44 +633,107 @@ AnnotatedString Buffer::ContentSnapshot() {
 
 void Buffer::SinkResponse(Collaborator* collaborator,
                           const EditResponse& response) {
+  TraceSpan span("Buffer::SinkResponse");
   {
     absl::MutexLock lock(&mu_);
     collaborator->MarkResponse();
   }
 
+  if (response.presence) {
+    UpdatePresence(site_.site_id(), response.presence, nullptr);
+  }
+
   if (HasUpdates(response)) {
-    PublishToListeners(&response.content_updates, nullptr);
+    PublishToListeners(&response.content_updates, nullptr, site_.site_id(),
+                       collaborator->name());
     UpdateState(collaborator, response.become_used,
-                [&](EditNotification& state) {
-                  Log() << collaborator->name() << " integrating";
+                &response.content_updates, [&](EditNotification& state) {
+                  LOG(VERBOSE) << collaborator->name() << " integrating";
                   IntegrateResponse(response, &state);
                 });
   } else {
-    Log() << collaborator->name() << " gives an empty update";
+    LOG(VERBOSE) << collaborator->name() << " gives an empty update";
     absl::MutexLock lock(&mu_);
     if (response.become_used) {
       last_used_ = absl::Now();
     }
     declared_no_edit_collaborators_.insert(collaborator);
+    WakeWaiters();
   }
 
+  MaybeDropEvictedAnnotations(collaborator);
+
   if (response.done) {
     absl::MutexLock lock(&mu_);
     done_collaborators_.insert(collaborator);
     declared_no_edit_collaborators_.insert(collaborator);
-    Log() << filename_.string() << ":" << collaborator->name()
-          << " throws shutdown from SinkResponse";
+    WakeWaiters();
+    LOG(INFO) << filename_.string() << ":" << collaborator->name()
+              << " throws shutdown from SinkResponse";
     throw Shutdown();
   }
 }
 
+void Buffer::MaybeDropEvictedAnnotations(Collaborator* collaborator) {
+  CommandSet commands;
+  {
+    absl::MutexLock lock(&mu_);
+    if (!evicted_site_id_) return;
+    refreshed_collaborators_.insert(collaborator);
+    if (!collaborators_started_) return;
+    for (const auto& c : collaborators_) {
+      if (dynamic_cast<SyncCollaborator*>(c.get()) != nullptr &&
+          !Parked(c.get()) && refreshed_collaborators_.count(c.get()) == 0) {
+        return;
+      }
+    }
+    Site evicted_site(evicted_site_id_);
+    state_.content.MakeDeleteAttributesBySite(&commands, evicted_site);
+    evicted_site_id_.reset();
+    refreshed_collaborators_.clear();
+  }
+  if (!commands.commands().empty()) PushChanges(&commands, false);
+}
+
 void Buffer::PublishToListeners(const CommandSet* commands,
-                                BufferListener* except) {
+                                BufferListener* except, int origin_site,
+                                const char* source) {
+  static const VersionVector kNoVersion;
+  absl::MutexLock lock(&mu_);
+  if (edit_trace_) edit_trace_->Append(source, origin_site, *commands);
+  const VersionVector& version =
+      command_log_ ? command_log_->Append(origin_site, *commands) : kNoVersion;
+  for (auto* l : listeners_) {
+    if (l == except) continue;
+    l->Update(commands, version);
+  }
+}
+
+void Buffer::UpdatePresence(int site_id,
+                            const absl::optional<SitePresence>& presence,
+                            BufferListener* except) {
+  TraceSpan span("Buffer::UpdatePresence");
   absl::MutexLock lock(&mu_);
+  if (state_.shutdown) return;
+  auto it = state_.presence.find(site_id);
+  if (presence) {
+    // stale, or our own update coming back
+    if (it != state_.presence.end() && it->second.seq >= presence->seq) return;
+    state_.presence[site_id] = *presence;
+  } else {
+    if (it == state_.presence.end()) return;
+    state_.presence.erase(it);
+  }
   for (auto* l : listeners_) {
     if (l == except) continue;
-    l->Update(commands);
+    l->UpdatePresence(site_id, presence);
   }
+  // bypasses UpdateState: no content changes, so nothing to integrate and no
+  // passes to cancel
+  version_++;
+  ChangeSummary change;
+  change.presence = true;
+  WakeWaiters(MarkInterested(change));
 }
 
 void Buffer::RunPush(AsyncCollaborator* collaborator) {
@@ -365,8 +761,15 @@ void Buffer::RunSync(SyncCollaborator* collaborator) {
   uint64_t processed_version = 0;
   try {
     for (;;) {
-      SinkResponse(collaborator, collaborator->Edit(NextNotification(
-                                     collaborator, &processed_version)));
+      CancellationToken cancel;
+      EditNotification notification =
+          NextNotification(collaborator, &processed_version, &cancel);
+      EditResponse response;
+      {
+        TraceSpan span(collaborator->name());
+        response = collaborator->Edit(notification, cancel);
+      }
+      SinkResponse(collaborator, response);
     }
   } catch (Shutdown) {
     return;
@@ -389,10 +792,25 @@ std::vector<std::string> Buffer::ProfileData() const {
     report("chg", c->last_change());
     report("rsp", c->last_response());
     report("rqst", c->last_request());
+    auto hist = [&out, this, &c](const char* name, const Histogram& h) {
+      auto snapshot = h.Take();
+      if (snapshot.count() == 0) return;
+      out.emplace_back(absl::StrCat(filename().string(), ":", c->name(), ":",
+                                    name, ": ", snapshot.ToString()));
+    };
+    hist("wait", c->stats().queue_wait);
+    hist("run", c->stats().run);
+    hist("intg", c->stats().integrate);
   }
   return out;
 }
 
+void Buffer::ForEachCollaborator(
+    std::function<void(const Collaborator&)> f) const {
+  absl::MutexLock lock(&mu_);
+  for (const auto& c : collaborators_) f(*c);
+}
+
 BufferListener::BufferListener(Buffer* buffer) : buffer_(buffer) {}
 
 BufferListener::~BufferListener() {
@@ -401,27 +819,60 @@ BufferListener::~BufferListener() {
 }
 
 void BufferListener::Start(
-    std::function<void(const AnnotatedString&)> initial) {
+    std::function<void(const AnnotatedString&, const CommandLog*)> initial) {
   absl::MutexLock lock(&buffer_->mu_);
   buffer_->listeners_.insert(this);
-  initial(buffer_->state_.content);
+  initial(buffer_->state_.content, buffer_->command_log_.get());
 }
 
 std::unique_ptr<BufferListener> Buffer::Listen(
-    std::function<void(const AnnotatedString&)> initial,
-    std::function<void(const CommandSet*)> update) {
+    std::function<void(const AnnotatedString&, const CommandLog*)> initial,
+    std::function<void(const CommandSet*, const VersionVector&)> update) {
   class FnListener final : public BufferListener {
    public:
-    FnListener(Buffer* buffer, std::function<void(const CommandSet*)> update)
+    FnListener(
+        Buffer* buffer,
+        std::function<void(const CommandSet*, const VersionVector&)> update)
         : BufferListener(buffer), update_(update) {}
 
-    void Update(const CommandSet* updates) { update_(updates); }
+    void Update(const CommandSet* updates, const VersionVector& version) {
+      update_(updates, version);
+    }
 
    private:
-    std::function<void(const CommandSet*)> update_;
+    std::function<void(const CommandSet*, const VersionVector&)> update_;
   };
 
   std::unique_ptr<BufferListener> listener(new FnListener(this, update));
   listener->Start(initial);
   return listener;
 }
+
+std::unique_ptr<BufferListener> Buffer::ListenPresence(
+    std::function<void(int site_id,
+                       const absl::optional<SitePresence>& presence)>
+        update) {
+  class PresenceListener final : public BufferListener {
+   public:
+    PresenceListener(
+        Buffer* buffer,
+        std::function<void(int, const absl::optional<SitePresence>&)> update)
+        : BufferListener(buffer), update_(update) {}
+
+    void Update(const CommandSet* updates, const VersionVector& version) {}
+    void UpdatePresence(int site_id,
+                        const absl::optional<SitePresence>& presence) {
+      update_(site_id, presence);
+    }
+
+   private:
+    std::function<void(int, const absl::optional<SitePresence>&)> update_;
+  };
+
+  std::unique_ptr<BufferListener> listener(new PresenceListener(this, update));
+  listener->Start([this, &update](const AnnotatedString&, const CommandLog*) {
+    mu_.AssertHeld();
+    for (const auto& p : state_.presence) update(p.first, p.second);
+  });
+  return listener;
+}
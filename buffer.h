@@ -14,20 +14,44 @@
 #pragma once
 
 #include <boost/filesystem.hpp>
+#include <map>
+#include <set>
 #include <thread>
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/types/optional.h"
 #include "annotated_string.h"
+#include "cancellation_token.h"
+#include "command_log.h"
+#include "edit_trace.h"
+#include "histogram.h"
 #include "selector.h"
 
 class Project;
 
+// where one site's cursor and selection are: these change with every key
+// press and mean nothing once the site leaves, so they're kept outside the
+// CRDT, last writer wins
+struct SitePresence {
+  ID cursor;
+  // ID() if nothing is selected
+  ID selection_anchor;
+  // increases with each update from the site
+  uint64_t seq = 0;
+};
+
+// by site id
+typedef std::map<int, SitePresence> PresenceMap;
+
 struct EditNotification {
   bool fully_loaded = false;
   bool shutdown = false;
   uint64_t referenced_file_version = 0;
   AnnotatedString content;
+  PresenceMap presence;
+  // how many responses with content_updates from the collaborator notified
+  // are integrated into content: anything it sent after those isn't yet
+  uint64_t acked = 0;
 };
 
 struct EditResponse {
@@ -36,6 +60,8 @@ struct EditResponse {
   bool become_loaded = false;
   bool referenced_file_changed = false;
   CommandSet content_updates;
+  // new presence for the buffer's site
+  absl::optional<SitePresence> presence;
 };
 
 void IntegrateResponse(const EditResponse& response, EditNotification* state);
@@ -48,26 +74,125 @@ class BufferListener {
 
  private:
   friend class Buffer;
-  virtual void Update(const CommandSet* updates) = 0;
-  void Start(std::function<void(const AnnotatedString&)> init);
+  // version is the buffer's log version once updates are included (empty if
+  // it keeps no log)
+  virtual void Update(const CommandSet* updates,
+                      const VersionVector& version) = 0;
+  // presence is empty if the site has gone
+  virtual void UpdatePresence(int site_id,
+                              const absl::optional<SitePresence>& presence) {}
+  void Start(
+      std::function<void(const AnnotatedString&, const CommandLog*)> init);
   BufferListener(Buffer* buffer);
 
   Buffer* const buffer_;
 };
 
+// who is waiting on a collaborator's work: when several want to commit at
+// once, lower values go first
+enum class CollaboratorPriority {
+  INTERACTIVE,  // a user is waiting on this (terminal, client mirror)
+  ANALYSIS,     // feeds what the user is looking at (tokens, diagnostics)
+  BACKGROUND,   // batch work (formatting, compiling, file io)
+};
+
+constexpr int kNumCollaboratorPriorities = 3;
+
+struct CollaboratorStats {
+  // from a change being committed until the collaborator is handed it
+  Histogram queue_wait;
+  // from being handed a change until a response comes back
+  Histogram run;
+  // applying a response to the buffer
+  Histogram integrate;
+};
+
+// which committed changes a collaborator wants to see; loading and shutdown
+// are always seen
+struct CollaboratorInterest {
+  // characters inserted or deleted
+  bool text = true;
+  bool referenced_files = true;
+  // cursors and selections of any site
+  bool presence = true;
+  // attributes and annotations of any type, or only those listed
+  bool all_attributes = true;
+  std::set<Attribute::DataCase> attributes;
+
+  // character changes (and optionally referenced files) only
+  static CollaboratorInterest Text(bool referenced_files) {
+    CollaboratorInterest interest;
+    interest.referenced_files = referenced_files;
+    interest.presence = false;
+    interest.all_attributes = false;
+    return interest;
+  }
+
+  // attributes of the listed types only
+  static CollaboratorInterest Attributes(std::set<Attribute::DataCase> types) {
+    CollaboratorInterest interest;
+    interest.text = false;
+    interest.referenced_files = false;
+    interest.presence = false;
+    interest.all_attributes = false;
+    interest.attributes = std::move(types);
+    return interest;
+  }
+};
+
+// what a committed update changed, to match against collaborator interests
+struct ChangeSummary {
+  // loading or shutdown changed: everyone sees this
+  bool always = false;
+  bool text = false;
+  bool referenced_files = false;
+  bool presence = false;
+  std::set<Attribute::DataCase> attributes;
+
+  bool InterestedBy(const CollaboratorInterest& interest) const {
+    if (always) return true;
+    if (text && interest.text) return true;
+    if (referenced_files && interest.referenced_files) return true;
+    if (presence && interest.presence) return true;
+    if (attributes.empty()) return false;
+    if (interest.all_attributes) return true;
+    for (auto dc : attributes) {
+      if (interest.attributes.count(dc)) return true;
+    }
+    return false;
+  }
+};
+
 class Collaborator {
  public:
   virtual ~Collaborator() {}
 
   const char* name() const { return name_; }
+  CollaboratorPriority priority() const { return priority_; }
+  const CollaboratorInterest& interest() const { return interest_; }
   absl::Duration push_delay_from_idle() const { return push_delay_from_idle_; }
   absl::Duration push_delay_from_start() const {
     return push_delay_from_start_;
   }
 
-  void MarkRequest() { last_request_ = absl::Now(); }
-  void MarkResponse() { last_response_ = absl::Now(); }
+  void MarkRequest() {
+    last_request_ = absl::Now();
+    if (pending_since_ != absl::InfiniteFuture()) {
+      stats_.queue_wait.Add(last_request_ - pending_since_);
+      pending_since_ = absl::InfiniteFuture();
+    }
+  }
+  void MarkResponse() {
+    last_response_ = absl::Now();
+    stats_.run.Add(last_response_ - last_request_);
+  }
   void MarkChange() { last_change_ = absl::Now(); }
+  void MarkPending(absl::Time changed) {
+    if (pending_since_ == absl::InfiniteFuture()) pending_since_ = changed;
+  }
+
+  CollaboratorStats* mutable_stats() { return &stats_; }
+  const CollaboratorStats& stats() const { return stats_; }
 
   const absl::Time& last_response() const { return last_response_; }
   const absl::Time& last_request() const { return last_request_; }
@@ -75,19 +200,30 @@ class Collaborator {
 
  protected:
   Collaborator(const char* name, absl::Duration push_delay_from_idle,
-               absl::Duration push_delay_from_start)
+               absl::Duration push_delay_from_start,
+               CollaboratorPriority priority)
       : name_(name),
+        priority_(priority),
         push_delay_from_idle_(push_delay_from_idle),
         push_delay_from_start_(push_delay_from_start) {}
 
+  // call from the constructor: defaults to everything
+  void set_interest(const CollaboratorInterest& interest) {
+    interest_ = interest;
+  }
+
  private:
   const char* const name_;
+  const CollaboratorPriority priority_;
+  CollaboratorInterest interest_;
   const absl::Duration push_delay_from_idle_;
   const absl::Duration push_delay_from_start_;
   absl::Time last_response_ = absl::Now();
   absl::Time last_request_ = absl::Now();
   absl::Time last_change_ = absl::Now();
+  absl::Time pending_since_ = absl::InfiniteFuture();
   absl::Duration last_notify_ = absl::Seconds(0);
+  CollaboratorStats stats_;
 };
 
 typedef std::unique_ptr<Collaborator> CollaboratorPtr;
@@ -99,8 +235,10 @@ class AsyncCollaborator : public Collaborator {
 
  protected:
   AsyncCollaborator(const char* name, absl::Duration push_delay_from_idle,
-                    absl::Duration push_delay_from_start)
-      : Collaborator(name, push_delay_from_idle, push_delay_from_start) {}
+                    absl::Duration push_delay_from_start,
+                    CollaboratorPriority priority)
+      : Collaborator(name, push_delay_from_idle, push_delay_from_start,
+                     priority) {}
 };
 
 class AsyncCommandCollaborator : public Collaborator {
@@ -109,23 +247,39 @@ class AsyncCommandCollaborator : public Collaborator {
   virtual void Push(const CommandSet* commands) = 0;
   // return true if successful, false if done
   virtual bool Pull(CommandSet* commands) = 0;
+  // presence of other sites is exchanged separately from commands
+  virtual void PushPresence(int site_id,
+                            const absl::optional<SitePresence>& presence) {}
+  // return true if successful, false if done (or presence isn't supported)
+  virtual bool PullPresence(int* site_id,
+                            absl::optional<SitePresence>* presence) {
+    return false;
+  }
 
  protected:
   AsyncCommandCollaborator(const char* name,
                            absl::Duration push_delay_from_idle,
-                           absl::Duration push_delay_from_start)
-      : Collaborator(name, push_delay_from_idle, push_delay_from_start) {}
+                           absl::Duration push_delay_from_start,
+                           CollaboratorPriority priority)
+      : Collaborator(name, push_delay_from_idle, push_delay_from_start,
+                     priority) {}
 };
 
 // a collaborator that only makes edits in response to edits
 class SyncCollaborator : public Collaborator {
  public:
-  virtual EditResponse Edit(const EditNotification& notification) = 0;
+  // cancel fires once the buffer's content moves past notification (or it
+  // shuts down): long running work should stop early, and results that
+  // can't be cheaply rebased onto the new content should be dropped
+  virtual EditResponse Edit(const EditNotification& notification,
+                            const CancellationToken& cancel) = 0;
 
  protected:
   SyncCollaborator(const char* name, absl::Duration push_delay_from_idle,
-                   absl::Duration push_delay_from_start)
-      : Collaborator(name, push_delay_from_idle, push_delay_from_start) {}
+                   absl::Duration push_delay_from_start,
+                   CollaboratorPriority priority)
+      : Collaborator(name, push_delay_from_idle, push_delay_from_start,
+                     priority) {}
 };
 
 typedef std::unique_ptr<AsyncCollaborator> AsyncCollaboratorPtr;
@@ -148,6 +302,14 @@ class Buffer {
       return *this;
     }
 
+    // restore a buffer evicted earlier in this process: content is its last
+    // state, site_id the site its collaborators annotated it with
+    Builder& SetEvictedState(const AnnotatedString& content, int site_id) {
+      initial_string_ = content;
+      evicted_site_id_ = site_id;
+      return *this;
+    }
+
     Builder& SetProject(Project* project) {
       project_ = project;
       return *this;
@@ -163,18 +325,28 @@ class Buffer {
       return *this;
     }
 
+    // keep the last max_commands commands published to listeners, so
+    // listeners rejoining can catch up from where they were
+    Builder& SetCommandLog(size_t max_commands) {
+      command_log_size_ = max_commands;
+      return *this;
+    }
+
     std::unique_ptr<Buffer> Make() {
       assert(filename_);
-      return std::unique_ptr<Buffer>(new Buffer(
-          project_, *filename_, initial_string_, site_id_, synthetic_));
+      return std::unique_ptr<Buffer>(
+          new Buffer(project_, *filename_, initial_string_, site_id_,
+                     evicted_site_id_, synthetic_, command_log_size_));
     }
 
    private:
     absl::optional<boost::filesystem::path> filename_;
     absl::optional<AnnotatedString> initial_string_;
     absl::optional<int> site_id_;
+    absl::optional<int> evicted_site_id_;
     Project* project_ = nullptr;
     bool synthetic_ = false;
+    size_t command_log_size_ = 0;
   };
 
   Buffer(const Buffer&) = delete;
@@ -194,58 +366,180 @@ class Buffer {
   const boost::filesystem::path& filename() const { return filename_; }
   bool read_only() const { return false; }
   bool synthetic() const { return synthetic_; }
+  // content came from an evicted buffer and already matches the file
+  bool restored() const { return restored_; }
   bool is_server() const { return project_ != nullptr; }
   bool is_client() const { return !is_server(); }
 
   std::vector<std::string> ProfileData() const;
+  void ForEachCollaborator(std::function<void(const Collaborator&)> f) const;
 
   static void RegisterCollaborator(
       std::function<void(Buffer*)> maybe_init_collaborator);
 
-  void PushChanges(const CommandSet* cmds, bool become_used);
+  // Collaborators added lazily are only created once a client subscribes to
+  // their output (named for the collaborator), and are parked - skipping
+  // new content - while nobody is subscribed.
+  void AddLazyCollaborator(const std::string& output,
+                           std::function<void()> make_collaborator);
+
+  class Subscription {
+   public:
+    ~Subscription();
+
+    Subscription(const Subscription&) = delete;
+    Subscription& operator=(const Subscription&) = delete;
+
+   private:
+    friend class Buffer;
+    Subscription(const Buffer* buffer, const std::string& output)
+        : buffer_(buffer), output_(output) {}
+
+    const Buffer* const buffer_;
+    const std::string output_;
+  };
+
+  // subscribing doesn't change the buffer's content, so collaborators (which
+  // only see a const Buffer) can do it for what they display
+  std::unique_ptr<Subscription> Subscribe(const std::string& output) const;
+  // f is called with the outputs subscribed to now, and again whenever that
+  // set changes, until replaced (nullptr to stop): a client passes its own on
+  // to the server
+  void SetSubscriptionObserver(
+      std::function<void(const std::set<std::string>& outputs)> f) const;
+
+  void PushChanges(const CommandSet* cmds, bool become_used) {
+    PushChanges(cmds, become_used, site_.site_id());
+  }
+  // origin_site is the site that sent cmds, for the command log
+  void PushChanges(const CommandSet* cmds, bool become_used, int origin_site);
   AnnotatedString ContentSnapshot();
 
+  // initial is given the content, and the command log (if kept) to work out
+  // what a rejoining listener is missing
   std::unique_ptr<BufferListener> Listen(
-      std::function<void(const AnnotatedString&)> initial,
-      std::function<void(const CommandSet*)> update);
+      std::function<void(const AnnotatedString& content,
+                         const CommandLog* log)>
+          initial,
+      std::function<void(const CommandSet* commands,
+                         const VersionVector& version)>
+          update);
+
+  // last writer (by seq) wins; an empty presence removes the site
+  void UpdatePresence(int site_id,
+                      const absl::optional<SitePresence>& presence) {
+    UpdatePresence(site_id, presence, nullptr);
+  }
+  // update is called for every site present now, then for every change
+  std::unique_ptr<BufferListener> ListenPresence(
+      std::function<void(int site_id,
+                         const absl::optional<SitePresence>& presence)>
+          update);
 
  private:
   friend class BufferListener;
 
   Buffer(Project* project, const boost::filesystem::path& filename,
          absl::optional<AnnotatedString> initial_string,
-         absl::optional<int> site_id, bool synthetic);
+         absl::optional<int> site_id, absl::optional<int> evicted_site_id,
+         bool synthetic, size_t command_log_size);
 
   void AddCollaborator(AsyncCollaboratorPtr&& collaborator);
   void AddCollaborator(AsyncCommandCollaboratorPtr&& collaborator);
   void AddCollaborator(SyncCollaboratorPtr&& collaborator);
 
+  // if cancel is non-null it's fired when the returned state is superseded
   EditNotification NextNotification(Collaborator* collaborator,
-                                    uint64_t* last_processed);
+                                    uint64_t* last_processed,
+                                    CancellationToken* cancel = nullptr);
+  // wait (with mu_ held) until deadline passes; false if shut down first
+  bool AwaitDeadline(const Collaborator* collaborator, absl::Time deadline)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
   void SinkResponse(Collaborator* collaborator, const EditResponse& response);
+  // once every sync collaborator has had a pass over restored content, drop
+  // the annotations carried over from before eviction
+  void MaybeDropEvictedAnnotations(Collaborator* collaborator);
 
   void RunPush(AsyncCollaborator* collaborator);
   void RunPull(AsyncCollaborator* collaborator);
   void RunSync(SyncCollaborator* collaborator);
 
+  bool Parked(const Collaborator* collaborator) const
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // tell the subscription observer, if any, what's now subscribed
+  void NotifySubscriptionObserver() const;
+  // signal threads waiting in NextNotification (or for shutdown) to recheck
+  // the state; call after changing anything they wait on
+  void WakeWaiters() const EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // commands is what f integrates (if anything), used to find out which
+  // collaborators are interested in the update
   void UpdateState(Collaborator* collaborator, bool become_used,
-                   std::function<void(EditNotification& new_state)>);
+                   const CommandSet* commands,
+                   std::function<void(EditNotification& new_state)> f);
+  // source names what produced command_set, for the edit trace
   void PublishToListeners(const CommandSet* command_set,
-                          BufferListener* except);
+                          BufferListener* except, int origin_site,
+                          const char* source);
+  void UpdatePresence(int site_id, const absl::optional<SitePresence>& presence,
+                      BufferListener* except);
+  // advance the version for collaborators interested in change, returning
+  // them
+  std::set<const Collaborator*> MarkInterested(const ChangeSummary& change)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // WakeWaiters, but only for interested collaborators
+  void WakeWaiters(const std::set<const Collaborator*>& interested)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   Project* const project_;
   mutable absl::Mutex mu_;
   const bool synthetic_;
+  const bool restored_;
+  // all collaborators have been added
+  bool collaborators_started_ GUARDED_BY(mu_);
+  // site of annotations restored from an evicted buffer, until refreshed
+  absl::optional<int> evicted_site_id_ GUARDED_BY(mu_);
+  std::set<Collaborator*> refreshed_collaborators_ GUARDED_BY(mu_);
   uint64_t version_ GUARDED_BY(mu_);
+  // like version_, but not advanced by presence changes (which updates
+  // needn't be redone for)
+  uint64_t content_version_ GUARDED_BY(mu_);
+  // the last version each collaborator is interested in
+  std::map<const Collaborator*, uint64_t> wanted_version_ GUARDED_BY(mu_);
   std::set<Collaborator*> declared_no_edit_collaborators_ GUARDED_BY(mu_);
   std::set<Collaborator*> done_collaborators_ GUARDED_BY(mu_);
   std::set<BufferListener*> listeners_ GUARDED_BY(mu_);
+  // what's been published to listeners, if kept
+  std::unique_ptr<CommandLog> command_log_ GUARDED_BY(mu_);
+  // with --edit_trace_dir
+  std::unique_ptr<EditTraceWriter> edit_trace_ GUARDED_BY(mu_);
   bool updating_ GUARDED_BY(mu_);
+  // a non-interactive update is being applied outside the update lock
+  bool speculating_ GUARDED_BY(mu_);
+  // threads waiting for the update lock, by priority
+  int update_waiters_[kNumCollaboratorPriorities] GUARDED_BY(mu_);
   absl::Time last_used_ GUARDED_BY(mu_);
   const boost::filesystem::path filename_;
   EditNotification state_ GUARDED_BY(mu_);
+  // per collaborator, responses with content_updates integrated so far
+  std::map<const Collaborator*, uint64_t> acked_ GUARDED_BY(mu_);
+  // threads waiting for the state to change, and the collaborator each
+  // waits for (null if it waits for any change)
+  std::map<absl::CondVar*, const Collaborator*> state_waiters_ GUARDED_BY(mu_);
+  // passes working from the current content
+  std::map<Collaborator*, CancellationToken> in_flight_ GUARDED_BY(mu_);
   std::vector<CollaboratorPtr> collaborators_ GUARDED_BY(mu_);
   std::map<std::string, std::thread> collaborator_threads_ GUARDED_BY(mu_);
+  // outputs produced by lazy collaborators
+  std::set<std::string> lazy_outputs_ GUARDED_BY(mu_);
+  // lazy collaborators nobody has subscribed to yet, by output
+  mutable std::map<std::string, std::function<void()>> unstarted_collaborators_
+      GUARDED_BY(mu_);
+  mutable std::map<std::string, int> subscribers_ GUARDED_BY(mu_);
+  // held while the observer runs, so it's never called once replaced
+  mutable absl::Mutex subscription_observer_mu_ ACQUIRED_BEFORE(mu_);
+  mutable std::function<void(const std::set<std::string>&)>
+      subscription_observer_ GUARDED_BY(subscription_observer_mu_);
   std::thread init_thread_;
   mutable Site site_;
 };
@@ -271,3 +565,22 @@ class Buffer {
   IMPL_COLLABORATOR(name, buffer_arg, true)
 #define SERVER_COLLABORATOR(name, buffer_arg) \
   IMPL_COLLABORATOR(name, buffer_arg, false)
+
+// a server collaborator that runs only while a client subscribes to output
+#define LAZY_SERVER_COLLABORATOR(name, output, buffer_arg)               \
+  namespace {                                                            \
+  class name##_impl {                                                    \
+   public:                                                               \
+    static bool ShouldAdd(const Buffer* buffer_arg);                     \
+    name##_impl() {                                                      \
+      Buffer::RegisterCollaborator([](Buffer* buffer) {                  \
+        if (buffer->is_server() && ShouldAdd(buffer)) {                  \
+          buffer->AddLazyCollaborator(                                   \
+              output, [buffer]() { buffer->MakeCollaborator<name>(); }); \
+        }                                                                \
+      });                                                                \
+    }                                                                    \
+  };                                                                     \
+  name##_impl impl;                                                      \
+  }                                                                      \
+  bool name##_impl::ShouldAdd(const Buffer* buffer_arg)
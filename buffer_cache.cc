@@ -0,0 +1,142 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffer_cache.h"
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "absl/strings/str_cat.h"
+#include "log.h"
+
+namespace {
+
+bool ReadFile(const boost::filesystem::path& path, std::string* out) {
+  std::ifstream in(path.string(), std::ios::binary);
+  if (!in) return false;
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  *out = ss.str();
+  return true;
+}
+
+uint16_t MaxSiteID(const AnnotatedStringMsg& msg) {
+  uint16_t max = 0;
+  auto see = [&max](uint64_t id) {
+    max = std::max(max, static_cast<uint16_t>(ID(id).site));
+  };
+  for (const auto& c : msg.chars()) see(c.id());
+  for (const auto& a : msg.attributes()) see(a.id());
+  for (const auto& a : msg.annotations()) see(a.id());
+  for (uint64_t id : msg.graveyard()) see(id);
+  return max;
+}
+
+}  // namespace
+
+BufferStateCache::BufferStateCache(const boost::filesystem::path& dir,
+                                   CompileArgs args, absl::Duration max_age)
+    : dir_(dir), args_(std::move(args)) {
+  boost::filesystem::create_directories(dir_);
+  const std::time_t oldest = absl::ToTimeT(absl::Now() - max_age);
+  boost::system::error_code ec;
+  for (boost::filesystem::directory_iterator it(dir_, ec), end; it != end;
+       it.increment(ec)) {
+    if (boost::filesystem::last_write_time(it->path(), ec) < oldest) {
+      boost::filesystem::remove(it->path(), ec);
+    }
+  }
+}
+
+uint64_t BufferStateCache::Hash(const std::string& data) {
+  // FNV-1a
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : data) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+boost::filesystem::path BufferStateCache::EntryPath(
+    const boost::filesystem::path& path) const {
+  return dir_ / absl::StrCat(absl::Hex(Hash(path.string())), ".pb");
+}
+
+uint64_t BufferStateCache::ArgsHash(const boost::filesystem::path& path) {
+  {
+    absl::MutexLock lock(&mu_);
+    auto it = args_hashes_.find(path);
+    if (it != args_hashes_.end()) return it->second;
+  }
+  std::string joined;
+  for (const auto& arg : args_(path)) {
+    joined += arg;
+    joined += '\0';
+  }
+  uint64_t hash = Hash(joined);
+  absl::MutexLock lock(&mu_);
+  args_hashes_[path] = hash;
+  return hash;
+}
+
+void BufferStateCache::Store(const boost::filesystem::path& path,
+                             const AnnotatedString& content,
+                             uint16_t site_id) {
+  EvictedBufferMsg msg;
+  *msg.mutable_content() = content.AsProto();
+  msg.set_site_id(site_id);
+  msg.set_content_hash(Hash(content.Render()));
+  msg.set_args_hash(ArgsHash(path));
+  // written aside and renamed, so a crash can't leave half an entry
+  auto entry_path = EntryPath(path);
+  auto tmp_path = entry_path;
+  tmp_path += absl::StrCat(".", getpid(), ".tmp");
+  {
+    std::ofstream out(tmp_path.string(), std::ios::binary | std::ios::trunc);
+    if (!msg.SerializeToOstream(&out) || !out.flush()) {
+      LOG(ERROR) << "Failed caching state of " << path;
+      boost::system::error_code ec;
+      boost::filesystem::remove(tmp_path, ec);
+      return;
+    }
+  }
+  boost::system::error_code ec;
+  boost::filesystem::rename(tmp_path, entry_path, ec);
+  if (ec) LOG(ERROR) << "Failed caching state of " << path << ": " << ec;
+}
+
+absl::optional<BufferStateCache::Entry> BufferStateCache::Load(
+    const boost::filesystem::path& path) {
+  std::string serialized;
+  if (!ReadFile(EntryPath(path), &serialized)) return absl::nullopt;
+  EvictedBufferMsg msg;
+  if (!msg.ParseFromString(serialized)) return absl::nullopt;
+  std::string on_disk;
+  if (!ReadFile(path, &on_disk)) return absl::nullopt;
+  // edited by something else since, or compiled differently: start over
+  if (msg.content_hash() != Hash(on_disk)) return absl::nullopt;
+  if (msg.args_hash() != ArgsHash(path)) {
+    LOG(INFO) << "Compile args for " << path << " changed: not restoring";
+    return absl::nullopt;
+  }
+  const uint16_t max_site_id =
+      std::max(MaxSiteID(msg.content()), static_cast<uint16_t>(msg.site_id()));
+  if (!Site::ReserveThrough(max_site_id)) {
+    LOG(INFO) << "Cached state of " << path << " uses site " << max_site_id
+              << ", too near the last: not restoring";
+    return absl::nullopt;
+  }
+  return Entry{AnnotatedString::FromProto(msg.content()),
+               static_cast<uint16_t>(msg.site_id())};
+}
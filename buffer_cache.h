@@ -0,0 +1,69 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "annotated_string.h"
+
+// On-disk store for the state of buffers the server has closed (evicted, or
+// open when it exited), so reopening one - in this process or a later one -
+// starts with its last annotations instead of re-reading the file and
+// waiting for collaborators. An entry is only good while the file still has
+// the content it was stored with and the file's compile args haven't
+// changed.
+class BufferStateCache {
+ public:
+  struct Entry {
+    AnnotatedString content;
+    uint16_t site_id;
+  };
+
+  // the compile args a file's annotations depend on (empty if none)
+  typedef std::function<std::vector<std::string>(
+      const boost::filesystem::path& path)>
+      CompileArgs;
+
+  // entries untouched for max_age are dropped on construction
+  BufferStateCache(const boost::filesystem::path& dir, CompileArgs args,
+                   absl::Duration max_age);
+
+  BufferStateCache(const BufferStateCache&) = delete;
+  BufferStateCache& operator=(const BufferStateCache&) = delete;
+
+  void Store(const boost::filesystem::path& path,
+             const AnnotatedString& content, uint16_t site_id);
+  // the entry for path if it's still good; the sites it has ids from are
+  // reserved, so they can't clash with sites made afterwards
+  absl::optional<Entry> Load(const boost::filesystem::path& path);
+
+  // stable across processes and builds (entries outlive both)
+  static uint64_t Hash(const std::string& data);
+
+ private:
+  boost::filesystem::path EntryPath(const boost::filesystem::path& path) const;
+  uint64_t ArgsHash(const boost::filesystem::path& path);
+
+  const boost::filesystem::path dir_;
+  const CompileArgs args_;
+  absl::Mutex mu_;
+  // working out compile args can mean running the compiler: once per path
+  std::map<boost::filesystem::path, uint64_t> args_hashes_ GUARDED_BY(mu_);
+};
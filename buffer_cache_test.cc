@@ -0,0 +1,106 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffer_cache.h"
+#include <fstream>
+#include "gtest/gtest.h"
+
+namespace {
+
+boost::filesystem::path WriteSource(const std::string& text) {
+  auto path = boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path("buffer-cache-%%%%-%%%%.cc");
+  std::ofstream(path.string()) << text;
+  return path;
+}
+
+AnnotatedString MakeString(Site* site, const std::string& text) {
+  CommandSet cmds;
+  AnnotatedString::MakeRawInsert(&cmds, site, text, AnnotatedString::Begin(),
+                                 AnnotatedString::End());
+  return AnnotatedString().Integrate(cmds);
+}
+
+}  // namespace
+
+class BufferStateCacheTest : public ::testing::Test {
+ protected:
+  BufferStateCacheTest()
+      : dir_(boost::filesystem::temp_directory_path() /
+             boost::filesystem::unique_path("buffer-cache-%%%%-%%%%")) {}
+  ~BufferStateCacheTest() { boost::filesystem::remove_all(dir_); }
+
+  std::unique_ptr<BufferStateCache> MakeCache() {
+    return std::unique_ptr<BufferStateCache>(new BufferStateCache(
+        dir_,
+        [this](const boost::filesystem::path&) {
+          return std::vector<std::string>{"-std=" + std_};
+        },
+        absl::Hours(24)));
+  }
+
+  const boost::filesystem::path dir_;
+  std::string std_ = "c++14";
+};
+
+TEST_F(BufferStateCacheTest, RoundTrip) {
+  Site site;
+  auto path = WriteSource("int x;\n");
+  MakeCache()->Store(path, MakeString(&site, "int x;\n"), site.site_id());
+  // as if by a restarted server
+  auto entry = MakeCache()->Load(path);
+  ASSERT_TRUE(entry);
+  EXPECT_EQ("int x;\n", entry->content.Render());
+  EXPECT_EQ(site.site_id(), entry->site_id);
+  boost::filesystem::remove(path);
+}
+
+TEST_F(BufferStateCacheTest, StaleEntryIsDropped) {
+  Site site;
+  auto path = WriteSource("int y;\n");
+  auto cache = MakeCache();
+  cache->Store(path, MakeString(&site, "int x;\n"), site.site_id());
+  EXPECT_FALSE(cache->Load(path));
+  boost::filesystem::remove(path);
+}
+
+TEST_F(BufferStateCacheTest, CompileArgsChangeDropsEntry) {
+  Site site;
+  auto path = WriteSource("int x;\n");
+  MakeCache()->Store(path, MakeString(&site, "int x;\n"), site.site_id());
+  std_ = "c++17";
+  EXPECT_FALSE(MakeCache()->Load(path));
+  boost::filesystem::remove(path);
+}
+
+TEST_F(BufferStateCacheTest, RestoredSitesAreNotReused) {
+  auto path = WriteSource("int x;\n");
+  // a site from an earlier process that got further than this one
+  Site old_site(absl::optional<int>(Site().site_id() + 100));
+  MakeCache()->Store(path, MakeString(&old_site, "int x;\n"),
+                     old_site.site_id());
+  ASSERT_TRUE(MakeCache()->Load(path));
+  EXPECT_GT(Site().site_id(), old_site.site_id());
+  boost::filesystem::remove(path);
+}
+
+TEST_F(BufferStateCacheTest, LastSiteIsNotRestored) {
+  auto path = WriteSource("int x;\n");
+  Site last_site(absl::optional<int>(65535));
+  MakeCache()->Store(path, MakeString(&last_site, "int x;\n"),
+                     last_site.site_id());
+  // restoring it would wrap the next site to 0
+  EXPECT_FALSE(MakeCache()->Load(path));
+  EXPECT_NE(0, Site().site_id());
+  boost::filesystem::remove(path);
+}
@@ -0,0 +1,135 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffer_registry.h"
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include "log.h"
+
+constexpr int BufferRegistry::kShards;
+constexpr size_t BufferRegistry::kMaxCachedNames;
+
+BufferRegistry::BufferRegistry(const boost::filesystem::path& root,
+                               Factory make)
+    : root_(boost::filesystem::weakly_canonical(
+          boost::filesystem::absolute(root))),
+      make_(std::move(make)) {}
+
+BufferRegistry::Shard* BufferRegistry::ShardFor(const std::string& key) {
+  return &shards_[std::hash<std::string>()(key) % kShards];
+}
+
+bool BufferRegistry::IsChildOfRoot(const boost::filesystem::path& path) const {
+  if (!path.has_filename()) return false;
+  std::string dir = path.parent_path().string();
+  std::string root = root_.string();
+  while (!root.empty() && root.back() == '/') root.pop_back();
+  if (dir.length() < root.length()) return false;
+  // whole path components only: /a/bc isn't under /a/b
+  return std::equal(root.begin(), root.end(), dir.begin()) &&
+         (dir.length() == root.length() || dir[root.length()] == '/');
+}
+
+absl::optional<boost::filesystem::path> BufferRegistry::Canonicalize(
+    const std::string& name) {
+  Shard* shard = ShardFor(name);
+  {
+    absl::ReaderMutexLock lock(&shard->mu);
+    auto it = shard->names.find(name);
+    if (it != shard->names.end()) return it->second;
+  }
+  // resolved before the sandbox check (so neither .. nor a link can climb
+  // out), and so that every spelling of a file keys the same buffer
+  boost::system::error_code ec;
+  absl::optional<boost::filesystem::path> path =
+      boost::filesystem::weakly_canonical(boost::filesystem::absolute(name),
+                                          ec);
+  if (ec) {
+    LOG(ERROR) << "Unable to resolve " << name << ": " << ec.message();
+    path = absl::nullopt;
+  } else if (!IsChildOfRoot(*path)) {
+    LOG(ERROR) << "Attempt to access outside of project sandbox: " << *path
+               << " in project root " << root_;
+    path = absl::nullopt;
+  }
+  absl::MutexLock lock(&shard->mu);
+  // names come from clients: don't let a long tail of them pile up
+  if (shard->names.size() >= kMaxCachedNames / kShards) shard->names.clear();
+  shard->names.emplace(name, path);
+  return path;
+}
+
+std::shared_ptr<Buffer> BufferRegistry::Get(const std::string& name) {
+  absl::optional<boost::filesystem::path> path = Canonicalize(name);
+  if (!path) return nullptr;
+  Shard* shard = ShardFor(path->string());
+  {
+    absl::ReaderMutexLock lock(&shard->mu);
+    auto it = shard->buffers.find(*path);
+    if (it != shard->buffers.end()) return it->second.buffer;
+  }
+  // stat outside the lock: the file can't matter to anyone else yet
+  if (!boost::filesystem::exists(*path)) return nullptr;
+  absl::MutexLock lock(&shard->mu);
+  auto it = shard->buffers.find(*path);
+  if (it != shard->buffers.end()) return it->second.buffer;
+  std::shared_ptr<Buffer> buffer = make_(*path);
+  shard->buffers.emplace(*path, OpenBuffer{buffer, absl::Now()});
+  return buffer;
+}
+
+void BufferRegistry::MarkIdle(const boost::filesystem::path& path) {
+  Shard* shard = ShardFor(path.string());
+  absl::MutexLock lock(&shard->mu);
+  auto it = shard->buffers.find(path);
+  if (it != shard->buffers.end()) it->second.idle_since = absl::Now();
+}
+
+void BufferRegistry::ForEach(
+    std::function<void(const boost::filesystem::path&, Buffer*)> f) {
+  for (Shard& shard : shards_) {
+    absl::ReaderMutexLock lock(&shard.mu);
+    for (const auto& b : shard.buffers) f(b.first, b.second.buffer.get());
+  }
+}
+
+std::vector<std::shared_ptr<Buffer>> BufferRegistry::TakeIdle(
+    absl::Time expired, bool drop_oldest) {
+  // candidates across all shards, oldest first
+  std::vector<std::pair<absl::Time, boost::filesystem::path>> idle;
+  for (Shard& shard : shards_) {
+    absl::ReaderMutexLock lock(&shard.mu);
+    for (const auto& b : shard.buffers) {
+      if (b.second.buffer.use_count() == 1) {
+        idle.emplace_back(b.second.idle_since, b.first);
+      }
+    }
+  }
+  std::sort(idle.begin(), idle.end());
+
+  std::vector<std::shared_ptr<Buffer>> taken;
+  for (const auto& candidate : idle) {
+    if (!drop_oldest && candidate.first > expired) break;
+    Shard* shard = ShardFor(candidate.second.string());
+    absl::MutexLock lock(&shard->mu);
+    auto it = shard->buffers.find(candidate.second);
+    // picked up again since we looked
+    if (it == shard->buffers.end() || it->second.buffer.use_count() != 1) {
+      continue;
+    }
+    drop_oldest = false;
+    taken.emplace_back(std::move(it->second.buffer));
+    shard->buffers.erase(it);
+  }
+  return taken;
+}
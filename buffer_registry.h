@@ -0,0 +1,84 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <boost/filesystem/path.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/types/optional.h"
+#include "buffer.h"
+
+// The server's open buffers, by path. Buffers are spread over shards by path
+// so streams opening different buffers don't contend, and finding one that's
+// already open only takes a reader lock. Names clients ask for are made
+// absolute and checked against the project root once, then cached.
+class BufferRegistry {
+ public:
+  typedef std::function<std::shared_ptr<Buffer>(
+      const boost::filesystem::path& path)>
+      Factory;
+
+  // make is called (under a shard lock) to open buffers not yet open
+  BufferRegistry(const boost::filesystem::path& root, Factory make);
+
+  BufferRegistry(const BufferRegistry&) = delete;
+  BufferRegistry& operator=(const BufferRegistry&) = delete;
+
+  // null if name is outside the root or doesn't exist
+  std::shared_ptr<Buffer> Get(const std::string& name);
+  // the last client of the buffer at path has gone
+  void MarkIdle(const boost::filesystem::path& path);
+  void ForEach(
+      std::function<void(const boost::filesystem::path&, Buffer*)> f);
+
+  // Removes and returns buffers nobody else holds that have been idle since
+  // before expired, and with drop_oldest, the least recently used one of the
+  // others too.
+  std::vector<std::shared_ptr<Buffer>> TakeIdle(absl::Time expired,
+                                                bool drop_oldest);
+
+ private:
+  static constexpr int kShards = 16;
+  static constexpr size_t kMaxCachedNames = 4096;
+
+  struct OpenBuffer {
+    // shared with the streams editing it
+    std::shared_ptr<Buffer> buffer;
+    // last time the final stream on it ended
+    absl::Time idle_since;
+  };
+
+  struct Shard {
+    absl::Mutex mu;
+    // new references to buffers are only taken under mu
+    std::map<boost::filesystem::path, OpenBuffer> buffers GUARDED_BY(mu);
+    // requested name -> canonical path, or empty if outside the root
+    std::unordered_map<std::string, absl::optional<boost::filesystem::path>>
+        names GUARDED_BY(mu);
+  };
+
+  Shard* ShardFor(const std::string& key);
+  absl::optional<boost::filesystem::path> Canonicalize(const std::string& name);
+  bool IsChildOfRoot(const boost::filesystem::path& path) const;
+
+  const boost::filesystem::path root_;
+  const Factory make_;
+  Shard shards_[kShards];
+};
@@ -0,0 +1,105 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "buffer_registry.h"
+#include <gtest/gtest.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <thread>
+
+namespace {
+
+class BufferRegistryTest : public ::testing::Test {
+ protected:
+  BufferRegistryTest()
+      : root_(boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path()),
+        registry_(root_, [this](const boost::filesystem::path& path) {
+          made_++;
+          return std::shared_ptr<Buffer>(
+              Buffer::Builder().SetFilename(path).Make());
+        }) {
+    boost::filesystem::create_directories(root_ / "src");
+    std::ofstream((root_ / "src" / "a.cc").string()) << "int a;\n";
+  }
+
+  ~BufferRegistryTest() { boost::filesystem::remove_all(root_); }
+
+  const boost::filesystem::path root_;
+  std::atomic<int> made_{0};
+  BufferRegistry registry_;
+};
+
+}  // namespace
+
+TEST_F(BufferRegistryTest, SameBufferForEquivalentNames) {
+  auto a = registry_.Get((root_ / "src" / "a.cc").string());
+  ASSERT_NE(nullptr, a);
+  boost::filesystem::path cwd = boost::filesystem::current_path();
+  boost::filesystem::current_path(root_);
+  auto b = registry_.Get("src/a.cc");
+  boost::filesystem::current_path(cwd);
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(1, made_);
+}
+
+TEST_F(BufferRegistryTest, SameBufferForDotAndDotDotSpellings) {
+  auto a = registry_.Get((root_ / "src" / "a.cc").string());
+  ASSERT_NE(nullptr, a);
+  EXPECT_EQ(a, registry_.Get((root_ / "." / "src" / "a.cc").string()));
+  EXPECT_EQ(a, registry_.Get((root_ / "src" / ".." / "src" / "a.cc").string()));
+  EXPECT_EQ(a, registry_.Get((root_ / ".." / root_.filename() / "src" / "a.cc")
+                                 .string()));
+  EXPECT_EQ(1, made_);
+}
+
+TEST_F(BufferRegistryTest, RefusesDotDotOutOfRoot) {
+  const boost::filesystem::path outside =
+      root_.parent_path() / (root_.filename().string() + "-outside.cc");
+  std::ofstream(outside.string()) << "int x;\n";
+  EXPECT_EQ(nullptr, registry_.Get((root_ / "src" / ".." / ".." /
+                                    outside.filename())
+                                       .string()));
+  boost::filesystem::remove(outside);
+  EXPECT_EQ(0, made_);
+}
+
+TEST_F(BufferRegistryTest, RefusesOutsideRootAndMissing) {
+  EXPECT_EQ(nullptr, registry_.Get("/etc/passwd"));
+  EXPECT_EQ(nullptr, registry_.Get((root_ / "src" / "b.cc").string()));
+  EXPECT_EQ(0, made_);
+}
+
+TEST_F(BufferRegistryTest, ConcurrentOpensMakeOneBuffer) {
+  const std::string name = (root_ / "src" / "a.cc").string();
+  std::vector<std::thread> threads;
+  std::vector<std::shared_ptr<Buffer>> got(8);
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&, i]() { got[i] = registry_.Get(name); });
+  }
+  for (auto& t : threads) t.join();
+  for (const auto& b : got) EXPECT_EQ(got[0], b);
+  EXPECT_EQ(1, made_);
+}
+
+TEST_F(BufferRegistryTest, TakeIdleLeavesBuffersInUse) {
+  std::ofstream((root_ / "src" / "b.cc").string()) << "int b;\n";
+  auto a = registry_.Get((root_ / "src" / "a.cc").string());
+  registry_.Get((root_ / "src" / "b.cc").string());
+  auto taken = registry_.TakeIdle(absl::InfiniteFuture(), false);
+  ASSERT_EQ(1, taken.size());
+  EXPECT_EQ(root_ / "src" / "b.cc", taken[0]->filename());
+  a.reset();
+  EXPECT_TRUE(registry_.TakeIdle(absl::InfinitePast(), false).empty());
+  EXPECT_EQ(1, registry_.TakeIdle(absl::InfinitePast(), true).size());
+}
@@ -14,4 +14,28 @@
 #include "buffer.h"
 #include "gtest/gtest.h"
 
-TEST(Buffer, NoOp) { Buffer b; }
+TEST(Buffer, NoOp) {
+  Buffer::Builder().SetFilename("test.txt").SetSynthetic().Make();
+}
+
+TEST(Buffer, SubscriptionObserverSeesChanges) {
+  auto buffer =
+      Buffer::Builder().SetFilename("test.txt").SetSynthetic().Make();
+  const Buffer* b = buffer.get();
+  std::vector<std::set<std::string>> seen;
+  b->SetSubscriptionObserver([&seen](const std::set<std::string>& outputs) {
+    seen.push_back(outputs);
+  });
+  auto a1 = b->Subscribe("a");
+  auto a2 = b->Subscribe("a");
+  auto c = b->Subscribe("c");
+  a2.reset();
+  a1.reset();
+  b->SetSubscriptionObserver(nullptr);
+  c.reset();
+  ASSERT_EQ(4u, seen.size());
+  EXPECT_EQ(std::set<std::string>(), seen[0]);
+  EXPECT_EQ(std::set<std::string>({"a"}), seen[1]);
+  EXPECT_EQ(std::set<std::string>({"a", "c"}), seen[2]);
+  EXPECT_EQ(std::set<std::string>({"c"}), seen[3]);
+}
@@ -0,0 +1,91 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+
+// Signals that work started on behalf of someone is no longer wanted.
+// Copies share state: cancelling one cancels them all.
+class CancellationToken {
+ private:
+  struct State;
+
+ public:
+  CancellationToken() : state_(std::make_shared<State>()) {}
+
+  void Cancel() {
+    if (state_->requested.exchange(true)) return;
+    state_->cancelled.Notify();
+    absl::MutexLock lock(&state_->mu);
+    for (auto& cb : state_->callbacks) cb.second();
+    state_->callbacks.clear();
+  }
+
+  bool cancelled() const { return state_->cancelled.HasBeenNotified(); }
+
+  // returns true if cancelled before timeout expired
+  bool WaitForCancellationWithTimeout(absl::Duration timeout) const {
+    return state_->cancelled.WaitForNotificationWithTimeout(timeout);
+  }
+
+  // Runs a callback on cancellation (on the cancelling thread, or at once if
+  // already cancelled) unless it's destroyed first; once destroyed, the
+  // callback is not running and never will.
+  class Callback {
+   public:
+    ~Callback() {
+      absl::MutexLock lock(&state_->mu);
+      state_->callbacks.erase(id_);
+    }
+    Callback(const Callback&) = delete;
+    Callback& operator=(const Callback&) = delete;
+
+   private:
+    friend class CancellationToken;
+    Callback(std::shared_ptr<State> state, uint64_t id)
+        : state_(std::move(state)), id_(id) {}
+    const std::shared_ptr<State> state_;
+    const uint64_t id_;
+  };
+
+  std::unique_ptr<Callback> OnCancel(std::function<void()> f) const {
+    uint64_t id;
+    {
+      absl::MutexLock lock(&state_->mu);
+      id = state_->next_callback++;
+      if (!state_->requested.load()) {
+        state_->callbacks.emplace(id, std::move(f));
+        f = nullptr;
+      }
+    }
+    if (f) f();
+    return std::unique_ptr<Callback>(new Callback(state_, id));
+  }
+
+ private:
+  struct State {
+    std::atomic<bool> requested{false};
+    absl::Notification cancelled;
+    absl::Mutex mu;
+    uint64_t next_callback GUARDED_BY(mu) = 0;
+    std::map<uint64_t, std::function<void()>> callbacks GUARDED_BY(mu);
+  };
+  std::shared_ptr<State> state_;
+};
@@ -0,0 +1,32 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "cancellation_token.h"
+#include <gtest/gtest.h>
+
+TEST(CancellationTokenTest, OnCancel) {
+  CancellationToken token;
+  int ran = 0;
+  auto cb = token.OnCancel([&ran]() { ran++; });
+  auto dropped = token.OnCancel([&ran]() { ran += 10; });
+  dropped.reset();
+  EXPECT_EQ(0, ran);
+  CancellationToken copy = token;
+  copy.Cancel();
+  token.Cancel();
+  EXPECT_TRUE(token.cancelled());
+  EXPECT_EQ(1, ran);
+  // already cancelled: runs at once
+  auto late = token.OnCancel([&ran]() { ran += 100; });
+  EXPECT_EQ(101, ran);
+}
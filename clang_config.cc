@@ -118,7 +118,7 @@ End of search list.
                .err,
            '\n')) {
     re2::StringPiece spline(line.data(), line.length());
-    Log() << "CLANGARGLINE: " << line;
+    LOG(INFO) << "CLANGARGLINE: " << line;
     if (!started && RE2::FullMatch(spline, r_start)) {
       started = true;
     } else if (started && RE2::FullMatch(spline, r_ent, &ent)) {
@@ -169,7 +169,7 @@ void ClangCompileArgs(Project* project, const boost::filesystem::path& filename,
       }
       return;
     } catch (std::exception& e) {
-      Log() << e.what();
+      LOG(INFO) << e.what();
     }
     segments.pop_back();
   }
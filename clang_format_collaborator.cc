@@ -22,29 +22,36 @@ class ClangFormatCollaborator final : public SyncCollaborator {
  public:
   ClangFormatCollaborator(const Buffer* buffer)
       : SyncCollaborator("clang-format", absl::Seconds(2),
-                         absl::Milliseconds(100)),
-        buffer_(buffer) {}
+                         absl::Milliseconds(100),
+                         CollaboratorPriority::BACKGROUND),
+        buffer_(buffer) {
+    set_interest(CollaboratorInterest::Text(false));
+  }
 
-  EditResponse Edit(const EditNotification& notification) override;
+  EditResponse Edit(const EditNotification& notification,
+                    const CancellationToken& cancel) override;
 
  private:
   const Buffer* const buffer_;
 };
 
 EditResponse ClangFormatCollaborator::Edit(
-    const EditNotification& notification) {
+    const EditNotification& notification, const CancellationToken& cancel) {
   EditResponse response;
   if (!notification.fully_loaded) return response;
   auto str = notification.content;
   auto text = str.Render();
   auto clang_format = ClangToolPath(buffer_->project(), "clang-format");
-  Log() << "clang-format command: " << clang_format;
+  LOG(INFO) << "clang-format command: " << clang_format;
   auto res =
       run(clang_format,
           {"-output-replacements-xml",
            absl::StrCat("-assume-filename=", buffer_->filename().string())},
-          text);
-  Log() << res.out;
+          text, &cancel);
+  // replacements are offsets into the text we sent: once the user has typed
+  // over it they'd mangle the buffer, so drop them and format again later
+  if (res.cancelled || cancel.cancelled()) return response;
+  LOG(INFO) << res.out;
 
   pugi::xml_document doc;
   auto parse_result =
@@ -75,8 +82,8 @@ EditResponse ClangFormatCollaborator::Edit(
   AnnotatedString::Iterator it(str, AnnotatedString::Begin());
   it.MoveNext();
   for (auto r : replacements) {
-    Log() << "REPLACE: " << r.offset << "+" << r.length << " with '" << r.text
-          << "' starting from " << n;
+    LOG(VERBOSE) << "REPLACE: " << r.offset << "+" << r.length << " with '"
+                 << r.text << "' starting from " << n;
     for (; n < r.offset; n++) {
       it.MoveNext();
     }
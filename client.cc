@@ -15,21 +15,28 @@
 #include "client.h"
 #include <grpc++/create_channel.h>
 #include <boost/filesystem.hpp>
+#include <deque>
 #include "absl/time/clock.h"
+#include "command_batcher.h"
 #include "log.h"
 #include "project.h"
 #include "server.h"
+#include "shm_stream.h"
 #include "src_hash.h"
+#include "trace.h"
 
 DEFINE_bool(check_server_version, false,
             "Check the version of the server is the same as the client "
             "version, quit it otherwise");
 DEFINE_bool(restart_server, false, "Force the server to restart");
+DEFINE_int32(edit_rejoin_attempts, 5,
+             "Times to try rejoining a buffer's edit stream after it breaks");
 
 Client::Client(const boost::filesystem::path& ced_bin,
                const boost::filesystem::path& path) {
   Project project(path, true);
   auto root = project.aspect<ProjectRoot>();
+  shm_address_ = ShmAddressPath(root->Path());
   auto port_exists = [&]() {
     return boost::filesystem::exists(root->LocalAddressPath());
   };
@@ -52,8 +59,8 @@ Client::Client(const boost::filesystem::path& ced_bin,
         if (timeout > absl::Seconds(2)) {
           throw std::runtime_error("Failed starting server");
         }
-        Log() << "Sleeping for " << timeout << " while waiting for server @ "
-              << root->LocalAddress();
+        LOG(INFO) << "Sleeping for " << timeout
+                  << " while waiting for server @ " << root->LocalAddress();
         absl::SleepFor(timeout);
         int c = a + b;
         b = a;
@@ -74,15 +81,16 @@ Client::Client(const boost::filesystem::path& ced_bin,
     auto hello_status = project_stub_->ConnectionHello(
         &hello_ctx, hello_request, &hello_response);
     if (!hello_status.ok()) {
-      Log() << "ConnectionHello failed with status: "
-            << hello_status.error_code() << " " << hello_status.error_message();
+      LOG(INFO) << "ConnectionHello failed with status: "
+                << hello_status.error_code() << " "
+                << hello_status.error_message();
       unlink_port();
       continue;
     }
 
     if (force_restart || (FLAGS_check_server_version &&
                           hello_response.src_hash() != ced_src_hash)) {
-      Log() << "Requesting server to quit";
+      LOG(INFO) << "Requesting server to quit";
       Empty req, rsp;
       grpc::ClientContext quit_ctx;
       quit_ctx.set_deadline(hello_deadline);
@@ -98,76 +106,387 @@ Client::Client(const boost::filesystem::path& ced_bin,
 
 namespace {
 
+// over shared memory if the server takes it, otherwise gRPC
+std::pair<EditStreamPtr, EditMessage> OpenEditStream(
+    ProjectService::Stub* stub, const boost::filesystem::path& shm_address,
+    grpc::ClientContext* ctx, const EditMessage& hello) {
+  EditStreamPtr stream;
+  if (FLAGS_shm_transport) {
+    try {
+      stream.reset(new ShmClientReaderWriter<EditMessage, EditMessage>(
+          ShmChannel::Connect(shm_address,
+                              static_cast<size_t>(FLAGS_shm_ring_kb) << 10)));
+    } catch (std::exception& e) {
+      LOG(INFO) << "Sending edits over gRPC: " << e.what();
+    }
+  }
+  if (!stream) stream = stub->Edit(ctx);
+  EditMessage reply;
+  stream->Write(hello);
+  if (!stream->Read(&reply)) return std::pair<EditStreamPtr, EditMessage>();
+  if (reply.type_case() != EditMessage::kServerHello) {
+    return std::pair<EditStreamPtr, EditMessage>();
+  }
+  return std::make_pair(std::move(stream), reply);
+}
+
+std::unique_ptr<grpc::ClientContext> MakeEditContext() {
+  std::unique_ptr<grpc::ClientContext> ctx(new grpc::ClientContext());
+  // batches are compressed or not message by message
+  if (FLAGS_edit_compress_bytes > 0) {
+    ctx->set_compression_algorithm(GRPC_COMPRESS_GZIP);
+  }
+  return ctx;
+}
+
 class ClientCollaborator : public AsyncCommandCollaborator {
  public:
+  typedef std::function<std::pair<EditStreamPtr, EditMessage>(
+      grpc::ClientContext* ctx, const EditMessage& hello)>
+      Connector;
+
   ClientCollaborator(const Buffer* buffer, EditStreamPtr stream,
-                     std::unique_ptr<grpc::ClientContext> context)
-      : AsyncCommandCollaborator("client", absl::Seconds(0), absl::Seconds(0)),
+                     std::unique_ptr<grpc::ClientContext> context,
+                     const EditMessage& client_hello,
+                     const EditMessage& server_hello, Connector connect,
+                     PresenceStreamPtr presence_stream,
+                     std::unique_ptr<grpc::ClientContext> presence_context)
+      : AsyncCommandCollaborator("client", absl::Seconds(0), absl::Seconds(0),
+                                 CollaboratorPriority::INTERACTIVE),
+        buffer_(buffer),
+        connect_(std::move(connect)),
+        client_hello_(client_hello),
+        site_id_(server_hello.server_hello().site_id()),
+        site_token_(server_hello.server_hello().presence_token()),
         context_(std::move(context)),
-        stream_(std::move(stream)) {}
+        stream_(std::move(stream)),
+        log_id_(server_hello.server_hello().log_id()),
+        version_(VersionVectorFromProto(server_hello.version())),
+        presence_context_(std::move(presence_context)),
+        presence_stream_(std::move(presence_stream)),
+        batcher_([this](const CommandSet& batch, const VersionVector& version,
+                        bool compress) { Write(batch, compress); }) {
+    // the server runs lazy collaborators for what this client shows
+    buffer_->SetSubscriptionObserver(
+        [this](const std::set<std::string>& outputs) {
+          WriteSubscriptions(outputs);
+        });
+  }
 
   void Push(const CommandSet* commands) {
     if (commands == nullptr) {
-      Log() << "Cancel context";
-      context_->TryCancel();
+      buffer_->SetSubscriptionObserver(nullptr);
+      batcher_.Flush();
+      LOG(INFO) << "Cancel context";
+      std::shared_ptr<grpc::ClientContext> context;
+      {
+        // a rejoin holds this until it's done writing to the stream it
+        // installs, so that's the stream ended here (or it sees shutdown_)
+        absl::MutexLock write_lock(&write_mu_);
+        std::shared_ptr<EditStream> stream;
+        {
+          absl::MutexLock lock(&mu_);
+          shutdown_ = true;
+          context = context_;
+          stream = stream_;
+        }
+        // ends a shared memory stream; gRPC ones need cancelling too
+        stream->WritesDone();
+      }
+      context->TryCancel();
+      if (presence_context_) presence_context_->TryCancel();
     } else {
-      EditMessage msg;
-      *msg.mutable_commands() = *commands;
-      stream_->Write(msg);
+      batcher_.Add(*commands);
     }
   }
 
   bool Pull(CommandSet* commands) {
     commands->Clear();
-    EditMessage msg;
-    Log() << "Read";
-    if (!stream_->Read(&msg)) {
-      Log() << "Read failed";
+    for (;;) {
+      std::shared_ptr<EditStream> stream;
+      std::shared_ptr<grpc::ClientContext> context;
+      {
+        absl::MutexLock lock(&mu_);
+        stream = stream_;
+        context = context_;
+      }
+      EditMessage msg;
+      LOG(VERBOSE) << "Read";
+      if (stream->Read(&msg)) {
+        if (msg.type_case() != EditMessage::kCommands) {
+          LOG(ERROR) << "Protocol error";
+          context->TryCancel();
+          return false;
+        }
+        absl::MutexLock lock(&mu_);
+        Confirm(VersionVectorFromProto(msg.version()));
+        *commands = msg.commands();
+        return true;
+      }
+      LOG(INFO) << "Read failed";
+      if (!Rejoin(commands)) return false;
+      if (!commands->commands().empty()) return true;
+    }
+  }
+
+  void PushPresence(int site_id,
+                    const absl::optional<SitePresence>& presence) override {
+    if (!presence_stream_) return;
+    PresenceMessage msg;
+    *msg.mutable_update() = PresenceToProto(site_id, presence);
+    presence_stream_->Write(msg);
+  }
+
+  bool PullPresence(int* site_id,
+                    absl::optional<SitePresence>* presence) override {
+    if (!presence_stream_) return false;
+    PresenceMessage msg;
+    if (!presence_stream_->Read(&msg)) {
+      LOG(INFO) << "Presence read failed";
       return false;
     }
-    if (msg.type_case() != EditMessage::kCommands) {
-      Log() << "Protocol error";
-      context_->TryCancel();
+    if (msg.type_case() != PresenceMessage::kUpdate) {
+      LOG(ERROR) << "Presence protocol error";
+      presence_context_->TryCancel();
       return false;
     }
-    *commands = msg.commands();
+    *site_id = msg.update().site_id();
+    *presence = PresenceFromProto(msg.update());
     return true;
   }
 
  private:
-  std::unique_ptr<grpc::ClientContext> context_;
-  EditStreamPtr stream_;
+  typedef grpc::ClientReaderWriterInterface<EditMessage, EditMessage>
+      EditStream;
+
+  void Write(const CommandSet& batch, bool compress) {
+    absl::MutexLock write_lock(&write_mu_);
+    std::shared_ptr<EditStream> stream;
+    {
+      absl::MutexLock lock(&mu_);
+      // nothing goes out after WritesDone
+      if (shutdown_) return;
+      // kept until the server's version shows it integrated, in case we need
+      // to send it again after rejoining
+      sent_++;
+      if (log_id_ != 0) {
+        unconfirmed_.emplace_back(sent_, batch);
+        if (unconfirmed_.size() > kMaxUnconfirmed) {
+          LOG(INFO) << "Too many unconfirmed edits: won't be able to rejoin";
+          unconfirmed_.clear();
+          log_id_ = 0;
+        }
+      }
+      stream = stream_;
+    }
+    EditMessage msg;
+    *msg.mutable_commands() = batch;
+    grpc::WriteOptions options;
+    if (!compress) options.set_no_compression();
+    TraceSpan span("grpc_write");
+    stream->Write(msg, options);
+  }
+
+  void WriteSubscriptions(const std::set<std::string>& outputs) {
+    absl::MutexLock write_lock(&write_mu_);
+    std::shared_ptr<EditStream> stream;
+    {
+      absl::MutexLock lock(&mu_);
+      if (shutdown_) return;
+      // a rejoin sends them with its hello
+      subscriptions_ = outputs;
+      stream = stream_;
+    }
+    stream->Write(SubscriptionsMessage(outputs));
+  }
+
+  static EditMessage SubscriptionsMessage(
+      const std::set<std::string>& outputs) {
+    EditMessage msg;
+    for (const auto& output : outputs) {
+      msg.mutable_subscriptions()->add_outputs(output);
+    }
+    return msg;
+  }
+
+  void Confirm(const VersionVector& version) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    for (const auto& v : version) {
+      uint64_t& known = version_[v.first];
+      known = std::max(known, v.second);
+    }
+    uint64_t confirmed = version_[site_id_];
+    while (!unconfirmed_.empty() && unconfirmed_.front().first <= confirmed) {
+      unconfirmed_.pop_front();
+    }
+  }
+
+  // reconnect after the stream broke, catching up from our version; missing
+  // gets what the server integrated that we haven't seen
+  bool Rejoin(CommandSet* missing) {
+    absl::Duration backoff = absl::Milliseconds(50);
+    for (int attempt = 1; attempt <= FLAGS_edit_rejoin_attempts; attempt++) {
+      EditMessage hello = client_hello_;
+      std::set<std::string> subscriptions;
+      {
+        absl::MutexLock lock(&mu_);
+        if (shutdown_ || log_id_ == 0) return false;
+        auto body = hello.mutable_client_hello();
+        body->clear_subscriptions();
+        subscriptions = subscriptions_;
+        for (const auto& output : subscriptions) {
+          body->add_subscriptions(output);
+        }
+        body->set_rejoin_site_id(site_id_);
+        body->set_rejoin_token(site_token_);
+        body->set_log_id(log_id_);
+        VersionVectorToProto(version_, body->mutable_known());
+      }
+      absl::SleepFor(backoff);
+      backoff = std::min(backoff * 2, absl::Seconds(2));
+      LOG(INFO) << "Rejoining edit stream, attempt " << attempt;
+      std::shared_ptr<grpc::ClientContext> context = MakeEditContext();
+      auto rejoined = connect_(context.get(), hello);
+      if (!rejoined.first) continue;
+      const EditMessage::ServerHello& server_hello =
+          rejoined.second.server_hello();
+      if (!server_hello.incremental()) {
+        // the buffer's state has moved on in ways we can't merge from here
+        LOG(ERROR) << "Server can't rejoin us incrementally; giving up";
+        context->TryCancel();
+        return false;
+      }
+      std::shared_ptr<EditStream> stream(std::move(rejoined.first));
+      absl::MutexLock write_lock(&write_mu_);
+      std::vector<CommandSet> resend;
+      bool resubscribe = false;
+      {
+        absl::MutexLock lock(&mu_);
+        if (shutdown_) {
+          context->TryCancel();
+          return false;
+        }
+        Confirm(VersionVectorFromProto(rejoined.second.version()));
+        if (!unconfirmed_.empty() &&
+            unconfirmed_.front().first != version_[site_id_] + 1) {
+          LOG(ERROR) << "Lost edits the server never saw; giving up";
+          context->TryCancel();
+          return false;
+        }
+        for (const auto& u : unconfirmed_) resend.push_back(u.second);
+        // changed since the hello went out: that write went to the old stream
+        resubscribe = subscriptions != subscriptions_;
+        subscriptions = subscriptions_;
+        stream_ = stream;
+        context_ = context;
+      }
+      LOG(INFO) << "Rejoined: " << server_hello.missing().commands_size()
+                << " commands missed, " << resend.size() << " to resend";
+      for (const auto& commands : resend) {
+        EditMessage msg;
+        *msg.mutable_commands() = commands;
+        stream->Write(msg);
+      }
+      if (resubscribe) stream->Write(SubscriptionsMessage(subscriptions));
+      *missing = server_hello.missing();
+      return true;
+    }
+    return false;
+  }
+
+  static constexpr size_t kMaxUnconfirmed = 10000;
+
+  const Buffer* const buffer_;
+  const Connector connect_;
+  const EditMessage client_hello_;
+  const int site_id_;
+  // shown to rejoin as site_id_
+  const uint64_t site_token_;
+  // held across writes, so resent edits go out ahead of new ones
+  absl::Mutex write_mu_ ACQUIRED_BEFORE(mu_);
+  absl::Mutex mu_;
+  std::shared_ptr<grpc::ClientContext> context_ GUARDED_BY(mu_);
+  std::shared_ptr<EditStream> stream_ GUARDED_BY(mu_);
+  bool shutdown_ GUARDED_BY(mu_) = false;
+  // lazy server outputs the client shows, as last sent
+  std::set<std::string> subscriptions_ GUARDED_BY(mu_);
+  // zero if we can't rejoin
+  uint64_t log_id_ GUARDED_BY(mu_);
+  // how far through the server's log we've been sent
+  VersionVector version_ GUARDED_BY(mu_);
+  // batches written, and those the server hasn't yet shown us it integrated
+  uint64_t sent_ GUARDED_BY(mu_) = 0;
+  std::deque<std::pair<uint64_t, CommandSet>> unconfirmed_ GUARDED_BY(mu_);
+  // null if the server doesn't take presence
+  std::unique_ptr<grpc::ClientContext> presence_context_;
+  PresenceStreamPtr presence_stream_;
+  // declared last: its writer thread must stop before the stream goes away
+  CommandBatcher batcher_;
 };
 
+constexpr size_t ClientCollaborator::kMaxUnconfirmed;
+
 }  // namespace
 
 std::unique_ptr<Buffer> Client::MakeBuffer(
     const boost::filesystem::path& path) {
-  std::unique_ptr<grpc::ClientContext> ctx(new grpc::ClientContext());
+  std::unique_ptr<grpc::ClientContext> ctx = MakeEditContext();
+  EditMessage client_hello = ClientHelloFor(path);
   std::pair<EditStreamPtr, EditMessage> stream_and_first_msg =
-      MakeEditStream(ctx.get(), path);
+      OpenEditStream(project_stub_.get(), shm_address_, ctx.get(),
+                     client_hello);
   if (!stream_and_first_msg.first) return nullptr;
-  auto buffer =
-      Buffer::Builder()
-          .SetFilename(path)
-          .SetInitialString(AnnotatedString::FromProto(
-              stream_and_first_msg.second.server_hello().current_state()))
-          .SetSiteID(stream_and_first_msg.second.server_hello().site_id())
-          .Make();
+  const EditMessage& server_hello = stream_and_first_msg.second;
+  auto buffer = Buffer::Builder()
+                    .SetFilename(path)
+                    .SetInitialString(AnnotatedString::FromProto(
+                        server_hello.server_hello().current_state()))
+                    .SetSiteID(server_hello.server_hello().site_id())
+                    .Make();
+  std::unique_ptr<grpc::ClientContext> presence_ctx(new grpc::ClientContext());
+  PresenceStreamPtr presence_stream =
+      MakePresenceStream(presence_ctx.get(), path, server_hello);
+  if (!presence_stream) presence_ctx.reset();
+  // the stub outlives us if the buffer does
+  std::shared_ptr<ProjectService::Stub> stub = project_stub_;
+  boost::filesystem::path shm_address = shm_address_;
   buffer->MakeCollaborator<ClientCollaborator>(
-      std::move(stream_and_first_msg.first), std::move(ctx));
+      std::move(stream_and_first_msg.first), std::move(ctx), client_hello,
+      server_hello,
+      [stub, shm_address](grpc::ClientContext* ctx, const EditMessage& hello) {
+        return OpenEditStream(stub.get(), shm_address, ctx, hello);
+      },
+      std::move(presence_stream), std::move(presence_ctx));
   return buffer;
 }
 
-std::pair<EditStreamPtr, EditMessage> Client::MakeEditStream(
-    grpc::ClientContext* ctx, const boost::filesystem::path& path) {
-  EditStreamPtr stream = project_stub_->Edit(ctx);
+EditMessage Client::ClientHelloFor(const boost::filesystem::path& path) {
   EditMessage hello;
   hello.mutable_client_hello()->set_buffer_name(path.string());
-  stream->Write(hello);
-  if (!stream->Read(&hello)) return std::pair<EditStreamPtr, EditMessage>();
-  if (hello.type_case() != EditMessage::kServerHello) {
-    return std::pair<EditStreamPtr, EditMessage>();
-  }
-  return std::make_pair(std::move(stream), hello);
+  return hello;
+}
+
+std::pair<EditStreamPtr, EditMessage> Client::MakeEditStream(
+    grpc::ClientContext* ctx, const boost::filesystem::path& path) {
+  return OpenEditStream(project_stub_.get(), shm_address_, ctx,
+                        ClientHelloFor(path));
+}
+
+PresenceStreamPtr Client::MakePresenceStream(
+    grpc::ClientContext* ctx, const boost::filesystem::path& path,
+    const EditMessage& server_hello) {
+  PresenceStreamPtr stream = project_stub_->Presence(ctx);
+  PresenceMessage hello;
+  hello.mutable_hello()->set_buffer_name(path.string());
+  hello.mutable_hello()->set_site_id(server_hello.server_hello().site_id());
+  hello.mutable_hello()->set_presence_token(
+      server_hello.server_hello().presence_token());
+  if (!stream->Write(hello)) return nullptr;
+  return stream;
+}
+
+grpc::Status Client::GetStats(StatsResponse* stats) {
+  grpc::ClientContext ctx;
+  ctx.set_deadline(gpr_time_add(gpr_now(GPR_CLOCK_MONOTONIC),
+                                gpr_time_from_seconds(5, GPR_TIMESPAN)));
+  return project_stub_->Stats(&ctx, StatsRequest(), stats);
 }
@@ -20,6 +20,9 @@
 typedef std::unique_ptr<
     grpc::ClientReaderWriterInterface<EditMessage, EditMessage>>
     EditStreamPtr;
+typedef std::unique_ptr<
+    grpc::ClientReaderWriterInterface<PresenceMessage, PresenceMessage>>
+    PresenceStreamPtr;
 
 class Client {
  public:
@@ -29,7 +32,17 @@ class Client {
   std::unique_ptr<Buffer> MakeBuffer(const boost::filesystem::path& path);
   std::pair<EditStreamPtr, EditMessage> MakeEditStream(
       grpc::ClientContext* ctx, const boost::filesystem::path& path);
+  // server_hello is from the Edit stream of the site to send presence for
+  PresenceStreamPtr MakePresenceStream(grpc::ClientContext* ctx,
+                                       const boost::filesystem::path& path,
+                                       const EditMessage& server_hello);
+  grpc::Status GetStats(StatsResponse* stats);
 
  private:
-  std::unique_ptr<ProjectService::Stub> project_stub_;
+  static EditMessage ClientHelloFor(const boost::filesystem::path& path);
+
+  // shared with client collaborators, which may need it to reconnect
+  std::shared_ptr<ProjectService::Stub> project_stub_;
+  // where the server takes edits over shared memory
+  boost::filesystem::path shm_address_;
 };
@@ -17,6 +17,7 @@
 #include <vector>
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
 #include "log.h"
 
 DEFINE_bool(buffer_profile_display, false,
@@ -24,6 +25,10 @@ DEFINE_bool(buffer_profile_display, false,
 
 DEFINE_bool(editor_debug_display, false, "Show editor debug information");
 
+DEFINE_string(subscribe, "",
+              "Comma separated outputs of on-demand server collaborators to "
+              "show at startup (C-o shows or hides them later)");
+
 absl::Mutex ClientCollaborator::mu_;
 std::vector<ClientCollaborator*> ClientCollaborator::all_;
 
@@ -48,12 +53,20 @@ void Invalidator::InvalidateAll() {
 }
 
 ClientCollaborator::ClientCollaborator(const Buffer* buffer)
-    : AsyncCollaborator("terminal", absl::Seconds(0), absl::Seconds(0)),
+    : AsyncCollaborator("terminal", absl::Seconds(0), absl::Seconds(0),
+                        CollaboratorPriority::INTERACTIVE),
       buffer_(buffer),
       editor_(Editor::Make(buffer_->site(), buffer_->filename().string(),
                            !buffer->synthetic())),
       recently_used_(false) {
   absl::MutexLock lock(&mu_);
+  if (!buffer_->synthetic()) {
+    for (absl::string_view output :
+         absl::StrSplit(FLAGS_subscribe, ',', absl::SkipEmpty())) {
+      editor_->ToggleOutput(std::string(output));
+    }
+  }
+  UpdateSubscriptions();
   all_.push_back(this);
 }
 
@@ -74,6 +87,7 @@ void ClientCollaborator::Push(const EditNotification& notification) {
     tmr.Mark("lock");
     editor_->UpdateState(&tmr, notification);
     tmr.Mark("update");
+    UpdateSubscriptions();
   }
   Invalidator::InvalidateAll();
 }
@@ -98,12 +112,44 @@ EditResponse ClientCollaborator::Pull() {
   return r;
 }
 
+void ClientCollaborator::UpdateSubscriptions() {
+  // none once the buffer shuts down: they mustn't outlive it
+  const bool shutdown = editor_->CurrentState().shutdown;
+  const std::set<std::string>& shown = editor_->ShownOutputs();
+  for (auto it = subscriptions_.begin(); it != subscriptions_.end();) {
+    if (!shutdown && shown.count(it->first)) {
+      ++it;
+    } else {
+      it = subscriptions_.erase(it);
+    }
+  }
+  if (shutdown) return;
+  for (const auto& output : shown) {
+    if (!subscriptions_.count(output)) {
+      subscriptions_.emplace(output, buffer_->Subscribe(output));
+    }
+  }
+}
+
 void ClientCollaborator::Render(RenderContainers containers, Theme* theme) {
   /*
    * edit item
    */
   editor_->Render(theme,
                   buffer_->synthetic() ? containers.side_bar : containers.main);
+  UpdateSubscriptions();
+
+  if (editor_->Prompting()) {
+    containers.side_bar->MakeSimpleText(theme->ThemeToken({}, 0),
+                                        editor_->PromptStatus());
+  }
+
+  if (editor_->Finding()) {
+    containers.side_bar->MakeSimpleText(theme->ThemeToken({}, 0),
+                                        editor_->FindStatus());
+    // keep drawing frames until the search has covered the buffer
+    if (editor_->FindPending()) Invalidator::InvalidateAll();
+  }
 
   if (FLAGS_buffer_profile_display) {
     containers.side_bar->MakeSimpleText(theme->ThemeToken({}, 0),
@@ -136,7 +182,7 @@ void ClientCollaborator::Render(RenderContainers containers, Theme* theme) {
           diagnostics
               .AddItem(LAY_TOP | LAY_HFILL,
                        [msg](TerminalRenderContext* context) {
-                         Log() << *context->window;
+                         LOG(VERBOSE) << *context->window;
                          context->Put(0, 0, msg, context->color->Theme({}, 0));
                        })
               .FixSize(0, 1);
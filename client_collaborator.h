@@ -51,12 +51,16 @@ class ClientCollaborator final : public AsyncCollaborator {
  private:
   void Render(RenderContainers containers, Theme* theme)
       EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // subscribed to the lazy server outputs the editor shows, and no others
+  void UpdateSubscriptions() EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   const Buffer* const buffer_;
   static absl::Mutex mu_;
   std::shared_ptr<Editor> editor_ GUARDED_BY(mu_);
   LineEditor find_editor_ GUARDED_BY(mu_);
   bool recently_used_ GUARDED_BY(mu_);
+  std::map<std::string, std::unique_ptr<Buffer::Subscription>> subscriptions_
+      GUARDED_BY(mu_);
 
   static std::vector<ClientCollaborator*> all_ GUARDED_BY(mu_);
 };
@@ -0,0 +1,97 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "command_batcher.h"
+
+DEFINE_int32(edit_batch_delay_ms, 4,
+             "Longest to hold back edits to merge them with later ones while "
+             "a stream is busy");
+DEFINE_int32(edit_batch_max_bytes, 256 * 1024,
+             "Write a batch of held back edits once it reaches this size");
+DEFINE_int32(edit_compress_bytes, 16 * 1024,
+             "Compress edit batches at least this large on the wire (0 to "
+             "never compress)");
+
+CommandBatcher::CommandBatcher(Writer write)
+    : write_(std::move(write)), thread_([this]() { Run(); }) {}
+
+CommandBatcher::~CommandBatcher() {
+  {
+    absl::MutexLock lock(&mu_);
+    shutdown_ = true;
+  }
+  thread_.join();
+}
+
+void CommandBatcher::Add(const CommandSet& commands,
+                         const VersionVector& version) {
+  if (commands.commands().empty()) return;
+  absl::MutexLock lock(&mu_);
+  if (pending_.commands().empty()) pending_since_ = absl::Now();
+  pending_.MergeFrom(commands);
+  pending_version_ = version;
+  pending_bytes_ += commands.ByteSizeLong();
+  added_++;
+}
+
+void CommandBatcher::Flush() {
+  absl::MutexLock lock(&mu_);
+  const uint64_t target = added_;
+  flushing_++;
+  auto written = [this, target]() {
+    mu_.AssertHeld();
+    return written_ >= target;
+  };
+  mu_.Await(absl::Condition(&written));
+  flushing_--;
+}
+
+void CommandBatcher::Run() {
+  const absl::Duration delay = absl::Milliseconds(FLAGS_edit_batch_delay_ms);
+  auto has_pending = [this]() {
+    mu_.AssertHeld();
+    return shutdown_ || !pending_.commands().empty();
+  };
+  auto send_now = [this]() {
+    mu_.AssertHeld();
+    return shutdown_ || flushing_ > 0 ||
+           pending_bytes_ >= static_cast<size_t>(FLAGS_edit_batch_max_bytes);
+  };
+  for (;;) {
+    CommandSet batch;
+    VersionVector version;
+    size_t bytes;
+    uint64_t added;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(&has_pending));
+      if (pending_.commands().empty()) return;
+      // the stream is busy: wait a little for more to merge in
+      if (absl::Now() - last_write_ < delay) {
+        mu_.AwaitWithDeadline(absl::Condition(&send_now),
+                              pending_since_ + delay);
+      }
+      batch.Swap(&pending_);
+      version.swap(pending_version_);
+      bytes = pending_bytes_;
+      pending_bytes_ = 0;
+      added = added_;
+    }
+    write_(batch, version,
+           FLAGS_edit_compress_bytes > 0 &&
+               bytes >= static_cast<size_t>(FLAGS_edit_compress_bytes));
+    absl::MutexLock lock(&mu_);
+    written_ = added;
+    last_write_ = absl::Now();
+  }
+}
@@ -0,0 +1,70 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <gflags/gflags.h>
+#include <functional>
+#include <thread>
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "annotated_string.h"
+
+DECLARE_int32(edit_batch_delay_ms);
+DECLARE_int32(edit_batch_max_bytes);
+DECLARE_int32(edit_compress_bytes);
+
+// Merges the command sets bound for one stream so bursts go out as a few
+// large writes rather than many small ones (after Nagle's algorithm): while
+// the stream is idle commands are written straight away, but once writes are
+// going out back to back they're held for up to --edit_batch_delay_ms (or
+// until --edit_batch_max_bytes build up) and merged. Writes are made in order
+// from the batcher's own thread.
+class CommandBatcher {
+ public:
+  // given each batch, the version given with the last of its commands, and
+  // whether it's large enough to be worth compressing
+  typedef std::function<void(const CommandSet& batch,
+                             const VersionVector& version, bool compress)>
+      Writer;
+
+  explicit CommandBatcher(Writer write);
+  // writes anything still pending
+  ~CommandBatcher();
+
+  CommandBatcher(const CommandBatcher&) = delete;
+  CommandBatcher& operator=(const CommandBatcher&) = delete;
+
+  void Add(const CommandSet& commands,
+           const VersionVector& version = VersionVector());
+  // wait until everything added so far has been written
+  void Flush();
+
+ private:
+  void Run();
+
+  const Writer write_;
+  absl::Mutex mu_;
+  CommandSet pending_ GUARDED_BY(mu_);
+  VersionVector pending_version_ GUARDED_BY(mu_);
+  size_t pending_bytes_ GUARDED_BY(mu_) = 0;
+  absl::Time pending_since_ GUARDED_BY(mu_);
+  absl::Time last_write_ GUARDED_BY(mu_) = absl::InfinitePast();
+  // command sets added, and how many of those have been written
+  uint64_t added_ GUARDED_BY(mu_) = 0;
+  uint64_t written_ GUARDED_BY(mu_) = 0;
+  // threads in Flush: stop holding batches back
+  int flushing_ GUARDED_BY(mu_) = 0;
+  bool shutdown_ GUARDED_BY(mu_) = false;
+  std::thread thread_;
+};
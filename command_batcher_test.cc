@@ -0,0 +1,98 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "command_batcher.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace {
+
+CommandSet OneCommand(uint64_t id) {
+  CommandSet commands;
+  commands.add_commands()->set_id(id);
+  return commands;
+}
+
+struct Written {
+  absl::Mutex mu;
+  std::vector<CommandSet> batches GUARDED_BY(mu);
+  std::vector<VersionVector> versions GUARDED_BY(mu);
+  std::vector<bool> compressed GUARDED_BY(mu);
+
+  CommandBatcher::Writer Writer(absl::Duration write_time) {
+    return [this, write_time](const CommandSet& batch,
+                              const VersionVector& version, bool compress) {
+      absl::SleepFor(write_time);
+      absl::MutexLock lock(&mu);
+      batches.push_back(batch);
+      versions.push_back(version);
+      compressed.push_back(compress);
+    };
+  }
+
+  std::vector<uint64_t> Ids() {
+    absl::MutexLock lock(&mu);
+    std::vector<uint64_t> ids;
+    for (const auto& b : batches) {
+      for (const auto& c : b.commands()) ids.push_back(c.id());
+    }
+    return ids;
+  }
+};
+
+}  // namespace
+
+TEST(CommandBatcherTest, IdleStreamWritesImmediately) {
+  Written written;
+  CommandBatcher batcher(written.Writer(absl::ZeroDuration()));
+  batcher.Add(OneCommand(1));
+  batcher.Flush();
+  absl::MutexLock lock(&written.mu);
+  ASSERT_EQ(1, written.batches.size());
+  EXPECT_EQ(1, written.batches[0].commands_size());
+  EXPECT_FALSE(written.compressed[0]);
+}
+
+TEST(CommandBatcherTest, BurstIsMergedInOrder) {
+  Written written;
+  {
+    CommandBatcher batcher(written.Writer(absl::Milliseconds(20)));
+    for (uint64_t i = 1; i <= 100; i++) {
+      batcher.Add(OneCommand(i), VersionVector{{1, i}});
+    }
+  }
+  std::vector<uint64_t> expect;
+  for (uint64_t i = 1; i <= 100; i++) expect.push_back(i);
+  EXPECT_EQ(expect, written.Ids());
+  absl::MutexLock lock(&written.mu);
+  EXPECT_LT(written.batches.size(), 10);
+  // each batch carries the version of its last command
+  uint64_t count = 0;
+  for (size_t i = 0; i < written.batches.size(); i++) {
+    count += written.batches[i].commands_size();
+    EXPECT_EQ((VersionVector{{1, count}}), written.versions[i]);
+  }
+}
+
+TEST(CommandBatcherTest, LargeBatchesAreCompressed) {
+  Written written;
+  CommandBatcher batcher(written.Writer(absl::ZeroDuration()));
+  CommandSet big;
+  big.add_commands()->mutable_insert()->set_characters(
+      std::string(FLAGS_edit_compress_bytes, 'x'));
+  batcher.Add(big);
+  batcher.Flush();
+  absl::MutexLock lock(&written.mu);
+  ASSERT_EQ(1, written.compressed.size());
+  EXPECT_TRUE(written.compressed[0]);
+}
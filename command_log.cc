@@ -0,0 +1,59 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "command_log.h"
+#include <random>
+
+static uint64_t NewLogID() {
+  std::random_device rd;
+  uint64_t id = (static_cast<uint64_t>(rd()) << 32) | rd();
+  // zero means "no log" on the wire
+  return id ? id : 1;
+}
+
+CommandLog::CommandLog(size_t max_commands)
+    : max_commands_(max_commands), id_(NewLogID()) {}
+
+const VersionVector& CommandLog::Append(int origin_site,
+                                        const CommandSet& commands) {
+  uint64_t seq = ++version_[origin_site];
+  entries_.emplace_back(Entry{origin_site, seq, commands});
+  commands_ += commands.commands_size();
+  if (commands_ > max_commands_) Truncate();
+  return version_;
+}
+
+void CommandLog::Truncate() {
+  while (!entries_.empty() && commands_ > max_commands_ / 2) {
+    const Entry& e = entries_.front();
+    checkpoint_[e.origin_site] = e.seq;
+    commands_ -= e.commands.commands_size();
+    entries_.pop_front();
+  }
+}
+
+bool CommandLog::Since(const VersionVector& known, CommandSet* missing) const {
+  auto known_from = [&known](int site) -> uint64_t {
+    auto it = known.find(site);
+    return it == known.end() ? 0 : it->second;
+  };
+  for (const auto& c : checkpoint_) {
+    if (known_from(c.first) < c.second) return false;
+  }
+  for (const auto& e : entries_) {
+    if (e.seq > known_from(e.origin_site)) {
+      missing->MergeFrom(e.commands);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,59 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <deque>
+#include "annotated_string.h"
+
+// Bounded history of the command sets integrated into a buffer, in order and
+// numbered per origin site, so a replica that reconnects with the version
+// vector it had reached can be sent just what it's missing. Once the log
+// grows past its bound the oldest half is dropped, leaving a checkpoint:
+// replicas from before it need a full snapshot instead.
+class CommandLog {
+ public:
+  explicit CommandLog(size_t max_commands);
+
+  CommandLog(const CommandLog&) = delete;
+  CommandLog& operator=(const CommandLog&) = delete;
+
+  // identifies this log: versions from another log (another server, or an
+  // earlier incarnation of the buffer) mean nothing here
+  uint64_t id() const { return id_; }
+  const VersionVector& version() const { return version_; }
+
+  // returns the version once commands are included
+  const VersionVector& Append(int origin_site, const CommandSet& commands);
+
+  // the commands logged that a replica at known hasn't seen; false if some
+  // have already been dropped
+  bool Since(const VersionVector& known, CommandSet* missing) const;
+
+ private:
+  struct Entry {
+    int origin_site;
+    uint64_t seq;
+    CommandSet commands;
+  };
+
+  void Truncate();
+
+  const size_t max_commands_;
+  const uint64_t id_;
+  std::deque<Entry> entries_;
+  size_t commands_ = 0;
+  VersionVector version_;
+  // the version reached by the entries dropped so far
+  VersionVector checkpoint_;
+};
@@ -0,0 +1,76 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "command_log.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+CommandSet OneCommand(uint64_t id) {
+  CommandSet commands;
+  commands.add_commands()->set_id(id);
+  return commands;
+}
+
+std::vector<uint64_t> Ids(const CommandSet& commands) {
+  std::vector<uint64_t> ids;
+  for (const auto& c : commands.commands()) ids.push_back(c.id());
+  return ids;
+}
+
+}  // namespace
+
+TEST(CommandLogTest, VersionCountsSetsPerSite) {
+  CommandLog log(100);
+  log.Append(1, OneCommand(10));
+  log.Append(2, OneCommand(20));
+  VersionVector v = log.Append(1, OneCommand(11));
+  EXPECT_EQ((VersionVector{{1, 2}, {2, 1}}), v);
+  EXPECT_EQ(v, log.version());
+}
+
+TEST(CommandLogTest, SinceSendsOnlyWhatsMissing) {
+  CommandLog log(100);
+  log.Append(1, OneCommand(10));
+  log.Append(2, OneCommand(20));
+  log.Append(1, OneCommand(11));
+  log.Append(2, OneCommand(21));
+
+  CommandSet missing;
+  ASSERT_TRUE(log.Since(VersionVector{{1, 1}, {2, 2}}, &missing));
+  EXPECT_EQ((std::vector<uint64_t>{11}), Ids(missing));
+
+  missing.Clear();
+  ASSERT_TRUE(log.Since(VersionVector{}, &missing));
+  EXPECT_EQ((std::vector<uint64_t>{10, 20, 11, 21}), Ids(missing));
+
+  missing.Clear();
+  ASSERT_TRUE(log.Since(log.version(), &missing));
+  EXPECT_TRUE(missing.commands().empty());
+}
+
+TEST(CommandLogTest, TruncatedLogNeedsSnapshot) {
+  CommandLog log(10);
+  for (uint64_t i = 1; i <= 11; i++) log.Append(1, OneCommand(i));
+  CommandSet missing;
+  EXPECT_FALSE(log.Since(VersionVector{{1, 2}}, &missing));
+  ASSERT_TRUE(log.Since(VersionVector{{1, 9}}, &missing));
+  EXPECT_EQ((std::vector<uint64_t>{10, 11}), Ids(missing));
+}
+
+TEST(CommandLogTest, LogsHaveDistinctIDs) {
+  CommandLog a(10);
+  CommandLog b(10);
+  EXPECT_NE(0, a.id());
+  EXPECT_NE(a.id(), b.id());
+}
@@ -20,6 +20,7 @@
 #include "client_collaborator.h"
 #include "render.h"
 #include "terminal_color.h"
+#include "trace.h"
 
 // include last: curses.h obnoxiously #define's OK
 #include <curses.h>
@@ -111,8 +112,8 @@ class Curses final : public Application, public Device, public Invalidator {
       }
 
       void MoveCursor(int row, int col) override {
-        Log() << "MoveCursor: " << row << "," << col << ": ofs=" << ofsy_ << ","
-              << ofsx_;
+        LOG(VERBOSE) << "MoveCursor: " << row << "," << col << ": ofs=" << ofsy_
+                     << "," << ofsx_;
         c_->cursor_row_ = -1;
         c_->cursor_col_ = -1;
         const int r = row + ofsy_;
@@ -142,11 +143,11 @@ class Curses final : public Application, public Device, public Invalidator {
                          parent_right);
     int bottom = std::min(
         static_cast<int>(widget.bottom().value()) + parent_top, parent_bottom);
-    Log() << "WIDGET " << widget.id() << " type " << widget.type()
-          << " parent (" << parent_left << "," << parent_top << ")-("
-          << parent_right << "," << parent_bottom << ")"
-          << " self (" << left << "," << top << ")-(" << right << "," << bottom
-          << ")";
+    LOG(VERBOSE) << "WIDGET " << widget.id() << " type " << widget.type()
+                 << " parent (" << parent_left << "," << parent_top << ")-("
+                 << parent_right << "," << parent_bottom << ")"
+                 << " self (" << left << "," << top << ")-(" << right << ","
+                 << bottom << ")";
     Ctx ctx(this, parent_left, parent_top, left, top, right, bottom);
     widget.PaintSelf(&ctx);
     for (const auto* c : widget.children()) {
@@ -181,7 +182,8 @@ class Curses final : public Application, public Device, public Invalidator {
       if (!was_invalidated) log_timer.reset();
       int c = invalidated_ ? -1 : getch();
       if (!was_invalidated) log_timer.reset(new LogTimer("main_loop"));
-      Log() << "GOTKEY: " << c;
+      LOG(VERBOSE) << "GOTKEY: " << c;
+      if (c != ERR) Trace::Instant("key");
       if (!was_invalidated) last_key_press = absl::Now();
 
       log_timer->Mark("XXX");
@@ -299,7 +301,8 @@ class Curses final : public Application, public Device, public Invalidator {
       mvaddch(fb_rows_ - 1, fb_cols_ - ftstr.length() + i, ftstr[i] | attr);
     }
 
-    Log() << "finally move cursor " << cursor_row_ << ", " << cursor_col_;
+    LOG(VERBOSE) << "finally move cursor " << cursor_row_ << ", "
+                 << cursor_col_;
     if (cursor_row_ != -1) {
       move(cursor_row_, cursor_col_);
       curs_set(1);
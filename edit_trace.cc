@@ -0,0 +1,103 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "edit_trace.h"
+#include <google/protobuf/io/coded_stream.h>
+#include <unistd.h>
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "log.h"
+
+DEFINE_string(edit_trace_dir, "",
+              "Record the edits each buffer publishes to a trace file in "
+              "this directory (replay them with bm_replay)");
+
+boost::filesystem::path EditTracePath(const boost::filesystem::path& dir,
+                                      const boost::filesystem::path& filename) {
+  std::string name = filename.relative_path().string();
+  for (char& c : name) {
+    if (c == '/') c = '_';
+  }
+  return dir / absl::StrCat(name, ".", getpid(), ".edits");
+}
+
+EditTraceWriter::EditTraceWriter(const boost::filesystem::path& path)
+    : out_(path.string(), std::ios::binary | std::ios::trunc),
+      start_(absl::Now()) {}
+
+std::unique_ptr<EditTraceWriter> EditTraceWriter::Open(
+    const boost::filesystem::path& path,
+    const boost::filesystem::path& filename, const AnnotatedString& initial) {
+  std::unique_ptr<EditTraceWriter> writer(new EditTraceWriter(path));
+  if (!writer->out_) {
+    LOG(ERROR) << "Can't record edits to " << path;
+    return nullptr;
+  }
+  EditTraceHeader header;
+  header.set_filename(filename.string());
+  *header.mutable_initial() = initial.AsProto();
+  header.set_start_unix_us(absl::ToUnixMicros(writer->start_));
+  writer->Write(header);
+  LOG(INFO) << "Recording edits to " << filename << " in " << path;
+  return writer;
+}
+
+void EditTraceWriter::Append(const char* source, int origin_site,
+                             const CommandSet& commands) {
+  if (commands.commands().empty()) return;
+  record_.set_offset_us(absl::ToInt64Microseconds(absl::Now() - start_));
+  record_.set_source(source);
+  record_.set_origin_site(origin_site);
+  *record_.mutable_commands() = commands;
+  Write(record_);
+}
+
+void EditTraceWriter::Write(const google::protobuf::MessageLite& msg) {
+  scratch_.clear();
+  msg.SerializeToString(&scratch_);
+  // a varint32 is at most 5 bytes
+  uint8_t len[5];
+  uint8_t* end = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(
+      scratch_.length(), len);
+  out_.write(reinterpret_cast<const char*>(len), end - len);
+  out_.write(scratch_.data(), scratch_.length());
+}
+
+EditTraceReader::EditTraceReader(const boost::filesystem::path& path)
+    : in_(path.string(), std::ios::binary) {
+  if (!in_) {
+    throw std::runtime_error(absl::StrCat("Can't read ", path.string()));
+  }
+  if (!Read(&header_)) {
+    throw std::runtime_error(
+        absl::StrCat(path.string(), " isn't an edit trace"));
+  }
+}
+
+bool EditTraceReader::Next(EditTraceRecord* record) { return Read(record); }
+
+bool EditTraceReader::Read(google::protobuf::MessageLite* msg) {
+  uint32_t len = 0;
+  for (int shift = 0;; shift += 7) {
+    int c = in_.get();
+    if (c == EOF || shift > 28) return false;
+    len |= static_cast<uint32_t>(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) break;
+  }
+  scratch_.resize(len);
+  if (!in_.read(&scratch_[0], len)) {
+    LOG(INFO) << "Edit trace ends mid-record";
+    return false;
+  }
+  return msg->ParseFromString(scratch_);
+}
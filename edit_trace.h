@@ -0,0 +1,77 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <gflags/gflags.h>
+#include <boost/filesystem/path.hpp>
+#include <fstream>
+#include <memory>
+#include "absl/time/time.h"
+#include "annotated_string.h"
+#include "proto/edit_trace.pb.h"
+
+DECLARE_string(edit_trace_dir);
+
+// where a buffer for filename records its edits under dir
+boost::filesystem::path EditTracePath(const boost::filesystem::path& dir,
+                                      const boost::filesystem::path& filename);
+
+// Appends the command sets a buffer publishes to an edit trace file (see
+// proto/edit_trace.proto), so the edits that reached it can be replayed
+// later. Not thread safe: the buffer appends under its lock, which also
+// keeps records in the order they were published.
+class EditTraceWriter {
+ public:
+  // null (and logged) if path can't be written
+  static std::unique_ptr<EditTraceWriter> Open(
+      const boost::filesystem::path& path,
+      const boost::filesystem::path& filename, const AnnotatedString& initial);
+
+  EditTraceWriter(const EditTraceWriter&) = delete;
+  EditTraceWriter& operator=(const EditTraceWriter&) = delete;
+
+  void Append(const char* source, int origin_site, const CommandSet& commands);
+
+ private:
+  explicit EditTraceWriter(const boost::filesystem::path& path);
+
+  void Write(const google::protobuf::MessageLite& msg);
+
+  std::ofstream out_;
+  absl::Time start_;
+  EditTraceRecord record_;
+  std::string scratch_;
+};
+
+// Reads an edit trace back. A trailing record cut short (the process
+// recording it died mid-write) ends the trace.
+class EditTraceReader {
+ public:
+  // throws if path can't be read or doesn't start with a header
+  explicit EditTraceReader(const boost::filesystem::path& path);
+
+  EditTraceReader(const EditTraceReader&) = delete;
+  EditTraceReader& operator=(const EditTraceReader&) = delete;
+
+  const EditTraceHeader& header() const { return header_; }
+  // false at the end of the trace
+  bool Next(EditTraceRecord* record);
+
+ private:
+  bool Read(google::protobuf::MessageLite* msg);
+
+  std::ifstream in_;
+  EditTraceHeader header_;
+  std::string scratch_;
+};
@@ -0,0 +1,91 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "edit_trace.h"
+#include <gtest/gtest.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+namespace {
+
+class EditTraceTest : public ::testing::Test {
+ protected:
+  EditTraceTest()
+      : path_(boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path()) {}
+  ~EditTraceTest() { boost::filesystem::remove(path_); }
+
+  const boost::filesystem::path path_;
+};
+
+}  // namespace
+
+TEST_F(EditTraceTest, RecordsAndReplays) {
+  Site site;
+  AnnotatedString initial;
+  initial.Insert(&site, "hello", AnnotatedString::Begin());
+  CommandSet typed;
+  AnnotatedString::MakeRawInsert(&typed, &site, " world",
+                                 AnnotatedString::Begin(),
+                                 AnnotatedString::End());
+  {
+    auto writer = EditTraceWriter::Open(path_, "a.cc", initial);
+    ASSERT_NE(nullptr, writer);
+    writer->Append("push", 7, typed);
+    writer->Append("libclang", 1, CommandSet());
+    writer->Append("libclang", 1, typed);
+  }
+
+  EditTraceReader reader(path_);
+  EXPECT_EQ("a.cc", reader.header().filename());
+  EXPECT_EQ("hello",
+            AnnotatedString::FromProto(reader.header().initial()).Render());
+  EditTraceRecord record;
+  ASSERT_TRUE(reader.Next(&record));
+  EXPECT_EQ("push", record.source());
+  EXPECT_EQ(7, record.origin_site());
+  EXPECT_EQ(typed.SerializeAsString(), record.commands().SerializeAsString());
+  // empty command sets aren't recorded
+  ASSERT_TRUE(reader.Next(&record));
+  EXPECT_EQ("libclang", record.source());
+  EXPECT_FALSE(reader.Next(&record));
+}
+
+TEST_F(EditTraceTest, TruncatedRecordEndsTrace) {
+  Site site;
+  CommandSet typed;
+  AnnotatedString::MakeRawInsert(&typed, &site, "x", AnnotatedString::Begin(),
+                                 AnnotatedString::End());
+  {
+    auto writer = EditTraceWriter::Open(path_, "a.cc", AnnotatedString());
+    writer->Append("push", 1, typed);
+    writer->Append("push", 1, typed);
+  }
+  boost::filesystem::resize_file(path_, boost::filesystem::file_size(path_) -
+                                            2);
+  EditTraceReader reader(path_);
+  EditTraceRecord record;
+  EXPECT_TRUE(reader.Next(&record));
+  EXPECT_FALSE(reader.Next(&record));
+}
+
+TEST_F(EditTraceTest, RejectsMissingAndNonTrace) {
+  EXPECT_THROW({ EditTraceReader reader(path_); }, std::runtime_error);
+  std::ofstream(path_.string()) << "#include <stdio.h>\n";
+  EXPECT_THROW({ EditTraceReader reader(path_); }, std::runtime_error);
+}
+
+TEST(EditTracePathTest, FlattensFilename) {
+  EXPECT_EQ("/traces/src_a.cc.",
+            EditTracePath("/traces", "/src/a.cc").string().substr(0, 17));
+}
@@ -12,8 +12,14 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "editor.h"
+#include <gflags/gflags.h>
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "trace.h"
+
+DEFINE_int32(find_scan_ms, 5,
+             "Time each frame may spend searching the buffer out of view");
 
 std::vector<std::string> Editor::DebugData() const {
   std::vector<std::string> r;
@@ -34,42 +40,46 @@ std::vector<std::string> Editor::DebugData() const {
     }
   };
   add_proto("unpublished_commands", unpublished_commands_);
-  add_proto("unacknowledged_commands", unacknowledged_commands_);
+  for (const auto& unacked : unacknowledged_commands_) {
+    add_proto(absl::StrCat("unacknowledged_commands #", unacked.first),
+              unacked.second);
+  }
   return r;
 }
 
 EditResponse Editor::MakeResponse() {
-  PublishCursor();
-
-  Log() << "EDITOR: " << name_ << " done:" << state_.shutdown;
+  TraceSpan span("Editor::MakeResponse");
+  LOG(VERBOSE) << "EDITOR: " << name_ << " done:" << state_.shutdown;
 
   EditResponse r;
+  PublishCursor(&r);
   r.done = state_.shutdown;
   r.become_used = !unpublished_commands_.commands().empty();
   state_.content = state_.content.Integrate(unpublished_commands_);
   r.content_updates.MergeFrom(unpublished_commands_);
-  unacknowledged_commands_.MergeFrom(unpublished_commands_);
-  unpublished_commands_.Clear();
+  if (!unpublished_commands_.commands().empty()) {
+    unacknowledged_commands_.emplace_back(++responses_published_,
+                                          CommandSet());
+    unacknowledged_commands_.back().second.Swap(&unpublished_commands_);
+  }
   assert(unpublished_commands_.commands().empty());
   return r;
 }
 
-void Editor::PublishCursor() {
-  AnnotationEditor::ScopedEdit edit(&ed_, &unpublished_commands_);
+void Editor::PublishCursor(EditResponse* response) {
+  // our own cursor and selection go out as presence rather than as marks:
+  // they change too often to be worth integrating everywhere
+  if (cursor_reported_ != cursor_ ||
+      selection_anchor_reported_ != selection_anchor_) {
+    SitePresence presence;
+    presence.cursor = cursor_;
+    presence.selection_anchor = selection_anchor_;
+    presence.seq = ++presence_seq_;
+    response->presence = presence;
+    selection_anchor_reported_ = selection_anchor_;
+  }
   Attribute curs;
   curs.mutable_cursor();
-  ed_.Mark(cursor_,
-           AnnotatedString::Iterator(state_.content, cursor_).Next().id(),
-           curs);
-  if (selection_anchor_ != ID()) {
-    Attribute sel;
-    sel.mutable_selection();
-    if (state_.content.OrderIDs(cursor_, selection_anchor_) < 0) {
-      ed_.Mark(cursor_, selection_anchor_, sel);
-    } else {
-      ed_.Mark(selection_anchor_, cursor_, sel);
-    }
-  }
   AnnotatedString::Iterator(state_.content, cursor_)
       .ForEachAttrValue([this, curs](const Attribute& attr) {
         if (attr.data_case() != Attribute::kBufferRef) return;
@@ -80,42 +90,42 @@ void Editor::PublishCursor() {
         {
           AnnotationEditor::ScopedEdit edit_child(&it->second.ed, &cmds);
           for (auto line : attr.buffer_ref().lines()) {
-            Log() << "Mark child frame line " << line;
+            LOG(VERBOSE) << "Mark child frame line " << line;
             AnnotatedString::LineIterator li =
                 AnnotatedString::LineIterator::FromLineNumber(cur_content,
                                                               line);
             it->second.ed.Mark(li.id(), li.Next().id(), curs);
           }
         }
-        Log() << "Push changes " << cmds.DebugString();
+        LOG(VERBOSE) << "Push changes " << cmds.DebugString();
         it->second.buffer->PushChanges(&cmds, true);
-        Log() << "Result: "
-              << it->second.buffer->ContentSnapshot().AsProto().DebugString();
+        LOG(VERBOSE)
+            << "Result: "
+            << it->second.buffer->ContentSnapshot().AsProto().DebugString();
       });
   cursor_reported_ = cursor_;
 }
 
 void Editor::UpdateState(LogTimer* tmr, const EditNotification& state) {
-  Log() << "EDITOR: " << name_ << " UpdateState shutdown=" << state.shutdown;
+  LOG(VERBOSE) << "EDITOR: " << name_
+               << " UpdateState shutdown=" << state.shutdown;
 
   state_ = state;
-  auto s2 = state_.content;
-  CommandSet unacked;
-  for (const auto& cmd : unacknowledged_commands_.commands()) {
-    auto s3 = s2;
-    s2.Integrate(cmd);
-    if (!s3.SameTotalIdentity(s2)) {
-      *unacked.add_commands() = cmd;
-      tmr->Mark("unacked");
-    } else {
-      tmr->Mark("acked");
-    }
+  while (!unacknowledged_commands_.empty() &&
+         unacknowledged_commands_.front().first <= state_.acked) {
+    unacknowledged_commands_.pop_front();
   }
-  unacknowledged_commands_.Swap(&unacked);
+  tmr->Mark(unacknowledged_commands_.empty() ? "acked" : "unacked");
+
+  UpdateSideBuffers();
+}
 
+void Editor::UpdateSideBuffers() {
   std::map<ID, BufferInfo> new_buffers;
   state_.content.ForEachAttribute(
       Attribute::kBuffer, [this, &new_buffers](ID id, const Attribute& attr) {
+        const std::string& output = attr.buffer().output();
+        if (!output.empty() && shown_outputs_.count(output) == 0) return;
         auto it = buffers_.find(id);
         if (it != buffers_.end()) {
           new_buffers.emplace(it->first, std::move(it->second));
@@ -173,22 +183,29 @@ void Editor::MoveEndOfLine() {
 
 void Editor::MoveDownN(int n) {
   SetSelectMode(false);
-  for (int i = 0; i < n; i++) CursorDown();
+  CursorVertical(n);
 }
 
 void Editor::MoveUpN(int n) {
   SetSelectMode(false);
-  for (int i = 0; i < n; i++) CursorUp();
+  CursorVertical(-n);
 }
 
 void Editor::SelectDownN(int n) {
   SetSelectMode(true);
-  for (int i = 0; i < n; i++) CursorDown();
+  CursorVertical(n);
 }
 
 void Editor::SelectUpN(int n) {
   SetSelectMode(true);
-  for (int i = 0; i < n; i++) CursorUp();
+  CursorVertical(-n);
+}
+
+void Editor::JumpToLine(int line) {
+  SetSelectMode(false);
+  line_index_.Update(state_.content);
+  cursor_ = line_index_.LineStart(line);
+  vertical_cursor_ = ID();
 }
 
 void Editor::Backspace() {
@@ -230,6 +247,135 @@ void Editor::InsChar(char c) {
   ChangeCursorLine(c == '\n');
 }
 
+void Editor::StartFind() {
+  finding_ = true;
+  find_origin_ = cursor_;
+  SetFindQuery("");
+}
+
+void Editor::EndFind() {
+  finding_ = false;
+  SetFindQuery("");
+  select_pending_ = false;
+}
+
+void Editor::FindInsChar(char c) { SetFindQuery(search_.query() + c); }
+
+void Editor::FindBackspace() {
+  std::string query = search_.query();
+  if (query.empty()) return;
+  query.pop_back();
+  SetFindQuery(query);
+}
+
+void Editor::FindNext() {
+  search_.Update(state_.content);
+  if (search_.done()) {
+    if (auto match = search_.NextMatch(cursor_)) SelectMatch(*match);
+  } else {
+    // scanning on from here finds it soonest
+    search_.SetQuery(search_.query(), cursor_);
+    select_pending_ = true;
+  }
+}
+
+void Editor::SetFindQuery(const std::string& query) {
+  search_.Update(state_.content);
+  search_.SetQuery(query, find_origin_);
+  // selected once the scan (which starts from find_origin_) finds it
+  select_pending_ = !search_.query().empty();
+}
+
+void Editor::SelectMatch(std::pair<ID, ID> match) {
+  selection_anchor_ = AnnotatedString::Iterator(state_.content, match.first)
+                          .Prev()
+                          .id();
+  cursor_ = match.second;
+  vertical_cursor_ = ID();
+}
+
+std::vector<std::string> Editor::FindStatus() const {
+  return {absl::StrCat("find: ", search_.query()),
+          absl::StrCat(search_.matches(), search_.done() ? "" : "+",
+                       " matches")};
+}
+
+void Editor::ToggleOutput(const std::string& output) {
+  if (!shown_outputs_.erase(output)) shown_outputs_.insert(output);
+  UpdateSideBuffers();
+}
+
+void Editor::StartPrompt(Prompt prompt) {
+  prompt_ = prompt;
+  prompt_text_.clear();
+}
+
+void Editor::PromptInsChar(char c) { prompt_text_ += c; }
+
+void Editor::PromptBackspace() {
+  if (!prompt_text_.empty()) prompt_text_.pop_back();
+}
+
+void Editor::PromptEnter() {
+  switch (prompt_) {
+    case Prompt::NONE:
+      break;
+    case Prompt::OUTPUT:
+      if (!prompt_text_.empty()) ToggleOutput(prompt_text_);
+      break;
+    case Prompt::LINE: {
+      int line;
+      if (absl::SimpleAtoi(prompt_text_, &line) && line > 0) {
+        JumpToLine(line - 1);
+      }
+    } break;
+  }
+  prompt_ = Prompt::NONE;
+}
+
+std::vector<std::string> Editor::PromptStatus() const {
+  switch (prompt_) {
+    case Prompt::NONE:
+      break;
+    case Prompt::OUTPUT:
+      return {absl::StrCat("show/hide output: ", prompt_text_),
+              absl::StrCat("shown: ", absl::StrJoin(shown_outputs_, ", "))};
+    case Prompt::LINE:
+      return {absl::StrCat("go to line: ", prompt_text_)};
+  }
+  return {};
+}
+
+bool Editor::PromptKey(Widget* content) {
+  if (auto c = content->CharPressed()) {
+    PromptInsChar(c);
+  } else if (content->Chord("del")) {
+    PromptBackspace();
+  } else if (content->Chord("ret")) {
+    PromptEnter();
+  } else if (content->Chord("C-g")) {
+    PromptCancel();
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool Editor::FindKey(Widget* content) {
+  if (auto c = content->CharPressed()) {
+    FindInsChar(c);
+  } else if (content->Chord("del")) {
+    FindBackspace();
+  } else if (content->Chord("ret") || content->Chord("C-f")) {
+    FindNext();
+  } else if (content->Chord("C-g")) {
+    EndFind();
+  } else {
+    return false;
+  }
+  return true;
+}
+
 void Editor::SetSelectMode(bool sel) {
   if (!sel) {
     selection_anchor_ = ID();
@@ -260,51 +406,30 @@ void Editor::CursorRight() {
   cursor_ = it.id();
 }
 
-void Editor::CursorDown() {
-  AnnotatedString::Iterator it(state_.content, cursor_);
-  int col = 0;
-  auto edge = [&it]() {
-    return it.is_begin() || it.is_end() || it.value() == '\n';
-  };
-  while (!edge()) {
-    it.MovePrev();
-    col++;
-  }
-  Log() << "col:" << col;
-  it = AnnotatedString::Iterator(state_.content, cursor_);
-  do {
-    it.MoveNext();
-  } while (!edge());
-  it.MoveNext();
-  for (; col > 0 && !edge(); col--) {
-    it.MoveNext();
-  }
-  it.MovePrev();
-  cursor_ = it.id();
-  ChangeCursorLine(1);
-}
-
-void Editor::CursorUp() {
-  AnnotatedString::Iterator it(state_.content, cursor_);
-  int col = 0;
-  auto edge = [&it]() {
-    return it.is_begin() || it.is_end() || it.value() == '\n';
-  };
-  while (!edge()) {
-    it.MovePrev();
-    col++;
+void Editor::CursorVertical(int delta) {
+  line_index_.Update(state_.content);
+  ID line_start = AnnotatedString::LineIterator(state_.content, cursor_).id();
+  if (cursor_ != vertical_cursor_) {
+    vertical_column_ = 0;
+    for (AnnotatedString::Iterator it(state_.content, cursor_);
+         it.id() != line_start; it.MovePrev()) {
+      vertical_column_++;
+    }
   }
-  Log() << "col:" << col;
-  do {
-    it.MovePrev();
-  } while (!edge());
-  it.MoveNext();
-  for (; col > 0 && !edge(); col--) {
-    it.MoveNext();
+  const int line = line_index_.LineOf(line_start);
+  const int target =
+      std::max(0, std::min(line + delta, line_index_.lines() - 1));
+  LOG(VERBOSE) << "line:" << line << " -> " << target
+               << " col:" << vertical_column_;
+  AnnotatedString::Iterator it(state_.content,
+                               line_index_.LineStart(target));
+  for (int col = 0; col < vertical_column_; col++) {
+    auto next = it.Next();
+    if (next.is_end() || next.value() == '\n') break;
+    it = next;
   }
-  it.MovePrev();
-  cursor_ = it.id();
-  ChangeCursorLine(-1);
+  cursor_ = vertical_cursor_ = it.id();
+  ChangeCursorLine(target - line);
 }
 
 void Editor::CursorStartOfLine() {
@@ -319,12 +444,58 @@ void Editor::CursorEndOfLine() {
                 .id();
 }
 
+std::vector<std::pair<ID, ID>> Editor::Selections() const {
+  std::vector<std::pair<ID, ID>> selections;
+  if (selection_anchor_ != ID()) {
+    selections.emplace_back(cursor_, selection_anchor_);
+  }
+  for (const auto& p : state_.presence) {
+    if (p.first == site_->site_id()) continue;
+    const SitePresence& presence = p.second;
+    if (presence.selection_anchor == ID()) continue;
+    // presence can arrive ahead of the edits it refers to
+    if (!state_.content.Contains(presence.cursor) ||
+        !state_.content.Contains(presence.selection_anchor)) {
+      continue;
+    }
+    selections.emplace_back(presence.cursor, presence.selection_anchor);
+  }
+  return selections;
+}
+
+// characters from first to last (inclusive) that lie in any of selections
+static std::set<ID> SelectedIDs(
+    const AnnotatedString& str, ID first, ID last,
+    const std::vector<std::pair<ID, ID>>& selections) {
+  std::set<ID> selected;
+  for (auto sel : selections) {
+    ID beg = sel.first;
+    ID end = sel.second;
+    if (str.OrderIDs(beg, end) > 0) std::swap(beg, end);
+    if (str.OrderIDs(end, first) <= 0 || str.OrderIDs(last, beg) < 0) {
+      continue;
+    }
+    bool inside = str.OrderIDs(beg, first) <= 0;
+    for (AnnotatedString::AllIterator it(str, first);; it.MoveNext()) {
+      if (it.id() == beg) inside = true;
+      if (it.id() == end) break;
+      if (inside) selected.insert(it.id());
+      if (it.id() == last || it.is_end()) break;
+    }
+  }
+  return selected;
+}
+
 void Editor::Render(Theme* theme, Widget* parent) {
   Widget* content = parent->MakeContent(
       Widget::Options().set_id(name_).set_activatable(editable_));
 
   if (content->Focus()) {
-    if (auto c = content->CharPressed()) {
+    if (finding_ && FindKey(content)) {
+      // handled
+    } else if (Prompting() && PromptKey(content)) {
+      // handled
+    } else if (auto c = content->CharPressed()) {
       InsChar(c);
     } else if (content->Chord("up")) {
       MoveUp();
@@ -342,6 +513,10 @@ void Editor::Render(Theme* theme, Widget* parent) {
       SelectUp();
     } else if (content->Chord("S-down")) {
       SelectDown();
+    } else if (content->Chord("page-up")) {
+      MovePageUp();
+    } else if (content->Chord("page-down")) {
+      MovePageDown();
     } else if (content->Chord("del")) {
       Backspace();
     } else if (content->Chord("C-c")) {
@@ -350,6 +525,12 @@ void Editor::Render(Theme* theme, Widget* parent) {
       Paste(content->renderer());
     } else if (content->Chord("C-x")) {
       Cut(content->renderer());
+    } else if (content->Chord("C-f")) {
+      StartFind();
+    } else if (content->Chord("C-o")) {
+      StartPrompt(Prompt::OUTPUT);
+    } else if (content->Chord("C-l")) {
+      StartPrompt(Prompt::LINE);
     } else if (content->Chord("ret")) {
       InsChar('\n');
     }
@@ -357,6 +538,9 @@ void Editor::Render(Theme* theme, Widget* parent) {
 
   auto* r = parent->renderer();
   auto ex = r->extents();
+  debug_.window_height =
+      static_cast<int>(parent->bottom().value() - parent->top().value());
+  page_lines_ = std::max(1, debug_.window_height / ex.chr_height - 1);
   r->solver()->add_constraints(
       {rhea::constraint(cursor_line_ == cursor_line_.value(),
                         rhea::strength::strong()),
@@ -369,103 +553,95 @@ void Editor::Render(Theme* theme, Widget* parent) {
        cursor_line_ * ex.chr_height <=
            parent->bottom() - parent->top() - ex.chr_height});
 
+  std::string find;
+  if (finding_) {
+    // what's in view is matched as it's drawn; this is for the rest (and
+    // for the match to select)
+    search_.Update(state_.content);
+    search_.Scan(absl::Milliseconds(FLAGS_find_scan_ms));
+    if (select_pending_) {
+      if (auto match = search_.FirstMatch()) {
+        SelectMatch(*match);
+        select_pending_ = false;
+      } else if (search_.done()) {
+        select_pending_ = false;
+      }
+    }
+    find = search_.query();
+  }
+
   ID cursor = cursor_ = AnnotatedString::Iterator(state_.content, cursor_).id();
   AnnotatedString::LineIterator line_cr(state_.content, cursor_);
   rhea::variable cursor_line = cursor_line_;
   if (!editable_) cursor = ID();
-  content->Draw(
-      [line_cr, cursor_line, cursor, ex, theme, content](DeviceContext* ctx) {
-        ctx->Fill(0, 0, ctx->width(), ctx->height(),
-                  theme->ThemeToken({}, 0).background);
-        int cl = cursor_line.value() * ex.chr_height;
-        ctx->Fill(0, cl, ctx->width(), cl + ex.chr_height,
-                  theme->ThemeToken({}, Theme::HIGHLIGHT_LINE).background);
-        AnnotatedString::LineIterator line_bk = line_cr;
-        AnnotatedString::LineIterator line_fw = line_cr;
-        RenderLine(ctx, ex, theme, cursor, cl, line_cr, true);
-        for (int i = 1; i <= ctx->height() / ex.chr_height; i++) {
-          if (line_bk.MovePrev()) {
-            RenderLine(ctx, ex, theme, cursor, cl - i * ex.chr_height, line_bk,
-                       false);
-          }
-          if (line_fw.MoveNext()) {
-            RenderLine(ctx, ex, theme, cursor, cl + i * ex.chr_height, line_fw,
-                       false);
-          }
-        }
-      });
-}
-
-typedef absl::InlinedVector<std::string, 2> GutterVec;
-
-struct CharDet {
-  CharDet(uint32_t base_flags, GutterVec* g)
-      : chr_flags(base_flags), gutters(g) {}
-  bool has_diagnostic = false;
-  uint32_t chr_flags;
-  std::vector<std::string> tags;
-  GutterVec* const gutters;
-
-  void AddGutter(std::string&& s) {
-    for (const auto& g : *gutters) {
-      if (s == g) return;
+  const AnnotatedString* str = &state_.content;
+  std::vector<std::pair<ID, ID>> selections = Selections();
+  std::shared_ptr<LineStyleCache> line_styles = line_styles_;
+  content->Draw([line_cr, cursor_line, cursor, ex, theme, content, str,
+                 selections, line_styles, find](DeviceContext* ctx) {
+    ctx->Fill(0, 0, ctx->width(), ctx->height(),
+              theme->ThemeToken({}, 0).background);
+    int cl = cursor_line.value() * ex.chr_height;
+    ctx->Fill(0, cl, ctx->width(), cl + ex.chr_height,
+              theme->ThemeToken({}, Theme::HIGHLIGHT_LINE).background);
+    const int rows = ctx->height() / ex.chr_height;
+    std::set<ID> selected;
+    if (!selections.empty()) {
+      AnnotatedString::LineIterator first = line_cr;
+      AnnotatedString::LineIterator last = line_cr;
+      for (int i = 0; i <= rows; i++) {
+        first.MovePrev();
+        last.MoveNext();
+      }
+      selected = SelectedIDs(*str, first.id(), last.id(), selections);
     }
-    gutters->emplace_back(std::move(s));
-  }
-
-  void FillFromIterator(AnnotatedString::AllIterator it) {
-    it.ForEachAttrValue([&](const Attribute& attr) {
-      switch (attr.data_case()) {
-        case Attribute::kSelection:
-          chr_flags |= Theme::SELECTED;
-          break;
-        case Attribute::kDiagnostic:
-          has_diagnostic = true;
-          break;
-        case Attribute::kTags:
-          for (auto t : attr.tags().tags()) {
-            tags.push_back(t);
-          }
-          break;
-        case Attribute::kSize:
-          switch (attr.size().type()) {
-            case SizeAnnotation::OFFSET_INTO_PARENT:
-              if (attr.size().bits()) {
-                AddGutter(absl::StrCat("@", attr.size().size(), ".",
-                                       attr.size().bits()));
-              } else {
-                AddGutter(absl::StrCat("@", attr.size().size()));
-              }
-              break;
-            case SizeAnnotation::SIZEOF_SELF:
-              if (attr.size().bits()) {
-                AddGutter(absl::StrCat(
-                    attr.size().size() * 8 + attr.size().bits(), "b"));
-              } else {
-                AddGutter(absl::StrCat(attr.size().size(), "B"));
-              }
-              break;
-            default:
-              break;
-          }
-          break;
-        default:
-          break;
+    AnnotatedString::LineIterator line_bk = line_cr;
+    AnnotatedString::LineIterator line_fw = line_cr;
+    RenderLine(ctx, ex, theme, cursor, selected, cl,
+               line_styles->Get(line_cr), true, find);
+    for (int i = 1; i <= rows; i++) {
+      if (line_bk.MovePrev()) {
+        RenderLine(ctx, ex, theme, cursor, selected, cl - i * ex.chr_height,
+                   line_styles->Get(line_bk), false, find);
       }
-    });
-  }
-};
+      if (line_fw.MoveNext()) {
+        RenderLine(ctx, ex, theme, cursor, selected, cl + i * ex.chr_height,
+                   line_styles->Get(line_fw), false, find);
+      }
+    }
+    line_styles->EndFrame();
+  });
+}
 
 void Editor::RenderLine(DeviceContext* ctx, const Device::Extents& extents,
-                        Theme* theme, ID cursor, int y,
-                        AnnotatedString::LineIterator lit, bool highlight) {
-  AnnotatedString::AllIterator it = lit.AsAllIterator();
+                        Theme* theme, ID cursor, const std::set<ID>& selected,
+                        int y, const LineStyleCache::Line& line,
+                        bool highlight, const std::string& find) {
   const uint32_t base_flags = highlight ? Theme::HIGHLIGHT_LINE : 0;
-  GutterVec gutter_annotations;
+  // which of the line's printed characters are part of a find match
+  std::vector<bool> found;
+  if (!find.empty()) {
+    std::string text;
+    for (const auto& c : line.chars) {
+      if (!c.visible || c.id == line.start) continue;
+      if (c.chr == '\n') break;
+      text += c.chr;
+    }
+    found.resize(text.size());
+    std::vector<size_t> at;
+    TextSearch::FindAll(text, find, &at);
+    for (size_t a : at) {
+      std::fill(found.begin() + a, found.begin() + a + find.size(), true);
+    }
+  }
+  size_t column = 0;
   int x_start = 0;
   std::string to_print;
   const CharFmt base_fmt = theme->ThemeToken({}, base_flags);
   CharFmt fmt = base_fmt;
+  // the theme is asked again only where the style or flags change
+  int last_style = -1;
+  uint32_t last_flags = 0;
   auto flush_print = [&]() {
     if (to_print.empty()) return;
     int x_end = x_start + extents.chr_width * to_print.length();
@@ -477,37 +653,40 @@ void Editor::RenderLine(DeviceContext* ctx, const Device::Extents& extents,
     x_start = x_end;
     to_print.clear();
   };
-  while (it.id() != AnnotatedString::End()) {
-    if (it.is_visible() || it.is_begin()) {
-      CharDet cd(base_flags, &gutter_annotations);
-      cd.FillFromIterator(it);
-      if (cd.has_diagnostic) {
-        cd.tags.push_back("invalid");
-      }
-      if (it.is_visible() && it.id() != lit.id()) {
-        if (it.value() == '\n') {
-          if (it.id() == cursor) {
-            ctx->MoveCursor(y + extents.chr_height, 0);
-          }
-          break;
-        } else {
-          char c = it.value();
-          auto cfmt = theme->ThemeToken(cd.tags, cd.chr_flags);
+  for (const auto& c : line.chars) {
+    if (c.visible && c.id != line.start) {
+      if (c.chr == '\n') {
+        if (c.id == cursor) {
+          ctx->MoveCursor(y + extents.chr_height, 0);
+        }
+        break;
+      } else {
+        uint32_t flags = base_flags;
+        if (!selected.empty() && selected.count(c.id)) {
+          flags |= Theme::SELECTED;
+        }
+        if (!found.empty() && found[column]) {
+          flags |= Theme::FIND_HIGHLIGHT;
+        }
+        column++;
+        if (c.style != last_style || flags != last_flags) {
+          auto cfmt = theme->ThemeToken(line.styles[c.style], flags);
+          last_style = c.style;
+          last_flags = flags;
           if (cfmt != fmt) {
             flush_print();
             fmt = cfmt;
           }
-          to_print += c;
         }
+        to_print += c.chr;
       }
-      if (it.id() == cursor) {
-        ctx->MoveCursor(y, x_start + to_print.length() * extents.chr_width);
-      }
     }
-    it.MoveNext();
+    if (c.id == cursor) {
+      ctx->MoveCursor(y, x_start + to_print.length() * extents.chr_width);
+    }
   }
   flush_print();
-  std::string gutter = absl::StrJoin(gutter_annotations, ",");
+  const std::string& gutter = line.gutter;
   int x = ctx->width() - gutter.length() * extents.chr_width;
   CharFmt fill_attr =
       theme->ThemeToken(::Theme::Tag{"comment.gutter"}, base_flags);
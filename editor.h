@@ -13,10 +13,15 @@
 // limitations under the License.
 #pragma once
 
+#include <deque>
 #include <numeric>
+#include <set>
 #include <string>
 #include "absl/strings/str_join.h"
 #include "buffer.h"
+#include "line_index.h"
+#include "line_style_cache.h"
+#include "text_search.h"
 #include "log.h"
 #include "render.h"
 #include "theme.h"
@@ -30,7 +35,7 @@ class Editor : public std::enable_shared_from_this<Editor> {
 
  private:
   Editor(Site* site, const std::string& name, bool editable)
-      : site_(site), name_(name), editable_(editable), ed_(site) {}
+      : site_(site), name_(name), editable_(editable) {}
 
  public:
   // state management
@@ -38,7 +43,8 @@ class Editor : public std::enable_shared_from_this<Editor> {
   const EditNotification& CurrentState() { return state_; }
   bool HasCommands() {
     return state_.shutdown || !unpublished_commands_.commands().empty() ||
-           cursor_reported_ != cursor_;
+           cursor_reported_ != cursor_ ||
+           selection_anchor_reported_ != selection_anchor_;
   }
   EditResponse MakeResponse();
 
@@ -59,6 +65,10 @@ class Editor : public std::enable_shared_from_this<Editor> {
   void SelectUpN(int n);
   void SelectDown() { SelectDownN(1); }
   void SelectUp() { SelectUpN(1); }
+  void MovePageDown() { MoveDownN(page_lines_); }
+  void MovePageUp() { MoveUpN(page_lines_); }
+  // line counts from 0
+  void JumpToLine(int line);
   void Backspace();
   void Copy(Renderer* env);
   void Cut(Renderer* env);
@@ -66,29 +76,71 @@ class Editor : public std::enable_shared_from_this<Editor> {
   void InsNewLine() { InsChar('\n'); }
   void InsChar(char c);
 
+  // incremental find: matches are highlighted as the query is typed, and
+  // the first one after where the find started is selected
+  void StartFind();
+  void EndFind();
+  void FindInsChar(char c);
+  void FindBackspace();
+  // select the next match after the cursor
+  void FindNext();
+  bool Finding() const { return finding_; }
+  // still searching the parts of the buffer out of view
+  bool FindPending() const { return finding_ && !search_.done(); }
+  std::vector<std::string> FindStatus() const;
+
+  // outputs of lazy server collaborators (like godbolt) whose side buffers
+  // are shown
+  const std::set<std::string>& ShownOutputs() const { return shown_outputs_; }
+  void ToggleOutput(const std::string& output);
+
+  // a command's argument, typed into the side bar: C-o prompts for an output
+  // to show or hide, C-l for a line (counting from 1) to jump to
+  enum class Prompt { NONE, OUTPUT, LINE };
+  void StartPrompt(Prompt prompt);
+  void PromptInsChar(char c);
+  void PromptBackspace();
+  // run the command on what's been typed, and close the prompt
+  void PromptEnter();
+  void PromptCancel() { prompt_ = Prompt::NONE; }
+  bool Prompting() const { return prompt_ != Prompt::NONE; }
+  std::vector<std::string> PromptStatus() const;
+
   void Render(Theme* theme, Widget* parent);
 
  private:
   void CursorLeft();
   void CursorRight();
-  void CursorDown();
-  void CursorUp();
+  // delta lines down (or up, if negative), keeping to the column the cursor
+  // had before the last run of vertical moves
+  void CursorVertical(int delta);
   void CursorStartOfLine();
   void CursorEndOfLine();
-  void PublishCursor();
+  void PublishCursor(EditResponse* response);
 
   void SetSelectMode(bool sel);
   bool SelectMode() const { return selection_anchor_ != ID(); }
   void DeleteSelection();
+  void SetFindQuery(const std::string& query);
+  void SelectMatch(std::pair<ID, ID> match);
+  // find mode's handling of the key pressed, if it has any
+  bool FindKey(Widget* content);
+  // likewise while prompting
+  bool PromptKey(Widget* content);
+  // side buffers from the current state, less those of hidden outputs
+  void UpdateSideBuffers();
 
   void ChangeCursorLine(int delta) {
     if (delta) {
       cursor_line_.set_value(cursor_line_.value() + delta);
     }
   }
+  // the ends of every site's selection
+  std::vector<std::pair<ID, ID>> Selections() const;
   static void RenderLine(DeviceContext* ctx, const Device::Extents& extents,
-                         Theme* theme, ID cursor, int y,
-                         AnnotatedString::LineIterator lit, bool highlight);
+                         Theme* theme, ID cursor, const std::set<ID>& selected,
+                         int y, const LineStyleCache::Line& line,
+                         bool highlight, const std::string& find);
 
   Site* const site_;
   const std::string name_;
@@ -97,10 +149,33 @@ class Editor : public std::enable_shared_from_this<Editor> {
   ID cursor_ = AnnotatedString::Begin();
   ID cursor_reported_ = AnnotatedString::End();
   ID selection_anchor_ = ID();
+  ID selection_anchor_reported_ = ID();
+  // where the last vertical move left the cursor, and the column it aimed
+  // for: moving on from there aims for the same column
+  ID vertical_cursor_ = ID();
+  int vertical_column_ = 0;
+  LineIndex line_index_;
+  // styles of the lines last drawn, shared with the draw callback
+  std::shared_ptr<LineStyleCache> line_styles_ =
+      std::make_shared<LineStyleCache>();
+  // lines in view when last rendered
+  int page_lines_ = 20;
+  bool finding_ = false;
+  // where the cursor was when the find started
+  ID find_origin_;
+  TextSearch search_;
+  // select the search's FirstMatch once it has one
+  bool select_pending_ = false;
+  std::set<std::string> shown_outputs_;
+  Prompt prompt_ = Prompt::NONE;
+  std::string prompt_text_;
+  uint64_t presence_seq_ = 0;
   EditNotification state_;
   CommandSet unpublished_commands_;
-  CommandSet unacknowledged_commands_;
-  AnnotationEditor ed_;
+  // what's been published but isn't yet in state_, by the number of the
+  // response it went out in (the buffer acks them in order)
+  std::deque<std::pair<uint64_t, CommandSet>> unacknowledged_commands_;
+  uint64_t responses_published_ = 0;
   struct BufferInfo {
     std::unique_ptr<Buffer> buffer;
     AnnotationEditor ed;
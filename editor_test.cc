@@ -0,0 +1,77 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "editor.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+class EditorTest : public ::testing::Test {
+ protected:
+  EditorTest() : editor_(Editor::Make(&site_, "test", true)) {}
+
+  void SetText(const std::string& text) {
+    CommandSet commands;
+    AnnotatedString::MakeRawInsert(&commands, &site_, text,
+                                   AnnotatedString::Begin(),
+                                   AnnotatedString::End());
+    state_.content = state_.content.Integrate(commands);
+    LogTimer tmr("editor_test");
+    editor_->UpdateState(&tmr, state_);
+  }
+
+  // the content once the editor's edits are integrated
+  std::string Text() {
+    IntegrateResponse(editor_->MakeResponse(), &state_);
+    return state_.content.Render();
+  }
+
+  void GoToLine(const std::string& typed) {
+    editor_->StartPrompt(Editor::Prompt::LINE);
+    for (char c : typed) editor_->PromptInsChar(c);
+    editor_->PromptEnter();
+  }
+
+  Site site_;
+  std::shared_ptr<Editor> editor_;
+  EditNotification state_;
+};
+
+}  // namespace
+
+TEST_F(EditorTest, GoToLinePromptJumps) {
+  SetText("one\ntwo\nthree\n");
+  GoToLine("3");
+  EXPECT_FALSE(editor_->Prompting());
+  editor_->InsChar('>');
+  EXPECT_EQ("one\ntwo\n>three\n", Text());
+}
+
+TEST_F(EditorTest, GoToLinePromptClampsAndIgnoresJunk) {
+  SetText("one\ntwo\n");
+  GoToLine("x");
+  editor_->InsChar('>');
+  GoToLine("99");
+  editor_->InsChar('<');
+  EXPECT_EQ(">one\ntwo\n<", Text());
+}
+
+TEST_F(EditorTest, CancelledPromptDoesNothing) {
+  SetText("one\ntwo\n");
+  editor_->StartPrompt(Editor::Prompt::LINE);
+  editor_->PromptInsChar('2');
+  editor_->PromptCancel();
+  editor_->PromptEnter();
+  editor_->InsChar('>');
+  EXPECT_EQ(">one\ntwo\n", Text());
+}
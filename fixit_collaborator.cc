@@ -19,23 +19,28 @@ class FixitCollaborator final : public SyncCollaborator {
  public:
   FixitCollaborator(const Buffer* buffer)
       : SyncCollaborator("fixit", absl::Milliseconds(1500),
-                         absl::Milliseconds(100)),
-        buffer_(buffer) {}
+                         absl::Milliseconds(100),
+                         CollaboratorPriority::ANALYSIS),
+        buffer_(buffer) {
+    set_interest(CollaboratorInterest::Attributes({Attribute::kFixit}));
+  }
 
-  EditResponse Edit(const EditNotification& notification) override;
+  EditResponse Edit(const EditNotification& notification,
+                    const CancellationToken& cancel) override;
 
  private:
   const Buffer* const buffer_;
 };
 
-EditResponse FixitCollaborator::Edit(const EditNotification& notification) {
+EditResponse FixitCollaborator::Edit(const EditNotification& notification,
+                                     const CancellationToken& cancel) {
   EditResponse response;
   notification.content.ForEachAnnotation(
       Attribute::kFixit, [&](ID annid, ID beg, ID end, const Attribute& attr) {
-        Log() << "FIXIT: " << attr.DebugString();
+        LOG(VERBOSE) << "FIXIT: " << attr.DebugString();
         const Fixit& fixit = attr.fixit();
         if (fixit.type() != Fixit::COMPILE_FIX) return;
-        Log() << "CONSUME FIXIT: " << annid.id;
+        LOG(VERBOSE) << "CONSUME FIXIT: " << annid.id;
         AnnotatedString::MakeDelMark(&response.content_updates, annid);
         notification.content.MakeDelete(&response.content_updates, beg, end);
         notification.content.MakeInsert(
@@ -23,12 +23,16 @@
 class GodboltCollaborator final : public SyncCollaborator {
  public:
   GodboltCollaborator(const Buffer* buffer)
-      : SyncCollaborator("godbolt", absl::Seconds(0), absl::Milliseconds(300)),
+      : SyncCollaborator("godbolt", absl::Seconds(0), absl::Milliseconds(300),
+                         CollaboratorPriority::BACKGROUND),
         buffer_(buffer),
         content_latch_(buffer),
-        ed_(buffer->site()) {}
+        ed_(buffer->site()) {
+    set_interest(CollaboratorInterest::Text(true));
+  }
 
-  EditResponse Edit(const EditNotification& notification) override;
+  EditResponse Edit(const EditNotification& notification,
+                    const CancellationToken& cancel) override;
 
  private:
   const Buffer* const buffer_;
@@ -42,7 +46,8 @@ class GodboltCollaborator final : public SyncCollaborator {
 #define OBJDUMP_BIN "objdump"
 #endif
 
-EditResponse GodboltCollaborator::Edit(const EditNotification& notification) {
+EditResponse GodboltCollaborator::Edit(const EditNotification& notification,
+                                       const CancellationToken& cancel) {
   EditResponse response;
   response.done = notification.shutdown;
   if (response.done) return response;
@@ -55,18 +60,21 @@ EditResponse GodboltCollaborator::Edit(const EditNotification& notification) {
   auto cmd =
       ClangCompileCommand(buffer_->project(), buffer_->filename().string(), "-",
                           tmpf.filename(), &args);
-  Log() << cmd << " " << absl::StrJoin(args, " ");
-  if (run(cmd, args, text).status != 0) {
+  LOG(INFO) << cmd << " " << absl::StrJoin(args, " ");
+  auto compiled = run(cmd, args, text, &cancel);
+  if (compiled.cancelled || compiled.status != 0) {
     return response;
   }
 
-  Log() << "objdump: " << tmpf.filename();
+  LOG(INFO) << "objdump: " << tmpf.filename();
   auto dump = run(
       OBJDUMP_BIN,
       {"-d", "-l", "-M", "intel", "-C", "--no-show-raw-insn", tmpf.filename()},
-      "");
+      "", &cancel);
+  // the listing is matched to source by line number: stale against new text
+  if (dump.cancelled || cancel.cancelled()) return response;
 
-  Log() << dump.out;
+  LOG(INFO) << dump.out;
   AsmParseResult parsed_asm = AsmParse(dump.out);
 
   AnnotationEditor::ScopedEdit edit(&ed_, &response.content_updates);
@@ -74,13 +82,14 @@ EditResponse GodboltCollaborator::Edit(const EditNotification& notification) {
   auto s = buffer_->filename() / "godbolt.s";
   side_buf.mutable_buffer()->set_name(s.string());
   side_buf.mutable_buffer()->set_contents(parsed_asm.body);
+  side_buf.mutable_buffer()->set_output(name());
   ID side_buf_id = ed_.AttrID(side_buf);
 
   AnnotatedString::LineIterator line_it(notification.content,
                                         AnnotatedString::Begin());
   int line_idx = 0;
   for (const auto& m : parsed_asm.src_to_asm_line) {
-    Log() << "line_idx=" << line_idx << " m.first=" << m.first;
+    LOG(VERBOSE) << "line_idx=" << line_idx << " m.first=" << m.first;
     while (line_idx < m.first) {
       line_it.MoveNext();
       line_idx++;
@@ -97,7 +106,7 @@ EditResponse GodboltCollaborator::Edit(const EditNotification& notification) {
   return response;
 }
 
-SERVER_COLLABORATOR(GodboltCollaborator, buffer) {
+LAZY_SERVER_COLLABORATOR(GodboltCollaborator, "godbolt", buffer) {
   auto fext = buffer->filename().extension();
   for (auto mext :
        {".c", ".cxx", ".cpp", ".C", ".cc", ".h", ".H", ".hpp", ".hxx"}) {
@@ -353,13 +353,24 @@ class GUI : public Application, public Device, public Invalidator {
             case SDLK_RIGHT:
               key_name += "right";
               break;
+            case SDLK_PAGEUP:
+              key_name += "page-up";
+              break;
+            case SDLK_PAGEDOWN:
+              key_name += "page-down";
+              break;
             case SDLK_ESCAPE:
               key_name += "esc";
               break;
             default:
-              key_name.clear();
+              if ((mod & KMOD_CTRL) && key >= SDLK_a && key <= SDLK_z) {
+                key_name += static_cast<char>(key);
+              } else {
+                key_name.clear();
+              }
           }
-          Log() << "key:" << key << " mod:" << mod << " name:" << key_name;
+          LOG(VERBOSE) << "key:" << key << " mod:" << mod
+                       << " name:" << key_name;
           if (key_name == "esc") {
             done_ = true;
           } else if (!key_name.empty()) {
@@ -0,0 +1,87 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "histogram.h"
+#include <algorithm>
+#include <cmath>
+#include "absl/strings/str_cat.h"
+
+constexpr int Histogram::kSubBucketBits;
+constexpr int Histogram::kSubBuckets;
+constexpr int Histogram::kMaxExponent;
+constexpr int Histogram::kBuckets;
+
+Histogram::Histogram() : count_(0), sum_us_(0), max_us_(0) {
+  for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+}
+
+int Histogram::BucketFor(uint64_t us) {
+  if (us < kSubBuckets) return static_cast<int>(us);
+  int e = 63 - __builtin_clzll(us);
+  if (e > kMaxExponent) return kBuckets - 1;
+  int sub = (us >> (e - kSubBucketBits)) & (kSubBuckets - 1);
+  return (e - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+uint64_t Histogram::BucketLimit(int b) {
+  b++;
+  if (b < kSubBuckets) return b;
+  int e = b / kSubBuckets + kSubBucketBits - 1;
+  int sub = b % kSubBuckets;
+  return static_cast<uint64_t>(kSubBuckets + sub) << (e - kSubBucketBits);
+}
+
+void Histogram::Add(absl::Duration d) {
+  int64_t us = std::max<int64_t>(0, absl::ToInt64Microseconds(d));
+  buckets_[BucketFor(us)].fetch_add(1, std::memory_order_relaxed);
+  sum_us_.fetch_add(us, std::memory_order_relaxed);
+  int64_t prev_max = max_us_.load(std::memory_order_relaxed);
+  while (prev_max < us && !max_us_.compare_exchange_weak(
+                              prev_max, us, std::memory_order_relaxed)) {
+  }
+  count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::Take() const {
+  Snapshot s;
+  s.count_ = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    s.buckets_[i] = buckets_[i].load(std::memory_order_relaxed);
+    s.count_ += s.buckets_[i];
+  }
+  s.sum_us_ = sum_us_.load(std::memory_order_relaxed);
+  s.max_us_ = max_us_.load(std::memory_order_relaxed);
+  return s;
+}
+
+absl::Duration Histogram::Snapshot::Percentile(double p) const {
+  if (count_ == 0) return absl::ZeroDuration();
+  uint64_t target = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(p * static_cast<double>(count_))));
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    seen += buckets_[i];
+    if (seen >= target) {
+      return absl::Microseconds(
+          std::min<int64_t>(max_us_, static_cast<int64_t>(BucketLimit(i))));
+    }
+  }
+  return max();
+}
+
+std::string Histogram::Snapshot::ToString() const {
+  return absl::StrCat("n=", count_,
+                      " p50=", absl::FormatDuration(Percentile(0.5)),
+                      " p99=", absl::FormatDuration(Percentile(0.99)),
+                      " max=", absl::FormatDuration(max()));
+}
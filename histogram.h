@@ -0,0 +1,67 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <string>
+#include "absl/time/time.h"
+
+// Lock-free log-linear latency histogram: microsecond resolution, four
+// buckets per power of two (so ~25% error), recordable from any thread
+class Histogram {
+ public:
+  static constexpr int kSubBucketBits = 2;
+  static constexpr int kSubBuckets = 1 << kSubBucketBits;
+  static constexpr int kMaxExponent = 40;  // ~12 days
+  static constexpr int kBuckets = kSubBuckets * kMaxExponent;
+
+  Histogram();
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  void Add(absl::Duration d);
+
+  class Snapshot {
+   public:
+    uint64_t count() const { return count_; }
+    absl::Duration sum() const { return absl::Microseconds(sum_us_); }
+    absl::Duration max() const { return absl::Microseconds(max_us_); }
+    uint64_t bucket(int i) const { return buckets_[i]; }
+    // estimate of the value below which a fraction p of samples fall
+    absl::Duration Percentile(double p) const;
+    std::string ToString() const;
+
+   private:
+    friend class Histogram;
+    uint64_t count_ = 0;
+    int64_t sum_us_ = 0;
+    int64_t max_us_ = 0;
+    std::array<uint64_t, kBuckets> buckets_;
+  };
+
+  // not atomic across buckets: concurrent Adds may be partially visible
+  Snapshot Take() const;
+
+  static int BucketFor(uint64_t us);
+  // exclusive upper bound of bucket b
+  static uint64_t BucketLimit(int b);
+
+ private:
+  std::atomic<uint64_t> count_;
+  std::atomic<int64_t> sum_us_;
+  std::atomic<int64_t> max_us_;
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_;
+};
@@ -0,0 +1,59 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "histogram.h"
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+TEST(HistogramTest, Empty) {
+  Histogram h;
+  auto s = h.Take();
+  EXPECT_EQ(0, s.count());
+  EXPECT_EQ(absl::ZeroDuration(), s.Percentile(0.99));
+}
+
+TEST(HistogramTest, BucketsAreContiguous) {
+  for (int b = 0; b < Histogram::kBuckets - 1; b++) {
+    uint64_t limit = Histogram::BucketLimit(b);
+    EXPECT_EQ(b, Histogram::BucketFor(limit - 1)) << limit;
+    EXPECT_EQ(b + 1, Histogram::BucketFor(limit)) << limit;
+  }
+}
+
+TEST(HistogramTest, Percentiles) {
+  Histogram h;
+  for (int i = 1; i <= 100; i++) h.Add(absl::Milliseconds(i));
+  auto s = h.Take();
+  EXPECT_EQ(100, s.count());
+  EXPECT_EQ(absl::Milliseconds(100), s.max());
+  EXPECT_EQ(absl::Milliseconds(5050), s.sum());
+  // buckets are a quarter of a power of two wide
+  EXPECT_GE(s.Percentile(0.5), absl::Milliseconds(50));
+  EXPECT_LE(s.Percentile(0.5), absl::Milliseconds(64));
+  EXPECT_GE(s.Percentile(0.99), absl::Milliseconds(99));
+  EXPECT_LE(s.Percentile(0.99), absl::Milliseconds(100));
+}
+
+TEST(HistogramTest, ConcurrentAdds) {
+  Histogram h;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&h, t]() {
+      for (int i = 0; i < 10000; i++) h.Add(absl::Microseconds(t * 1000 + i));
+    });
+  }
+  for (auto& t : threads) t.join();
+  EXPECT_EQ(40000, h.Take().count());
+  EXPECT_EQ(absl::Microseconds(12999), h.Take().max());
+}
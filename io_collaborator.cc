@@ -36,9 +36,11 @@ class IOCollaborator final : public AsyncCollaborator {
 };
 
 IOCollaborator::IOCollaborator(const Buffer* buffer)
-    : AsyncCollaborator("io", absl::Milliseconds(100), absl::Milliseconds(500)),
+    : AsyncCollaborator("io", absl::Milliseconds(100), absl::Milliseconds(500),
+                        CollaboratorPriority::BACKGROUND),
       buffer_(buffer),
       last_char_id_(AnnotatedString::Begin()) {
+  set_interest(CollaboratorInterest::Text(false));
   fd_ = WrapSyscall("open", [this]() {
     return open(buffer_->filename().string().c_str(), O_RDONLY);
   });
@@ -69,6 +71,15 @@ void IOCollaborator::Push(const EditNotification& notification) {
 }
 
 EditResponse IOCollaborator::Pull() {
+  if (buffer_->restored()) {
+    EditResponse r;
+    r.done = true;
+    r.become_loaded = true;
+    close(fd_);
+    fd_ = 0;
+    return r;
+  }
+
   static constexpr const int kChunkSize = 4096;
   char buf[kChunkSize];
   const int n = WrapSyscall(
@@ -27,7 +27,8 @@ class LibClangCollaborator final : public SyncCollaborator {
   LibClangCollaborator(const Buffer* buffer);
   ~LibClangCollaborator();
 
-  EditResponse Edit(const EditNotification& notification) override;
+  EditResponse Edit(const EditNotification& notification,
+                    const CancellationToken& cancel) override;
 
  private:
   const Buffer* const buffer_;
@@ -86,7 +87,7 @@ IMPL_PROJECT_GLOBAL_ASPECT(ClangEnv, project, 0) {
   try {
     return std::unique_ptr<ProjectAspect>(new ClangEnv(project));
   } catch (std::exception& e) {
-    Log() << "Error starting clang environment: " << e.what();
+    LOG(ERROR) << "Error starting clang environment: " << e.what();
     return nullptr;
   }
 }
@@ -94,10 +95,14 @@ IMPL_PROJECT_GLOBAL_ASPECT(ClangEnv, project, 0) {
 }  // namespace
 
 LibClangCollaborator::LibClangCollaborator(const Buffer* buffer)
-    : SyncCollaborator("libclang", absl::Seconds(0), absl::Milliseconds(1)),
+    : SyncCollaborator("libclang", absl::Seconds(0), absl::Milliseconds(1),
+                       CollaboratorPriority::ANALYSIS),
       buffer_(buffer),
       content_latch_(true),
-      ed_(buffer->site()) {}
+      ed_(buffer->site()) {
+  // its own diagnostics and tokens (and cursor moves) needn't wake it
+  set_interest(CollaboratorInterest::Text(true));
+}
 
 LibClangCollaborator::~LibClangCollaborator() {
   ClangEnv* env = buffer_->project()->aspect<ClangEnv>();
@@ -176,7 +181,8 @@ static bool IsPunctuation(char c) {
   }
 }
 
-EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
+EditResponse LibClangCollaborator::Edit(const EditNotification& notification,
+                                        const CancellationToken& cancel) {
   LogTimer tmr("libclang_edit");
 
   EditResponse response;
@@ -212,6 +218,14 @@ EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
   tmr.Mark("prelude");
 
   absl::MutexLock lock(env->mu());
+  // the environment is shared by every buffer in the project: if the content
+  // moved on while we waited for it, reparse the newer text instead.
+  // (once reparsed, results are integrated even if stale: annotations are
+  // anchored to character ids, so they rebase onto the new content for free)
+  if (cancel.cancelled()) {
+    LOG(INFO) << "libclang: skipping reparse of superseded content";
+    return response;
+  }
   env->UpdateUnsavedFile(filename, str);
   std::vector<std::string> cmd_args_strs;
   ClangCompileArgs(buffer_->project(), filename, &cmd_args_strs);
@@ -219,7 +233,7 @@ EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
   for (auto& arg : cmd_args_strs) {
     cmd_args.push_back(arg.c_str());
   }
-  Log() << "libclang args: " << absl::StrJoin(cmd_args, " ");
+  LOG(INFO) << "libclang args: " << absl::StrJoin(cmd_args, " ");
   std::vector<CXUnsavedFile> unsaved_files = env->GetUnsavedFiles();
   CXTranslationUnit tu = static_cast<CXTranslationUnit>(tu_);
   if (tu == nullptr) {
@@ -231,10 +245,10 @@ EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
         env->index(), filename.c_str(), cmd_args.data(), cmd_args.size(),
         unsaved_files.data(), unsaved_files.size(), options);
     if (tu == NULL) {
-      Log() << "Cannot parse translation unit";
+      LOG(ERROR) << "Cannot parse translation unit";
       return response;
     }
-    Log() << "Parsed: " << tu;
+    LOG(INFO) << "Parsed: " << tu;
 
     tmr.Mark("parse");
 
@@ -245,7 +259,7 @@ EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
   if (0 != env->clang_reparseTranslationUnit(
                tu, unsaved_files.size(), unsaved_files.data(),
                env->clang_defaultReparseOptions(tu))) {
-    Log() << "failed reparse";
+    LOG(ERROR) << "failed reparse";
     return response;
   }
 
@@ -262,7 +276,7 @@ EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
         env->clang_getLocationForOffset(tu, file, str.length());
     if (env->clang_equalLocations(topLoc, env->clang_getNullLocation()) ||
         env->clang_equalLocations(lastLoc, env->clang_getNullLocation())) {
-      Log() << "cannot retrieve location";
+      LOG(INFO) << "cannot retrieve location";
       env->clang_disposeTranslationUnit(tu);
       return response;
     }
@@ -270,7 +284,7 @@ EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
     // make a range from locations
     CXSourceRange range = env->clang_getRange(topLoc, lastLoc);
     if (env->clang_Range_isNull(range)) {
-      Log() << "cannot retrieve range";
+      LOG(INFO) << "cannot retrieve range";
       env->clang_disposeTranslationUnit(tu);
       return response;
     }
@@ -385,7 +399,7 @@ EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
 
     if (notification.fully_loaded) {
       unsigned num_diagnostics = env->clang_getNumDiagnostics(tu);
-      Log() << num_diagnostics << " diagnostics";
+      LOG(INFO) << num_diagnostics << " diagnostics";
       for (unsigned i = 0; i < num_diagnostics; i++) {
         CXDiagnostic cxdiag = env->clang_getDiagnostic(tu, i);
         CXString message = env->clang_formatDiagnostic(cxdiag, 0);
@@ -419,7 +433,7 @@ EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
           // diagnostic_editor_.AddPoint(ids[offset]);
         }
         unsigned num_fixits = env->clang_getDiagnosticNumFixIts(cxdiag);
-        Log() << "num_fixits:" << num_fixits;
+        LOG(INFO) << "num_fixits:" << num_fixits;
         for (unsigned j = 0; j < num_fixits; j++) {
           CXSourceRange extent;
           CXString repl = env->clang_getDiagnosticFixIt(cxdiag, j, &extent);
@@ -429,10 +443,10 @@ EditResponse LibClangCollaborator::Edit(const EditNotification& notification) {
           unsigned line, col, offset_start, offset_end;
           env->clang_getFileLocation(start, &file, &line, &col, &offset_start);
           env->clang_getFileLocation(end, &file, &line, &col, &offset_end);
-          Log() << file;
+          LOG(INFO) << file;
           if (file)
-            Log() << filename << " "
-                  << env->clang_getCString(env->clang_getFileName(file));
+            LOG(INFO) << filename << " "
+                      << env->clang_getCString(env->clang_getFileName(file));
           if (file && boost::filesystem::equivalent(
                           filename, env->clang_getCString(
                                         env->clang_getFileName(file)))) {
@@ -0,0 +1,127 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "line_index.h"
+#include <algorithm>
+
+constexpr size_t LineIndex::kBlockLines;
+
+void LineIndex::Update(const AnnotatedString& content) {
+  if (!built_) {
+    built_ = true;
+    content_ = content;
+    Rebuild();
+    return;
+  }
+  // edits within lines leave the line breaks as they were
+  if (content_.SameLineIdentity(content)) return;
+  std::vector<ID> added;
+  content.ForEachLineChange(content_, [&](ID id, bool now) {
+    if (now) {
+      added.push_back(id);
+    } else if (block_of_.count(id.id)) {
+      Erase(id);
+    }
+  });
+  // each new start goes after the line before it, which may be new too:
+  // those go in first
+  for (ID id : added) {
+    std::vector<ID> chain;
+    for (AnnotatedString::LineIterator it(content, id);
+         !block_of_.count(it.id().id); it.MovePrev()) {
+      chain.push_back(it.id());
+      // Begin is always indexed, so this stops
+      if (it.id() == AnnotatedString::Begin()) break;
+    }
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      AnnotatedString::LineIterator prev(content, *it);
+      prev.MovePrev();
+      Insert(prev.id(), *it);
+    }
+  }
+  content_ = content;
+  Renumber();
+}
+
+void LineIndex::Rebuild() {
+  blocks_.clear();
+  block_of_.clear();
+  AnnotatedString::LineIterator it(content_, AnnotatedString::Begin());
+  do {
+    if (blocks_.empty() || blocks_.back()->starts.size() >= kBlockLines) {
+      blocks_.emplace_back(new Block);
+    }
+    blocks_.back()->starts.push_back(it.id());
+    block_of_[it.id().id] = blocks_.back().get();
+  } while (it.MoveNext() && !it.is_end());
+  Renumber();
+}
+
+void LineIndex::Insert(ID after, ID start) {
+  Block* block = block_of_[after.id];
+  auto pos = std::find(block->starts.begin(), block->starts.end(), after);
+  block->starts.insert(pos + 1, start);
+  block_of_[start.id] = block;
+  if (block->starts.size() < 2 * kBlockLines) return;
+  // split in half
+  std::unique_ptr<Block> second(new Block);
+  second->starts.assign(block->starts.begin() + kBlockLines,
+                        block->starts.end());
+  block->starts.resize(kBlockLines);
+  for (ID id : second->starts) block_of_[id.id] = second.get();
+  auto it = std::find_if(
+      blocks_.begin(), blocks_.end(),
+      [block](const std::unique_ptr<Block>& b) { return b.get() == block; });
+  blocks_.insert(it + 1, std::move(second));
+}
+
+void LineIndex::Erase(ID start) {
+  auto found = block_of_.find(start.id);
+  Block* block = found->second;
+  block_of_.erase(found);
+  block->starts.erase(
+      std::find(block->starts.begin(), block->starts.end(), start));
+  if (!block->starts.empty()) return;
+  blocks_.erase(std::find_if(
+      blocks_.begin(), blocks_.end(),
+      [block](const std::unique_ptr<Block>& b) { return b.get() == block; }));
+}
+
+void LineIndex::Renumber() {
+  lines_ = 0;
+  for (auto& block : blocks_) {
+    block->first_line = lines_;
+    lines_ += block->starts.size();
+  }
+}
+
+ID LineIndex::LineStart(int line) const {
+  line = std::max(0, std::min(line, lines_ - 1));
+  // the last block starting at or before line
+  auto it = std::upper_bound(
+      blocks_.begin(), blocks_.end(), line,
+      [](int line, const std::unique_ptr<Block>& block) {
+        return line < block->first_line;
+      });
+  const Block& block = **(it - 1);
+  return block.starts[line - block.first_line];
+}
+
+int LineIndex::LineOf(ID line_start) const {
+  auto found = block_of_.find(line_start.id);
+  if (found == block_of_.end()) return 0;
+  const Block& block = *found->second;
+  return block.first_line +
+         (std::find(block.starts.begin(), block.starts.end(), line_start) -
+          block.starts.begin());
+}
@@ -0,0 +1,61 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "annotated_string.h"
+
+// Line starts of an AnnotatedString by line number, so moving by lines costs
+// a lookup rather than a walk over every line in between. The starts are
+// kept in order in blocks of a few hundred, each knowing its first line
+// number: adding or removing lines updates the blocks they fall in (and
+// renumbers the blocks) rather than the whole index. Edits within lines
+// don't touch it.
+class LineIndex {
+ public:
+  // make the index describe content
+  void Update(const AnnotatedString& content);
+
+  // lines in the content (at least 1: an empty string has one)
+  int lines() const { return lines_; }
+  // the line start (newline or Begin, as AnnotatedString::LineIterator has
+  // it) of line, clamped to the content
+  ID LineStart(int line) const;
+  // the line number of a line start
+  int LineOf(ID line_start) const;
+
+ private:
+  // blocks split once they reach twice this
+  static constexpr size_t kBlockLines = 256;
+
+  struct Block {
+    int first_line;
+    std::vector<ID> starts;
+  };
+
+  void Rebuild();
+  // start goes just after after, which is indexed
+  void Insert(ID after, ID start);
+  void Erase(ID start);
+  void Renumber();
+
+  bool built_ = false;
+  AnnotatedString content_;
+  int lines_ = 0;
+  std::vector<std::unique_ptr<Block>> blocks_;
+  // by ID::id
+  std::unordered_map<uint64_t, Block*> block_of_;
+};
@@ -0,0 +1,108 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "line_index.h"
+#include <gtest/gtest.h>
+#include <random>
+
+TEST(LineIndexTest, Empty) {
+  LineIndex index;
+  index.Update(AnnotatedString());
+  EXPECT_EQ(1, index.lines());
+  EXPECT_EQ(AnnotatedString::Begin(), index.LineStart(0));
+  EXPECT_EQ(AnnotatedString::Begin(), index.LineStart(5));
+}
+
+TEST(LineIndexTest, FindsLines) {
+  Site site;
+  AnnotatedString str;
+  str.Insert(&site, "ab\ncd\n\nef", AnnotatedString::Begin());
+  LineIndex index;
+  index.Update(str);
+  ASSERT_EQ(4, index.lines());
+  for (int i = 0; i < index.lines(); i++) {
+    EXPECT_EQ(i, index.LineOf(index.LineStart(i)));
+  }
+  AnnotatedString::Iterator it(str, index.LineStart(3));
+  it.MoveNext();
+  EXPECT_EQ('e', it.value());
+  EXPECT_EQ(index.LineStart(3), index.LineStart(100));
+}
+
+TEST(LineIndexTest, FollowsEdits) {
+  Site site;
+  AnnotatedString str;
+  ID last = str.Insert(&site, "a\nb", AnnotatedString::Begin());
+  LineIndex index;
+  index.Update(str);
+  EXPECT_EQ(2, index.lines());
+  str.Insert(&site, "\nc\nd", last);
+  index.Update(str);
+  EXPECT_EQ(4, index.lines());
+  // typing within a line keeps the lines
+  AnnotatedString typed = str;
+  typed.Insert(&site, "xyz", index.LineStart(1));
+  EXPECT_TRUE(typed.SameLineIdentity(str));
+  EXPECT_FALSE(typed.SameContentIdentity(str));
+}
+
+TEST(LineIndexTest, MatchesARebuildAcrossLineEdits) {
+  Site site;
+  AnnotatedString str;
+  std::string text;
+  for (int i = 0; i < 2000; i++) text += "line\n";
+  str.Insert(&site, text, AnnotatedString::Begin());
+  LineIndex index;
+  index.Update(str);
+  std::mt19937 rng(42);
+  for (int round = 0; round < 200; round++) {
+    // somewhere in the string
+    AnnotatedString::Iterator it(str, AnnotatedString::Begin());
+    for (int n = rng() % 5000; n > 0 && !it.Next().is_end(); n--) {
+      it.MoveNext();
+    }
+    if (rng() % 2) {
+      str.Insert(&site, round % 3 ? "a\nb\n\n" : "\n", it.id());
+    } else {
+      AnnotatedString::Iterator end = it;
+      for (int n = rng() % 40; n > 0 && !end.Next().is_end(); n--) {
+        end.MoveNext();
+      }
+      it.MoveNext();
+      CommandSet commands;
+      str.MakeDelete(&commands, it.id(), end.id());
+      str = str.Integrate(commands);
+    }
+    index.Update(str);
+    LineIndex fresh;
+    fresh.Update(str);
+    ASSERT_EQ(fresh.lines(), index.lines());
+    for (int i = 0; i < fresh.lines(); i++) {
+      ASSERT_EQ(fresh.LineStart(i), index.LineStart(i)) << round << " " << i;
+      ASSERT_EQ(i, index.LineOf(index.LineStart(i)));
+    }
+  }
+  // enough lines in one place to split its block more than once
+  ID at = index.LineStart(10);
+  for (int i = 0; i < 1500; i++) {
+    str.Insert(&site, "\n", at);
+    index.Update(str);
+  }
+  LineIndex fresh;
+  fresh.Update(str);
+  ASSERT_EQ(fresh.lines(), index.lines());
+  for (int i = 0; i < fresh.lines(); i++) {
+    ASSERT_EQ(fresh.LineStart(i), index.LineStart(i)) << i;
+    ASSERT_EQ(i, index.LineOf(index.LineStart(i)));
+  }
+}
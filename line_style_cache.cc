@@ -0,0 +1,159 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "line_style_cache.h"
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+
+namespace {
+
+typedef absl::InlinedVector<std::string, 2> GutterVec;
+
+struct CharDet {
+  explicit CharDet(GutterVec* g) : gutters(g) {}
+  bool has_diagnostic = false;
+  Theme::Tag tags;
+  GutterVec* const gutters;
+
+  void AddGutter(std::string&& s) {
+    for (const auto& g : *gutters) {
+      if (s == g) return;
+    }
+    gutters->emplace_back(std::move(s));
+  }
+
+  void FillFromIterator(AnnotatedString::AllIterator it) {
+    it.ForEachAttrValue([&](const Attribute& attr) {
+      switch (attr.data_case()) {
+        case Attribute::kDiagnostic:
+          has_diagnostic = true;
+          break;
+        case Attribute::kTags:
+          for (auto t : attr.tags().tags()) {
+            tags.push_back(t);
+          }
+          break;
+        case Attribute::kSize:
+          switch (attr.size().type()) {
+            case SizeAnnotation::OFFSET_INTO_PARENT:
+              if (attr.size().bits()) {
+                AddGutter(absl::StrCat("@", attr.size().size(), ".",
+                                       attr.size().bits()));
+              } else {
+                AddGutter(absl::StrCat("@", attr.size().size()));
+              }
+              break;
+            case SizeAnnotation::SIZEOF_SELF:
+              if (attr.size().bits()) {
+                AddGutter(absl::StrCat(
+                    attr.size().size() * 8 + attr.size().bits(), "b"));
+              } else {
+                AddGutter(absl::StrCat(attr.size().size(), "B"));
+              }
+              break;
+            default:
+              break;
+          }
+          break;
+        default:
+          break;
+      }
+    });
+  }
+};
+
+// the characters of a line a render looks at; F(it) returns false to stop
+template <class F>
+void ForEachLineChar(AnnotatedString::AllIterator it, ID line_start, F&& f) {
+  while (it.id() != AnnotatedString::End()) {
+    if (it.is_visible() || it.is_begin()) {
+      if (!f(it)) return;
+      if (it.is_visible() && it.id() != line_start && it.value() == '\n') {
+        return;
+      }
+    }
+    it.MoveNext();
+  }
+}
+
+}  // namespace
+
+const LineStyleCache::Line& LineStyleCache::Get(
+    AnnotatedString::LineIterator lit) {
+  auto emplaced = lines_.emplace(lit.id(), Line());
+  Line& line = emplaced.first->second;
+  line.used = frame_;
+  if (emplaced.second || !Unchanged(line, lit.AsAllIterator(), lit.id())) {
+    rebuilds_++;
+    Rebuild(&line, lit.AsAllIterator(), lit.id());
+  }
+  return line;
+}
+
+void LineStyleCache::EndFrame() {
+  for (auto it = lines_.begin(); it != lines_.end();) {
+    if (it->second.used != frame_) {
+      it = lines_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  frame_++;
+}
+
+bool LineStyleCache::Unchanged(const Line& line,
+                               AnnotatedString::AllIterator it,
+                               ID line_start) {
+  size_t i = 0;
+  bool same = true;
+  ForEachLineChar(it, line_start, [&](const AnnotatedString::AllIterator& c) {
+    if (i == line.chars.size()) {
+      same = false;
+      return false;
+    }
+    const Char& prev = line.chars[i++];
+    same = prev.id == c.id() && prev.visible == c.is_visible() &&
+           prev.chr == c.value() &&
+           prev.annotations.SameIdentity(c.annotation_ids());
+    return same;
+  });
+  return same && i == line.chars.size();
+}
+
+void LineStyleCache::Rebuild(Line* line, AnnotatedString::AllIterator it,
+                             ID line_start) {
+  line->start = line_start;
+  line->chars.clear();
+  line->styles.clear();
+  GutterVec gutter_annotations;
+  ForEachLineChar(it, line_start, [&](const AnnotatedString::AllIterator& c) {
+    CharDet cd(&gutter_annotations);
+    cd.FillFromIterator(c);
+    if (cd.has_diagnostic) {
+      cd.tags.push_back("invalid");
+    }
+    size_t style = 0;
+    while (style < line->styles.size() && line->styles[style] != cd.tags) {
+      style++;
+    }
+    if (style == line->styles.size()) {
+      line->styles.emplace_back(std::move(cd.tags));
+    }
+    line->chars.emplace_back(Char{c.id(), c.value(), c.is_visible(),
+                                  static_cast<uint16_t>(style),
+                                  c.annotation_ids()});
+    return true;
+  });
+  line->gutter = absl::StrJoin(gutter_annotations, ",");
+}
@@ -0,0 +1,71 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "annotated_string.h"
+#include "theme.h"
+
+// What RenderLine needs to know about each line on screen (its characters,
+// the theme tags each one carries and the gutter text), kept between frames.
+// A line's entry is checked against the string by walking its characters and
+// comparing their ids and annotation sets by identity; only a line whose
+// characters or annotations changed has its attributes looked up again.
+// Not thread safe: touch it from one render callback at a time.
+class LineStyleCache {
+ public:
+  struct Char {
+    ID id;
+    char chr;
+    bool visible;
+    // index into Line::styles
+    uint16_t style;
+    AVL<ID> annotations;
+  };
+
+  struct Line {
+    ID start;
+    // the characters a render of the line visits: its line start (if still
+    // visible), the visible characters following it and the newline ending
+    // it, if any
+    std::vector<Char> chars;
+    // distinct tag sets of chars, in order of first appearance
+    std::vector<Theme::Tag> styles;
+    std::string gutter;
+    uint64_t used = 0;
+  };
+
+  // the line that starts at lit, recomputed if it changed since it was last
+  // returned
+  const Line& Get(AnnotatedString::LineIterator lit);
+
+  // forget lines not returned since the last call
+  void EndFrame();
+
+  // times a line had to be recomputed
+  uint64_t rebuilds() const { return rebuilds_; }
+  size_t size() const { return lines_.size(); }
+
+ private:
+  static bool Unchanged(const Line& line, AnnotatedString::AllIterator it,
+                        ID line_start);
+  static void Rebuild(Line* line, AnnotatedString::AllIterator it,
+                      ID line_start);
+
+  std::map<ID, Line> lines_;
+  uint64_t frame_ = 1;
+  uint64_t rebuilds_ = 0;
+};
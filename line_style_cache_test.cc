@@ -0,0 +1,92 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "line_style_cache.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+ID Tag(AnnotatedString* str, Site* site, ID beg, ID end,
+       const std::string& tag) {
+  CommandSet commands;
+  Attribute attr;
+  attr.mutable_tags()->add_tags(tag);
+  ID attr_id = AnnotatedString::MakeDecl(&commands, site, attr);
+  Annotation ann;
+  ann.set_begin(beg.id);
+  ann.set_end(end.id);
+  ann.set_attribute(attr_id.id);
+  AnnotatedString::MakeMark(&commands, site, ann);
+  *str = str->Integrate(commands);
+  return attr_id;
+}
+
+std::string Text(const LineStyleCache::Line& line) {
+  std::string r;
+  for (const auto& c : line.chars) {
+    if (c.visible && c.id != line.start && c.chr != '\n') r += c.chr;
+  }
+  return r;
+}
+
+}  // namespace
+
+TEST(LineStyleCacheTest, StylesRuns) {
+  Site site;
+  AnnotatedString str;
+  str.Insert(&site, "abcd\nef", AnnotatedString::Begin());
+  AnnotatedString::Iterator c(str, AnnotatedString::Begin());
+  for (int i = 0; i < 3; i++) c.MoveNext();
+  // marks "ab"
+  Tag(&str, &site, AnnotatedString::Begin(), c.id(), "keyword");
+  AnnotatedString::LineIterator lit(str, AnnotatedString::Begin());
+  LineStyleCache cache;
+  const auto& line = cache.Get(lit);
+  EXPECT_EQ("abcd", Text(line));
+  ASSERT_EQ(2u, line.styles.size());
+  EXPECT_EQ(Theme::Tag{"keyword"}, line.styles[line.chars[1].style]);
+  EXPECT_EQ(Theme::Tag{}, line.styles[line.chars[3].style]);
+}
+
+TEST(LineStyleCacheTest, RebuildsOnlyChangedLines) {
+  Site site;
+  AnnotatedString str;
+  ID last = str.Insert(&site, "one\ntwo\nthree", AnnotatedString::Begin());
+  LineStyleCache cache;
+  auto render = [&]() {
+    std::vector<std::string> lines;
+    AnnotatedString::LineIterator lit(str, AnnotatedString::Begin());
+    for (; !lit.is_end(); lit.MoveNext()) {
+      lines.push_back(Text(cache.Get(lit)));
+    }
+    cache.EndFrame();
+    return lines;
+  };
+  EXPECT_EQ((std::vector<std::string>{"one", "two", "three"}), render());
+  EXPECT_EQ(3u, cache.rebuilds());
+  render();
+  EXPECT_EQ(3u, cache.rebuilds());
+  // typing on the last line redoes just that line
+  str.Insert(&site, "!", last);
+  EXPECT_EQ((std::vector<std::string>{"one", "two", "three!"}), render());
+  EXPECT_EQ(4u, cache.rebuilds());
+  // as does annotating the first
+  Tag(&str, &site, AnnotatedString::Begin(), last, "string");
+  AnnotatedString::LineIterator first(str, AnnotatedString::Begin());
+  EXPECT_EQ(Theme::Tag{"string"},
+            cache.Get(first).styles[cache.Get(first).chars[1].style]);
+  EXPECT_EQ(5u, cache.rebuilds());
+  EXPECT_EQ(3u, cache.size());
+  cache.EndFrame();
+  EXPECT_EQ(1u, cache.size());
+}
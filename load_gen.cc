@@ -0,0 +1,358 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "annotated_string.h"
+#include "application.h"
+#include "client.h"
+#include "histogram.h"
+#include "log.h"
+#include "server.h"
+
+DEFINE_int32(load_clients, 8, "Edit streams LoadGen opens");
+DEFINE_int32(load_files, 2, "Scratch files LoadGen spreads its streams over");
+DEFINE_int32(load_file_lines, 200, "Lines each scratch file starts with");
+DEFINE_string(load_file_suffix, ".txt",
+              "Suffix of scratch files (picks the collaborators that run)");
+DEFINE_int32(load_duration_secs, 30, "How long LoadGen generates load for");
+DEFINE_double(load_typing_cps, 8, "Keystrokes per second per stream");
+DEFINE_double(load_pastes_per_min, 2, "Pastes per minute per stream");
+DEFINE_int32(load_paste_bytes, 2048, "Size of each paste");
+DEFINE_double(load_cursor_moves_per_sec, 1,
+              "Cursor jumps (sent as presence) per second per stream");
+
+namespace {
+
+const char kText[] =
+    "the quick brown fox jumps over the lazy dog; pack my box with five "
+    "dozen liquor jugs\n";
+
+std::string TextOfLength(size_t n, size_t offset) {
+  std::string out;
+  out.reserve(n);
+  while (out.length() < n) {
+    out += kText[offset++ % (sizeof(kText) - 1)];
+  }
+  return out;
+}
+
+// Totals across streams.
+struct LoadStats {
+  Histogram keystroke_rtt;
+  Histogram paste_rtt;
+  std::atomic<uint64_t> sent{0};
+  std::atomic<uint64_t> lost{0};
+  std::atomic<uint64_t> commands_received{0};
+  std::atomic<uint64_t> presence_received{0};
+};
+
+// One simulated editor: a replica of the buffer kept up to date from its
+// stream, a cursor in it, and typing, pastes and cursor jumps scheduled at
+// random at the configured rates. An edit's round trip ends when the server
+// sends it back, which it does once it's integrated it.
+class LoadClient {
+ public:
+  LoadClient(Client* client, const boost::filesystem::path& path,
+             LoadStats* stats, int seed)
+      : stats_(stats), rng_(seed) {
+    auto stream_and_first_msg = client->MakeEditStream(&edit_ctx_, path);
+    if (!stream_and_first_msg.first) {
+      throw std::runtime_error(
+          absl::StrCat("Failed opening edit stream for ", path.string()));
+    }
+    edit_stream_ = std::move(stream_and_first_msg.first);
+    const auto& hello = stream_and_first_msg.second.server_hello();
+    site_.reset(new Site(absl::optional<int>(hello.site_id())));
+    replica_ = AnnotatedString::FromProto(hello.current_state());
+    cursor_ = AnnotatedString::Begin();
+    first_version_ = VersionSum(stream_and_first_msg.second.version());
+    last_version_ = first_version_;
+    if (FLAGS_load_cursor_moves_per_sec > 0) {
+      presence_stream_ = client->MakePresenceStream(
+          &presence_ctx_, path, stream_and_first_msg.second);
+    }
+  }
+
+  void Start(absl::Time end) {
+    edit_reader_ = std::thread([this]() { ReadEdits(); });
+    if (presence_stream_) {
+      presence_reader_ = std::thread([this]() { ReadPresence(); });
+    }
+    writer_ = std::thread([this, end]() { Generate(end); });
+  }
+
+  // waits up to drain for outstanding round trips, then hangs up
+  void Finish(absl::Duration drain) {
+    writer_.join();
+    {
+      absl::MutexLock lock(&mu_);
+      auto drained = [this]() {
+        mu_.AssertHeld();
+        return sent_.empty();
+      };
+      mu_.AwaitWithTimeout(absl::Condition(&drained), drain);
+      stats_->lost += sent_.size();
+    }
+    edit_stream_->WritesDone();
+    if (presence_stream_) presence_stream_->WritesDone();
+    edit_reader_.join();
+    edit_stream_->Finish();
+    if (presence_stream_) {
+      presence_reader_.join();
+      presence_stream_->Finish();
+    }
+  }
+
+  // command sets the server integrated into this stream's buffer while it
+  // was open
+  uint64_t Integrated() {
+    absl::MutexLock lock(&mu_);
+    return last_version_ - first_version_;
+  }
+
+ private:
+  enum Action { KEYSTROKE, PASTE, MOVE };
+
+  static uint64_t VersionSum(const VersionVectorMsg& msg) {
+    uint64_t sum = 0;
+    for (const auto& site : msg.sets()) sum += site.second;
+    return sum;
+  }
+
+  absl::Time After(double per_sec) {
+    if (per_sec <= 0) return absl::InfiniteFuture();
+    return absl::Now() +
+           absl::Seconds(std::exponential_distribution<>(per_sec)(rng_));
+  }
+
+  void Generate(absl::Time end) {
+    absl::Time next[] = {
+        After(FLAGS_load_typing_cps),
+        After(FLAGS_load_pastes_per_min / 60),
+        After(FLAGS_load_cursor_moves_per_sec),
+    };
+    for (;;) {
+      Action action = static_cast<Action>(
+          std::min_element(std::begin(next), std::end(next)) - next);
+      if (next[action] >= end) return;
+      absl::SleepFor(next[action] - absl::Now());
+      switch (action) {
+        case KEYSTROKE:
+          if (!Type(TextOfLength(1, typed_++), false)) return;
+          next[action] = After(FLAGS_load_typing_cps);
+          break;
+        case PASTE:
+          if (!Type(TextOfLength(FLAGS_load_paste_bytes, typed_), true)) {
+            return;
+          }
+          next[action] = After(FLAGS_load_pastes_per_min / 60);
+          break;
+        case MOVE:
+          if (!Move()) return;
+          next[action] = After(FLAGS_load_cursor_moves_per_sec);
+          break;
+      }
+    }
+  }
+
+  bool Type(const std::string& chars, bool paste) {
+    EditMessage msg;
+    {
+      absl::MutexLock lock(&mu_);
+      CommandSet* commands = msg.mutable_commands();
+      cursor_ = replica_.Insert(commands, site_.get(), chars, cursor_);
+      sent_.emplace(commands->commands(0).id(),
+                    std::make_pair(absl::Now(), paste));
+    }
+    stats_->sent++;
+    return edit_stream_->Write(msg);
+  }
+
+  // a jump of up to a screenful of characters either way
+  bool Move() {
+    PresenceMessage msg;
+    {
+      absl::MutexLock lock(&mu_);
+      AnnotatedString::Iterator it(replica_, cursor_);
+      int n = std::uniform_int_distribution<>(-2000, 2000)(rng_);
+      for (; n < 0 && !it.is_begin(); n++) it.MovePrev();
+      for (; n > 0 && !it.Next().is_end(); n--) it.MoveNext();
+      cursor_ = it.id();
+      SitePresence presence;
+      presence.cursor = cursor_;
+      presence.seq = ++presence_seq_;
+      *msg.mutable_update() = PresenceToProto(site_->site_id(), presence);
+    }
+    return !presence_stream_ || presence_stream_->Write(msg);
+  }
+
+  void ReadEdits() {
+    EditMessage msg;
+    while (edit_stream_->Read(&msg)) {
+      if (msg.type_case() != EditMessage::kCommands) continue;
+      absl::Time now = absl::Now();
+      stats_->commands_received += msg.commands().commands_size();
+      absl::MutexLock lock(&mu_);
+      for (const Command& cmd : msg.commands().commands()) {
+        if (site_->CreatedID(ID(cmd.id()))) {
+          auto it = sent_.find(cmd.id());
+          if (it == sent_.end()) continue;
+          Histogram* rtt = it->second.second ? &stats_->paste_rtt
+                                             : &stats_->keystroke_rtt;
+          rtt->Add(now - it->second.first);
+          sent_.erase(it);
+        } else {
+          replica_.Integrate(cmd);
+        }
+      }
+      last_version_ = std::max(last_version_, VersionSum(msg.version()));
+    }
+  }
+
+  void ReadPresence() {
+    PresenceMessage msg;
+    while (presence_stream_->Read(&msg)) stats_->presence_received++;
+  }
+
+  LoadStats* const stats_;
+  std::mt19937 rng_;
+  grpc::ClientContext edit_ctx_;
+  grpc::ClientContext presence_ctx_;
+  EditStreamPtr edit_stream_;
+  PresenceStreamPtr presence_stream_;
+  std::unique_ptr<Site> site_;
+  size_t typed_ = 0;
+  uint64_t presence_seq_ = 0;
+  std::thread writer_;
+  std::thread edit_reader_;
+  std::thread presence_reader_;
+
+  absl::Mutex mu_;
+  AnnotatedString replica_ GUARDED_BY(mu_);
+  ID cursor_ GUARDED_BY(mu_);
+  // first command id of each edit not yet sent back -> when it went, and
+  // whether it was a paste
+  std::unordered_map<uint64_t, std::pair<absl::Time, bool>> sent_
+      GUARDED_BY(mu_);
+  uint64_t first_version_ GUARDED_BY(mu_);
+  uint64_t last_version_ GUARDED_BY(mu_);
+};
+
+}  // namespace
+
+// Puts load on a project's server: opens --load_clients edit streams over
+// --load_files scratch files created in the given directory (spawning the
+// server if it's not running), types, pastes and moves the cursor at the
+// configured rates, then reports round trip latency and server throughput.
+class LoadGen : public Application {
+ public:
+  LoadGen(int argc, char** argv)
+      : dir_(DirFromCmdLine(argc, argv)), client_(argv[0], dir_) {}
+
+  ~LoadGen() {
+    for (const auto& path : files_) {
+      boost::system::error_code ec;
+      boost::filesystem::remove(path, ec);
+    }
+  }
+
+  int Run() override {
+    for (int i = 0; i < std::max(1, FLAGS_load_files); i++) {
+      files_.push_back(dir_ / absl::StrCat("loadgen.", getpid(), ".", i,
+                                           FLAGS_load_file_suffix));
+      std::ofstream out(files_.back().string());
+      for (int line = 0; line < FLAGS_load_file_lines; line++) out << kText;
+    }
+
+    const int idle_threads = ServerThreads();
+    std::vector<std::unique_ptr<LoadClient>> clients;
+    for (int i = 0; i < FLAGS_load_clients; i++) {
+      clients.emplace_back(
+          new LoadClient(&client_, files_[i % files_.size()], &stats_, i));
+    }
+    const int open_threads = ServerThreads();
+    LOG(INFO) << "LoadGen: " << clients.size() << " streams over "
+              << files_.size() << " files";
+
+    const absl::Time start = absl::Now();
+    const absl::Time end = start + absl::Seconds(FLAGS_load_duration_secs);
+    for (auto& c : clients) c->Start(end);
+    for (auto& c : clients) c->Finish(absl::Seconds(5));
+    const double secs = absl::ToDoubleSeconds(absl::Now() - start);
+
+    // streams on the same file see the same versions: count each file once
+    std::vector<uint64_t> integrated(files_.size());
+    for (size_t i = 0; i < clients.size(); i++) {
+      integrated[i % files_.size()] = std::max(integrated[i % files_.size()],
+                                               clients[i]->Integrated());
+    }
+    uint64_t total_integrated = 0;
+    for (uint64_t n : integrated) total_integrated += n;
+
+    std::cout << "streams: " << clients.size() << " over " << files_.size()
+              << " files for " << secs << "s\n";
+    std::cout << "edits sent: " << stats_.sent << " (" << stats_.sent / secs
+              << "/s), never sent back: " << stats_.lost << "\n";
+    std::cout << "keystroke round trip: "
+              << stats_.keystroke_rtt.Take().ToString() << "\n";
+    std::cout << "paste round trip: " << stats_.paste_rtt.Take().ToString()
+              << "\n";
+    std::cout << "server integrated: " << total_integrated
+              << " command sets (" << total_integrated / secs << "/s)\n";
+    std::cout << "commands fanned out: " << stats_.commands_received << " ("
+              << stats_.commands_received / secs << "/s), presence updates: "
+              << stats_.presence_received << "\n";
+    // streams are served from fixed thread pools: this shouldn't grow with
+    // --load_clients
+    std::cout << "server threads: " << idle_threads << " before opening "
+              << "streams, " << open_threads << " with them open\n";
+    return stats_.lost == 0 ? 0 : 1;
+  }
+
+ private:
+  // 0 if unknown
+  int ServerThreads() {
+    StatsResponse stats;
+    auto status = client_.GetStats(&stats);
+    if (!status.ok()) {
+      LOG(ERROR) << "Stats failed: " << status.error_message();
+      return 0;
+    }
+    return stats.threads();
+  }
+
+  static boost::filesystem::path DirFromCmdLine(int argc, char** argv) {
+    if (argc != 2 || !boost::filesystem::is_directory(argv[1])) {
+      throw std::runtime_error(
+          "Expected a directory inside the project to put scratch files in");
+    }
+    return boost::filesystem::absolute(argv[1]);
+  }
+
+  const boost::filesystem::path dir_;
+  Client client_;
+  LoadStats stats_;
+  std::vector<boost::filesystem::path> files_;
+};
+
+REGISTER_APPLICATION(LoadGen);
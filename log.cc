@@ -12,6 +12,190 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "log.h"
+#include <stdlib.h>
+#include <mutex>
+#include <thread>
+#include "absl/synchronization/mutex.h"
 
 DEFINE_string(logfile, "", "Logging destination");
-std::atomic<bool> Log::log_cerr_{true};
\ No newline at end of file
+DEFINE_int32(log_level, 1, "Log verbosity: 0=errors, 1=info, 2=verbose");
+std::atomic<bool> Log::log_cerr_{true};
+
+namespace {
+
+struct Line {
+  std::string text;
+  bool to_file;
+  bool to_cerr;
+};
+
+// Bounded multi-producer queue of log lines (after Vyukov's MPMC queue),
+// drained by one writer thread. Producers never take a lock; if the queue
+// fills up they write synchronously instead.
+class LogSink {
+ public:
+  static LogSink* Get() {
+    static LogSink* sink = new LogSink;
+    return sink;
+  }
+
+  void Write(Line line) {
+    std::call_once(started_, [this]() {
+      std::thread([this]() { WriterLoop(); }).detach();
+      atexit([]() { Log::Flush(); });
+    });
+    if (!Enqueue(&line)) {
+      Output(line.to_file ? line.text : std::string(),
+             line.to_cerr ? line.text : std::string());
+      return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_idle_.load()) {
+      absl::MutexLock lock(&wake_mu_);
+      wake_ = true;
+    }
+  }
+
+  void Flush() {
+    absl::MutexLock lock(&drain_mu_);
+    Drain();
+  }
+
+ private:
+  static constexpr size_t kCapacity = 1024;
+
+  struct Slot {
+    std::atomic<size_t> seq;
+    Line line;
+  };
+
+  LogSink() : enqueue_pos_(0), dequeue_pos_(0) {
+    for (size_t i = 0; i < kCapacity; i++) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool Enqueue(Line* line) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+      slot = &slots_[pos % kCapacity];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (dif == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->line = std::move(*line);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // returns the number of lines written
+  size_t Drain() EXCLUSIVE_LOCKS_REQUIRED(drain_mu_) {
+    std::string to_file;
+    std::string to_cerr;
+    size_t n = 0;
+    for (;; n++) {
+      Slot* slot = &slots_[dequeue_pos_ % kCapacity];
+      if (slot->seq.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+        break;
+      }
+      if (slot->line.to_file) to_file += slot->line.text;
+      if (slot->line.to_cerr) to_cerr += slot->line.text;
+      slot->line.text.clear();
+      slot->seq.store(dequeue_pos_ + kCapacity, std::memory_order_release);
+      dequeue_pos_++;
+    }
+    Output(to_file, to_cerr);
+    return n;
+  }
+
+  void WriterLoop() {
+    for (;;) {
+      writer_idle_.store(false);
+      {
+        absl::MutexLock lock(&drain_mu_);
+        if (Drain() != 0) continue;
+      }
+      writer_idle_.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      {
+        // producers that missed writer_idle_ enqueued before it was set:
+        // pick up their lines before sleeping
+        absl::MutexLock lock(&drain_mu_);
+        if (Drain() != 0) continue;
+      }
+      absl::MutexLock lock(&wake_mu_);
+      wake_mu_.AwaitWithTimeout(absl::Condition(&wake_), absl::Seconds(1));
+      wake_ = false;
+    }
+  }
+
+  void Output(const std::string& to_file, const std::string& to_cerr) {
+    if (!to_file.empty()) {
+      std::call_once(file_opened_, [this]() {
+        file_ = WrapSyscall("open", []() {
+          return open(FLAGS_logfile.c_str(),
+                      O_WRONLY | O_CREAT | O_CLOEXEC | O_TRUNC, 0777);
+        });
+      });
+      WriteAll(file_, to_file);
+    }
+    if (!to_cerr.empty()) WriteAll(STDERR_FILENO, to_cerr);
+  }
+
+  static void WriteAll(int fd, const std::string& s) {
+    try {
+      size_t done = 0;
+      while (done < s.length()) {
+        done += WrapSyscall("write", [fd, &s, done]() {
+          return ::write(fd, s.data() + done, s.length() - done);
+        });
+      }
+    } catch (...) {
+    }
+  }
+
+  std::once_flag started_;
+  std::once_flag file_opened_;
+  int file_ = -1;
+
+  std::atomic<size_t> enqueue_pos_;
+  Slot slots_[kCapacity];
+
+  absl::Mutex drain_mu_;
+  size_t dequeue_pos_ GUARDED_BY(drain_mu_);
+
+  std::atomic<bool> writer_idle_{false};
+  absl::Mutex wake_mu_;
+  bool wake_ GUARDED_BY(wake_mu_) = false;
+};
+
+constexpr size_t LogSink::kCapacity;
+
+}  // namespace
+
+Log::~Log() {
+  if (!cerr_ && FLAGS_logfile.empty()) return;
+  *this << '\n';
+#ifdef __APPLE__
+  uint64_t thread_id;
+  pthread_threadid_np(NULL, &thread_id);
+#else
+  int thread_id = -1;
+#endif
+  LogSink::Get()->Write(
+      Line{absl::StrCat("[", thread_id, "] ", absl::FormatTime(absl::Now()),
+                        "  ", str()),
+           !FLAGS_logfile.empty(), cerr_});
+}
+
+void Log::Flush() { LogSink::Get()->Flush(); }
@@ -23,9 +23,20 @@
 #include "absl/strings/str_cat.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "trace.h"
 #include "wrap_syscall.h"
 
 DECLARE_string(logfile);
+DECLARE_int32(log_level);
+
+enum class LogLevel { ERROR = 0, INFO = 1, VERBOSE = 2 };
+
+// Leveled logging: LOG(VERBOSE) << Expensive() does not evaluate Expensive()
+// unless --log_level >= 2 and there's somewhere to log to. Prefer it over a
+// bare Log() anywhere that runs per edit or per frame.
+#define LOG(level)                                   \
+  !Log::Enabled(LogLevel::level) ? static_cast<void>(0) \
+                                 : LogVoidify() & Log()
 
 class Log : public std::ostringstream {
  public:
@@ -34,60 +45,34 @@ class Log : public std::ostringstream {
       this->setstate(std::ios_base::badbit);
     }
   }
-  ~Log() {
-    if (!cerr_ && FLAGS_logfile.empty()) return;
-    *this << '\n';
-#ifdef __APPLE__
-    uint64_t thread_id;
-    pthread_threadid_np(NULL, &thread_id);
-#else
-    int thread_id = -1;
-#endif
-    auto s = absl::StrCat("[", thread_id, "] ", absl::FormatTime(absl::Now()),
-                          "  ", str());
-    if (!FLAGS_logfile.empty()) {
-      static LogFile file;
-      WrapSyscall("write", [this, &s]() {
-        return ::write(file.hdl(), s.data(), s.length());
-      });
-    }
-    if (cerr_) {
-      try {
-        WrapSyscall("write", [this, &s]() {
-          return ::write(STDERR_FILENO, s.data(), s.length());
-        });
-      } catch (...) {
-      }
-    }
-  }
+  // lines are queued and written by a background thread
+  ~Log();
 
   Log(const Log&) = delete;
   Log& operator=(const Log&) = delete;
 
   static void SetCerrLog(bool x) { log_cerr_ = x; }
 
- private:
-  class LogFile {
-   public:
-    LogFile() {
-      hdl_ = WrapSyscall("open", []() {
-        return open(FLAGS_logfile.c_str(),
-                    O_WRONLY | O_CREAT | O_CLOEXEC | O_TRUNC, 0777);
-      });
-    }
-
-    ~LogFile() { close(hdl_); }
-
-    int hdl() const { return hdl_; }
+  static bool Enabled(LogLevel level) {
+    return static_cast<int>(level) <= FLAGS_log_level &&
+           (!FLAGS_logfile.empty() ||
+            log_cerr_.load(std::memory_order_relaxed));
+  }
 
-   private:
-    int hdl_;
-  };
+  // block until every line logged so far has been written
+  static void Flush();
 
+ private:
   static std::atomic<bool> log_cerr_;
   const bool cerr_;
 };
 
+// lets LOG() expand to an expression of type void in both branches
+class LogVoidify {
+ public:
+  void operator&(const std::ostream&) {}
+};
+
 class LogTimer {
  public:
   LogTimer(const char* pfx) : start_(absl::Now()), pfx_(pfx) {}
@@ -98,6 +83,15 @@ class LogTimer {
 
   ~LogTimer() {
     auto end = absl::Now();
+    if (Trace::enabled()) {
+      Trace::Complete(pfx_, start_, end);
+      auto last = start_;
+      for (const auto& m : marks_) {
+        Trace::Complete(m.first, last, m.second);
+        last = m.second;
+      }
+    }
+    if (!Log::Enabled(LogLevel::INFO)) return;
     std::string report;
     absl::StrAppend(&report, "Completed ", pfx_, " in ",
                     absl::FormatDuration(end - start_));
@@ -13,4 +13,14 @@
 // limitations under the License.
 #include "log.h"
 
-int main() { Log() << "hello world"; }
+static int evaluated = 0;
+static int Evaluate() { return ++evaluated; }
+
+int main() {
+  Log() << "hello world";
+  LOG(INFO) << "hello " << Evaluate();
+  LOG(VERBOSE) << "not evaluated " << Evaluate();
+  if (evaluated != 1) return 1;
+  Log::Flush();
+  return 0;
+}
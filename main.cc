@@ -16,6 +16,7 @@
 #include <grpc/support/log.h>
 #include "application.h"
 #include "log.h"
+#include "trace.h"
 
 DEFINE_string(mode, DEFAULT_MODE,
               "Application mode (default " DEFAULT_MODE ")");
@@ -27,16 +28,20 @@ int main(int argc, char** argv) {
 
   gpr_set_log_verbosity(GPR_LOG_SEVERITY_DEBUG);
   gpr_set_log_function([](gpr_log_func_args* args) {
-    Log() << args->file << ":" << args->line << ": " << args->message;
+    LOG(INFO) << args->file << ":" << args->line << ": " << args->message;
   });
 
+  Trace::Start(FLAGS_mode);
+  int r;
   try {
-    return Application::RunMode(FLAGS_mode, argc, argv);
+    r = Application::RunMode(FLAGS_mode, argc, argv);
   } catch (std::exception& e) {
-    Log() << "FATAL EXCEPTION: " << e.what();
-    return 1;
+    LOG(ERROR) << "FATAL EXCEPTION: " << e.what();
+    r = 1;
   } catch (...) {
-    Log() << "FATAL EXCEPTION";
-    return 1;
+    LOG(ERROR) << "FATAL EXCEPTION";
+    r = 1;
   }
+  Trace::Stop();
+  return r;
 }
@@ -21,7 +21,7 @@ class PeepShow : public Application {
       : client_(argv[0], FileFromCmdLine(argc, argv)) {
     auto stream_and_first_msg =
         client_.MakeEditStream(&ctx_, FileFromCmdLine(argc, argv));
-    Log() << stream_and_first_msg.second.DebugString();
+    LOG(INFO) << stream_and_first_msg.second.DebugString();
     stream_ = std::move(stream_and_first_msg.first);
   }
 
@@ -30,7 +30,7 @@ class PeepShow : public Application {
   int Run() {
     EditMessage msg;
     while (stream_->Read(&msg)) {
-      Log() << msg.DebugString();
+      LOG(INFO) << msg.DebugString();
     }
     return 0;
   }
@@ -0,0 +1,197 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "project_search.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include "absl/synchronization/mutex.h"
+#include "log.h"
+#include "text_search.h"
+
+DEFINE_int32(project_search_threads, 0,
+             "Threads searching files for project search (0: one per core)");
+DEFINE_int32(project_search_max_file_mb, 64,
+             "Files larger than this are skipped by project search");
+
+namespace {
+
+// paths found by the walk, waiting for the pool
+class FileQueue {
+ public:
+  void Push(boost::filesystem::path path) {
+    absl::MutexLock lock(&mu_);
+    paths_.emplace_back(std::move(path));
+  }
+
+  void Close() {
+    absl::MutexLock lock(&mu_);
+    closed_ = true;
+  }
+
+  // false once closed and drained
+  bool Pop(boost::filesystem::path* path) {
+    auto ready = [this]() {
+      mu_.AssertHeld();
+      return closed_ || !paths_.empty();
+    };
+    absl::MutexLock lock(&mu_);
+    mu_.Await(absl::Condition(&ready));
+    if (paths_.empty()) return false;
+    *path = std::move(paths_.front());
+    paths_.pop_front();
+    return true;
+  }
+
+ private:
+  absl::Mutex mu_;
+  std::deque<boost::filesystem::path> paths_ GUARDED_BY(mu_);
+  bool closed_ GUARDED_BY(mu_) = false;
+};
+
+class MappedFile {
+ public:
+  explicit MappedFile(const boost::filesystem::path& path) {
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+        st.st_size <= int64_t(FLAGS_project_search_max_file_mb) << 20) {
+      void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        data_ = static_cast<const char*>(p);
+        size_ = st.st_size;
+      }
+    }
+    close(fd);
+  }
+  ~MappedFile() {
+    if (data_) munmap(const_cast<char*>(data_), size_);
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  absl::string_view text() const { return absl::string_view(data_, size_); }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+std::vector<ProjectSearchMatch> SearchFile(const boost::filesystem::path& path,
+                                           const std::string& query) {
+  std::vector<ProjectSearchMatch> matches;
+  MappedFile file(path);
+  absl::string_view text = file.text();
+  // a NUL early on means a binary file: not worth showing
+  if (memchr(text.data(), 0, std::min<size_t>(text.size(), 8192))) {
+    return matches;
+  }
+  std::vector<size_t> at;
+  TextSearch::FindAll(text, query, &at);
+  int line = 1;
+  size_t counted_to = 0;
+  size_t last_line_start = std::string::npos;
+  for (size_t offset : at) {
+    line += std::count(text.begin() + counted_to, text.begin() + offset, '\n');
+    counted_to = offset;
+    size_t begin = text.rfind('\n', offset);
+    begin = begin == absl::string_view::npos ? 0 : begin + 1;
+    // one entry per line, however many matches it has
+    if (begin == last_line_start) continue;
+    last_line_start = begin;
+    size_t end = text.find('\n', offset);
+    if (end == absl::string_view::npos) end = text.size();
+    // minified sources can have very long lines
+    end = std::min(end, begin + 256);
+    matches.push_back(ProjectSearchMatch{
+        line, std::string(text.substr(begin, end - begin))});
+  }
+  return matches;
+}
+
+bool Hidden(const boost::filesystem::path& path) {
+  const std::string name = path.filename().string();
+  return name.size() > 1 && name[0] == '.';
+}
+
+}  // namespace
+
+void SearchProject(
+    const boost::filesystem::path& root, const std::string& query,
+    const CancellationToken& cancel,
+    std::function<void(const boost::filesystem::path& file,
+                       std::vector<ProjectSearchMatch> matches)>
+        found) {
+  const std::string literal = query.substr(0, query.find('\n'));
+  if (literal.empty()) return;
+  int threads = FLAGS_project_search_threads;
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  FileQueue queue;
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; i++) {
+    pool.emplace_back([&]() {
+      boost::filesystem::path path;
+      while (queue.Pop(&path)) {
+        if (cancel.cancelled()) continue;
+        auto matches = SearchFile(path, literal);
+        if (!matches.empty() && !cancel.cancelled()) {
+          found(path, std::move(matches));
+        }
+      }
+    });
+  }
+
+  // walked a directory at a time: a recursive_directory_iterator ends at the
+  // first directory it can't read, and this carries on past it
+  std::vector<boost::filesystem::path> dirs{root};
+  while (!dirs.empty() && !cancel.cancelled()) {
+    const boost::filesystem::path dir = std::move(dirs.back());
+    dirs.pop_back();
+    boost::system::error_code ec;
+    boost::filesystem::directory_iterator it(dir, ec), end;
+    for (; !ec && it != end && !cancel.cancelled(); it.increment(ec)) {
+      const auto& path = it->path();
+      // .git and friends
+      if (Hidden(path)) continue;
+      boost::system::error_code entry_ec;
+      // links aren't followed, to directories or files: either could lead
+      // out of the project
+      const boost::filesystem::file_status status =
+          it->symlink_status(entry_ec);
+      if (boost::filesystem::is_directory(status)) {
+        dirs.push_back(path);
+      } else if (boost::filesystem::is_regular_file(status)) {
+        queue.Push(path);
+      }
+      if (entry_ec) {
+        LOG(INFO) << "project search skipping " << path << ": "
+                  << entry_ec.message();
+      }
+    }
+    if (ec) {
+      LOG(INFO) << "project search skipping the rest of " << dir << ": "
+                << ec.message();
+    }
+  }
+  queue.Close();
+  for (auto& t : pool) t.join();
+}
@@ -0,0 +1,42 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <gflags/gflags.h>
+#include <boost/filesystem/path.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+#include "cancellation_token.h"
+
+DECLARE_int32(project_search_threads);
+
+struct ProjectSearchMatch {
+  // 1-based
+  int line;
+  // the matching line (without its newline)
+  std::string text;
+};
+
+// Searches every file under root for a (single line, literal) query: one
+// thread walks the tree while a pool of threads maps each file found and
+// scans it. found is called (from pool threads, one file at a time) with
+// each file's matches, in line order. Returns once everything has been
+// searched or cancel is cancelled.
+void SearchProject(
+    const boost::filesystem::path& root, const std::string& query,
+    const CancellationToken& cancel,
+    std::function<void(const boost::filesystem::path& file,
+                       std::vector<ProjectSearchMatch> matches)>
+        found);
@@ -0,0 +1,204 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <gflags/gflags.h>
+#include <thread>
+#include "absl/strings/str_cat.h"
+#include "buffer.h"
+#include "log.h"
+#include "project.h"
+#include "project_search.h"
+
+DEFINE_int32(project_search_min_chars, 3,
+             "Shortest selection project search looks for");
+DEFINE_int32(project_search_publish_ms, 100,
+             "How often project search publishes results as they arrive");
+DEFINE_int32(project_search_max_results, 1000,
+             "Lines project search lists at most");
+
+// Searches the project for whatever is selected in the buffer, listing the
+// matching lines in a side buffer (as godbolt does its listing) while the
+// search runs. Selecting something else cancels the search under way.
+class ProjectSearchCollaborator final : public AsyncCollaborator {
+ public:
+  ProjectSearchCollaborator(const Buffer* buffer)
+      : AsyncCollaborator("project_search", absl::Seconds(0),
+                          absl::Milliseconds(200),
+                          CollaboratorPriority::BACKGROUND),
+        buffer_(buffer),
+        ed_(buffer->site()) {
+    CollaboratorInterest interest = CollaboratorInterest::Text(false);
+    interest.presence = true;
+    set_interest(interest);
+  }
+  ~ProjectSearchCollaborator();
+
+  void Push(const EditNotification& notification) override;
+  EditResponse Pull() override;
+
+ private:
+  // what a site has selected, if it's on one line
+  static std::string SelectedText(const AnnotatedString& content,
+                                  const SitePresence& presence);
+  void StartSearch(const std::string& query) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void StopSearch() LOCKS_EXCLUDED(mu_);
+
+  const Buffer* const buffer_;
+  // only touched by Pull
+  AnnotationEditor ed_;
+  absl::Time last_publish_;
+
+  absl::Mutex mu_;
+  std::string query_ GUARDED_BY(mu_);
+  CancellationToken cancel_ GUARDED_BY(mu_);
+  std::thread search_ GUARDED_BY(mu_);
+  bool searching_ GUARDED_BY(mu_) = false;
+  std::vector<std::string> results_ GUARDED_BY(mu_);
+  int files_ GUARDED_BY(mu_) = 0;
+  bool dirty_ GUARDED_BY(mu_) = false;
+  bool shutdown_ GUARDED_BY(mu_) = false;
+};
+
+ProjectSearchCollaborator::~ProjectSearchCollaborator() { StopSearch(); }
+
+std::string ProjectSearchCollaborator::SelectedText(
+    const AnnotatedString& content, const SitePresence& presence) {
+  ID beg = presence.selection_anchor;
+  ID end = presence.cursor;
+  if (beg == ID() || !content.Contains(beg) || !content.Contains(end)) {
+    return "";
+  }
+  content.MakeOrderedIDs(&beg, &end);
+  // the selection runs from just after the earlier end to the later one
+  std::string text =
+      content.Render(AnnotatedString::Iterator(content, beg).Next().id(),
+                     AnnotatedString::Iterator(content, end).Next().id());
+  if (text.find('\n') != std::string::npos) return "";
+  return text;
+}
+
+void ProjectSearchCollaborator::Push(const EditNotification& notification) {
+  if (notification.shutdown) {
+    StopSearch();
+    absl::MutexLock lock(&mu_);
+    shutdown_ = true;
+    return;
+  }
+  std::string query;
+  for (const auto& p : notification.presence) {
+    query = SelectedText(notification.content, p.second);
+    if (!query.empty()) break;
+  }
+  if (query.size() < static_cast<size_t>(FLAGS_project_search_min_chars)) {
+    query.clear();
+  }
+  {
+    absl::MutexLock lock(&mu_);
+    if (query == query_) return;
+  }
+  StopSearch();
+  absl::MutexLock lock(&mu_);
+  StartSearch(query);
+}
+
+void ProjectSearchCollaborator::StopSearch() {
+  std::thread search;
+  {
+    absl::MutexLock lock(&mu_);
+    cancel_.Cancel();
+    search.swap(search_);
+  }
+  if (search.joinable()) search.join();
+}
+
+void ProjectSearchCollaborator::StartSearch(const std::string& query) {
+  query_ = query;
+  results_.clear();
+  files_ = 0;
+  searching_ = false;
+  dirty_ = true;
+  cancel_ = CancellationToken();
+  const ProjectRoot* root =
+      buffer_->project() ? buffer_->project()->aspect<ProjectRoot>() : nullptr;
+  if (query_.empty() || root == nullptr) return;
+  searching_ = true;
+  const boost::filesystem::path path = root->Path();
+  CancellationToken cancel = cancel_;
+  search_ = std::thread([this, path, query, cancel]() {
+    LOG(INFO) << "project search for '" << query << "' under " << path;
+    SearchProject(
+        path, query, cancel,
+        [this, &path, &cancel](const boost::filesystem::path& file,
+                               std::vector<ProjectSearchMatch> matches) {
+          // paths are listed relative to the project root
+          std::string name = file.lexically_relative(path).string();
+          if (name.empty()) name = file.string();
+          absl::MutexLock lock(&mu_);
+          if (cancel.cancelled()) return;
+          files_++;
+          for (const auto& m : matches) {
+            if (results_.size() >=
+                static_cast<size_t>(FLAGS_project_search_max_results)) {
+              break;
+            }
+            results_.push_back(absl::StrCat(name, ":", m.line, ": ", m.text));
+          }
+          dirty_ = true;
+        });
+    absl::MutexLock lock(&mu_);
+    if (cancel.cancelled()) return;
+    searching_ = false;
+    dirty_ = true;
+  });
+}
+
+EditResponse ProjectSearchCollaborator::Pull() {
+  // let results gather between publications rather than sending each file's
+  absl::SleepFor(last_publish_ +
+                 absl::Milliseconds(FLAGS_project_search_publish_ms) -
+                 absl::Now());
+  auto ready = [this]() {
+    mu_.AssertHeld();
+    return dirty_ || shutdown_;
+  };
+  EditResponse r;
+  mu_.LockWhen(absl::Condition(&ready));
+  dirty_ = false;
+  r.done = shutdown_;
+  if (!query_.empty() && !r.done) {
+    // declaring the listing replaces the last one; declaring nothing removes
+    // it
+    AnnotationEditor::ScopedEdit edit(&ed_, &r.content_updates);
+    Attribute side_buf;
+    auto path = buffer_->filename() / "search";
+    side_buf.mutable_buffer()->set_name(path.string());
+    std::string contents =
+        absl::StrCat(query_, ": ", results_.size(), " lines in ", files_,
+                     " files", searching_ ? " (searching)" : "", "\n");
+    for (const auto& line : results_) {
+      absl::StrAppend(&contents, line, "\n");
+    }
+    side_buf.mutable_buffer()->set_contents(contents);
+    side_buf.mutable_buffer()->set_output(name());
+    ed_.AttrID(side_buf);
+  } else if (!r.done) {
+    AnnotationEditor::ScopedEdit edit(&ed_, &r.content_updates);
+  }
+  mu_.Unlock();
+  last_publish_ = absl::Now();
+  return r;
+}
+
+LAZY_SERVER_COLLABORATOR(ProjectSearchCollaborator, "project_search", buffer) {
+  return !buffer->synthetic();
+}
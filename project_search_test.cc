@@ -0,0 +1,116 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "project_search.h"
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <map>
+#include "absl/synchronization/mutex.h"
+
+namespace {
+
+class ProjectSearchTest : public ::testing::Test {
+ protected:
+  ProjectSearchTest() {
+    char tmpl[] = "/tmp/project_search_test.XXXXXX";
+    root_ = mkdtemp(tmpl);
+  }
+  ~ProjectSearchTest() { boost::filesystem::remove_all(root_); }
+
+  void Write(const std::string& name, const std::string& contents) {
+    auto path = root_ / name;
+    boost::filesystem::create_directories(path.parent_path());
+    std::ofstream(path.string()) << contents;
+  }
+
+  // file name (relative to root) -> "line:text" of each match
+  std::map<std::string, std::vector<std::string>> Search(
+      const std::string& query,
+      CancellationToken cancel = CancellationToken()) {
+    absl::Mutex mu;
+    std::map<std::string, std::vector<std::string>> found;
+    SearchProject(root_, query, cancel,
+                  [&](const boost::filesystem::path& file,
+                      std::vector<ProjectSearchMatch> matches) {
+                    absl::MutexLock lock(&mu);
+                    auto& lines =
+                        found[file.string().substr(root_.string().size() + 1)];
+                    for (const auto& m : matches) {
+                      lines.push_back(std::to_string(m.line) + ":" + m.text);
+                    }
+                  });
+    return found;
+  }
+
+  boost::filesystem::path root_;
+};
+
+}  // namespace
+
+TEST_F(ProjectSearchTest, FindsLines) {
+  Write("a.cc", "int foo;\nint bar;\nfoo(foo);\n");
+  Write("sub/b.h", "// no match here\nvoid foo()");
+  Write("sub/c.txt", "nothing");
+  Write(".git/objects", "foo");
+  Write("bin", std::string("foo\0foo", 7));
+  auto found = Search("foo");
+  EXPECT_EQ(2u, found.size());
+  EXPECT_EQ((std::vector<std::string>{"1:int foo;", "3:foo(foo);"}),
+            found["a.cc"]);
+  EXPECT_EQ((std::vector<std::string>{"2:void foo()"}), found["sub/b.h"]);
+}
+
+TEST_F(ProjectSearchTest, WalksPastUnreadableDirectories) {
+  Write("locked/x", "needle\n");
+  // some of which the walk reaches after the locked directory
+  for (int i = 0; i < 20; i++) {
+    Write("d" + std::to_string(i) + "/y", "needle\n");
+  }
+  boost::filesystem::permissions(root_ / "locked",
+                                 boost::filesystem::no_perms);
+  auto found = Search("needle");
+  boost::filesystem::permissions(root_ / "locked",
+                                 boost::filesystem::owner_all);
+  for (int i = 0; i < 20; i++) {
+    EXPECT_EQ(1u, found.count("d" + std::to_string(i) + "/y"));
+  }
+  // root reads it regardless
+  if (geteuid() != 0) {
+    EXPECT_EQ(0u, found.count("locked/x"));
+  }
+}
+
+TEST_F(ProjectSearchTest, DoesNotFollowLinksOutOfTheProject) {
+  char tmpl[] = "/tmp/project_search_outside.XXXXXX";
+  boost::filesystem::path outside = mkdtemp(tmpl);
+  std::ofstream((outside / "secret").string()) << "needle\n";
+  boost::filesystem::create_symlink(outside / "secret", root_ / "file_link");
+  boost::filesystem::create_directory_symlink(outside, root_ / "dir_link");
+  Write("mine", "needle\n");
+  auto found = Search("needle");
+  boost::filesystem::remove_all(outside);
+  EXPECT_EQ(1u, found.size());
+  EXPECT_EQ(1u, found.count("mine"));
+}
+
+TEST_F(ProjectSearchTest, Cancelled) {
+  for (int i = 0; i < 100; i++) Write("f" + std::to_string(i), "needle\n");
+  CancellationToken cancel;
+  cancel.Cancel();
+  EXPECT_TRUE(Search("needle", cancel).empty());
+  EXPECT_EQ(100u, Search("needle").size());
+  EXPECT_TRUE(Search("").empty());
+}
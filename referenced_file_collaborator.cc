@@ -20,8 +20,10 @@
 class ReferencedFileCollaborator final : public AsyncCollaborator {
  public:
   ReferencedFileCollaborator(const Buffer* buffer)
-      : AsyncCollaborator("reffile", absl::Seconds(0),
-                          absl::Milliseconds(100)) {}
+      : AsyncCollaborator("reffile", absl::Seconds(0), absl::Milliseconds(100),
+                          CollaboratorPriority::BACKGROUND) {
+    set_interest(CollaboratorInterest::Attributes({Attribute::kDependency}));
+  }
   void Push(const EditNotification& notification) override;
   EditResponse Pull() override;
 
@@ -47,7 +49,7 @@ void ReferencedFileCollaborator::Push(const EditNotification& notification) {
         referenced.insert(attr.dependency().filename());
       });
   if (referenced != last_) {
-    Log() << "CHANGED FILE SET";
+    LOG(INFO) << "CHANGED FILE SET";
     last_.swap(referenced);
     RestartWatch();
   }
@@ -68,7 +70,7 @@ EditResponse ReferencedFileCollaborator::Pull() {
 }
 
 void ReferencedFileCollaborator::ChangedFile(bool shutdown_fswatch) {
-  Log() << "REF:WATCHED CHANGED" << shutdown_fswatch;
+  LOG(INFO) << "REF:WATCHED CHANGED" << shutdown_fswatch;
   absl::MutexLock lock(&mu_);
   update_ = true;
   if (!shutdown_fswatch) {
@@ -79,7 +81,7 @@ void ReferencedFileCollaborator::ChangedFile(bool shutdown_fswatch) {
 void ReferencedFileCollaborator::RestartWatch() {
   std::vector<std::string> interest_vec;
   for (const auto& s : last_) {
-    Log() << "INTEREST SET:" << s;
+    LOG(INFO) << "INTEREST SET:" << s;
     interest_vec.push_back(s);
   }
   fswatch_.reset(new FSWatcher(
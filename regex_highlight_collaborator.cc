@@ -22,15 +22,18 @@ class RegexHighlightCollaborator final : public SyncCollaborator {
   RegexHighlightCollaborator(
       const Buffer* buffer,
       const std::vector<std::pair<std::string, std::string>>& config)
-      : SyncCollaborator("regex_highlight", absl::Seconds(0), absl::Seconds(0)),
+      : SyncCollaborator("regex_highlight", absl::Seconds(0), absl::Seconds(0),
+                         CollaboratorPriority::ANALYSIS),
         ed_(buffer->site()) {
+    set_interest(CollaboratorInterest::Text(false));
     for (const auto& p : config) {
       regex_to_scope_.emplace_back(std::unique_ptr<RE2>(new RE2(p.first)),
                                    p.second);
     }
   }
 
-  EditResponse Edit(const EditNotification& notification) {
+  EditResponse Edit(const EditNotification& notification,
+                    const CancellationToken& cancel) {
     std::string text_str;
     std::vector<ID> markers;
     AnnotatedString::Iterator it(notification.content,
@@ -47,13 +50,13 @@ class RegexHighlightCollaborator final : public SyncCollaborator {
     EditResponse r;
     AnnotationEditor::ScopedEdit edit(&ed_, &r.content_updates);
     while (!text.empty()) {
-      Log() << "SCAN c=" << (text.data() - orig.data())
-            << " l=" << text.length();
+      LOG(VERBOSE) << "SCAN c=" << (text.data() - orig.data())
+                   << " l=" << text.length();
       for (const auto& p : regex_to_scope_) {
         auto bef = text;
         bool hit = RE2::Consume(&text, *p.first);
         bool moved = text.data() != bef.data();
-        Log() << " " << hit << "/" << moved;
+        LOG(VERBOSE) << " " << hit << "/" << moved;
         if (hit && moved) {
           Attribute t;
           t.mutable_tags()->add_tags(p.second);
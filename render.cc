@@ -324,8 +324,8 @@ void Renderer::BeginFrame() {
   frame_time_ = absl::Now();
   animating_ = false;
   extents_ = device_->GetExtents();
-  Log() << "extents: sw=" << extents_.win_width
-        << " sh=" << extents_.win_height;
+  LOG(VERBOSE) << "extents: sw=" << extents_.win_width
+               << " sh=" << extents_.win_height;
   solver_->add_constraints({
       left_ == 0, top_ == 0, right_ == extents_.win_width,
       bottom_ == extents_.win_height,
@@ -362,9 +362,9 @@ absl::optional<absl::Time> Renderer::FinishFrame() {
 
   if (!kbev_.empty()) {
     if (kbev_.length() > 1 && kbev_partial_match_) {
-      Log() << "continuing chordseq: " << kbev_;
+      LOG(VERBOSE) << "continuing chordseq: " << kbev_;
     } else {
-      Log() << "invalid chordseq: " << kbev_;
+      LOG(VERBOSE) << "invalid chordseq: " << kbev_;
       kbev_.clear();
     }
   }
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "run.h"
+#include <signal.h>
 #include <string.h>
 #include <sys/dir.h>
 #include <sys/types.h>
@@ -20,6 +21,7 @@
 #include <thread>
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
+#include "absl/synchronization/mutex.h"
 #include "log.h"
 #include "wrap_syscall.h"
 
@@ -79,7 +81,8 @@ static void CloseFDsAfter(int after) {
 }
 
 RunResult run(const boost::filesystem::path& command,
-              const std::vector<std::string>& args, const std::string& input) {
+              const std::vector<std::string>& args, const std::string& input,
+              const CancellationToken* cancel) {
   enum Pipe { IN, OUT, ERR };
   enum Dir { READ, WRITE };
   int pipes[3][2];
@@ -87,8 +90,8 @@ RunResult run(const boost::filesystem::path& command,
     WrapSyscall("pipe", [&]() { return pipe(pipes[i]); });
   }
 
-  Log() << "RUN: "
-        << absl::StrCat(command.string(), " ", absl::StrJoin(args, " "));
+  LOG(INFO) << "RUN: "
+            << absl::StrCat(command.string(), " ", absl::StrJoin(args, " "));
 
   pid_t p = WrapSyscall("fork", [&]() { return fork(); });
   if (p == 0) {
@@ -108,14 +111,27 @@ RunResult run(const boost::filesystem::path& command,
     close(pipes[IN][READ]);
     close(pipes[OUT][WRITE]);
     close(pipes[ERR][WRITE]);
+    int write_errno = 0;
     std::thread wr([&]() {
+      // a command that exits (or is killed) before reading all its input
+      // closes the pipe under us: take EPIPE rather than have SIGPIPE take
+      // down the process. Blocked on this thread only, where it's left
+      // pending and dropped when the thread exits.
+      sigset_t sigpipe;
+      sigemptyset(&sigpipe);
+      sigaddset(&sigpipe, SIGPIPE);
+      pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
       if (input.length() > 0) {
         const char* buf = input.data();
         const char* end = buf + input.length();
         while (buf != end) {
-          buf += WrapSyscall("write", [&]() {
-            return write(pipes[IN][WRITE], buf, end - buf);
-          });
+          ssize_t n = write(pipes[IN][WRITE], buf, end - buf);
+          if (n < 0) {
+            if (errno == EINTR) continue;
+            write_errno = errno;
+            break;
+          }
+          buf += n;
         }
       }
       close(pipes[IN][WRITE]);
@@ -132,19 +148,51 @@ RunResult run(const boost::filesystem::path& command,
     RunResult result;
     std::thread rdout([&]() { rd(pipes[OUT][READ], &result.out); });
     std::thread rderr([&]() { rd(pipes[ERR][READ], &result.err); });
-    std::thread wait([&]() { waitpid(p, &result.status, 0); });
+    absl::Mutex exit_mu;
+    bool exited = false;
+    // kills the child on cancellation, for as long as it hasn't exited
+    std::unique_ptr<CancellationToken::Callback> on_cancel;
+    if (cancel) {
+      on_cancel = cancel->OnCancel([&]() {
+        absl::MutexLock lock(&exit_mu);
+        if (exited) return;
+        LOG(INFO) << "RUN CANCELLED: " << command.string();
+        kill(p, SIGKILL);
+        result.cancelled = true;
+      });
+    }
+    std::thread wait([&]() {
+      if (cancel) {
+        // see the exit without reaping, so that a cancellation can never
+        // signal a recycled pid
+        siginfo_t info;
+        while (waitid(P_PID, p, &info, WEXITED | WNOWAIT) == -1 &&
+               errno == EINTR) {
+        }
+        absl::MutexLock lock(&exit_mu);
+        exited = true;
+      }
+      waitpid(p, &result.status, 0);
+    });
     wr.join();
     rdout.join();
     rderr.join();
     wait.join();
+    on_cancel.reset();
+    // a command we killed was never going to take all its input
+    if (write_errno != 0 && !result.cancelled) {
+      throw std::runtime_error(absl::StrCat("write failed: errno=",
+                                            write_errno, " ",
+                                            strerror(write_errno)));
+    }
     return result;
   }
 }
 
 void run_daemon(const boost::filesystem::path& command,
                 const std::vector<std::string>& args) {
-  Log() << "RUN DAEMON: "
-        << absl::StrCat(command.string(), " ", absl::StrJoin(args, " "));
+  LOG(INFO) << "RUN DAEMON: "
+            << absl::StrCat(command.string(), " ", absl::StrJoin(args, " "));
 
   pid_t p = WrapSyscall("fork", [&]() { return fork(); });
   if (p == 0) {
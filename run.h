@@ -16,15 +16,19 @@
 #include <boost/filesystem/path.hpp>
 #include <string>
 #include <vector>
+#include "cancellation_token.h"
 
 struct RunResult {
   std::string out;
   std::string err;
   int status;
+  // the command was killed because cancel fired before it finished
+  bool cancelled = false;
 };
 
 RunResult run(const boost::filesystem::path& command,
-              const std::vector<std::string>& args, const std::string& input);
+              const std::vector<std::string>& args, const std::string& input,
+              const CancellationToken* cancel = nullptr);
 
 void run_daemon(const boost::filesystem::path& command,
                 const std::vector<std::string>& args);
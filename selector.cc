@@ -19,3 +19,91 @@ bool selector_detail::RuleMatches(const std::string& selector,
          std::mismatch(selector.begin(), selector.end(), token.begin()).first ==
              selector.end();
 }
+
+size_t CompiledSelectors::Add(const Selector& selector) {
+  const uint32_t index = selectors_.size();
+  std::vector<Rule> rules;
+  for (const auto& r : selector) {
+    rules.push_back(InternRule(r));
+    uses_[rules.back()].push_back(Use{index, uint32_t(rules.size() - 1)});
+  }
+  selectors_.emplace_back(std::move(rules));
+  return index;
+}
+
+CompiledSelectors::Rule CompiledSelectors::InternRule(const std::string& rule) {
+  uint32_t node = 0;
+  for (char c : rule) {
+    auto it = trie_[node].next.find(c);
+    if (it != trie_[node].next.end()) {
+      node = it->second;
+      continue;
+    }
+    uint32_t child = trie_.size();
+    trie_[node].next.emplace(c, child);
+    trie_.emplace_back();
+    node = child;
+  }
+  if (trie_[node].rule >= 0) return trie_[node].rule;
+  Rule id = uses_.size();
+  trie_[node].rule = id;
+  uses_.emplace_back();
+  // tokens already interned may match the new rule
+  for (size_t i = 0; i < token_names_.size(); i++) {
+    if (selector_detail::RuleMatches(rule, token_names_[i])) {
+      token_rules_[i].push_back(id);
+    }
+  }
+  return id;
+}
+
+std::vector<CompiledSelectors::Rule> CompiledSelectors::RulesMatching(
+    const std::string& token) const {
+  std::vector<Rule> rules;
+  uint32_t node = 0;
+  for (size_t i = 0;; i++) {
+    if (trie_[node].rule >= 0) rules.push_back(trie_[node].rule);
+    if (i == token.length()) break;
+    auto it = trie_[node].next.find(token[i]);
+    if (it == trie_[node].next.end()) break;
+    node = it->second;
+  }
+  return rules;
+}
+
+CompiledSelectors::Token CompiledSelectors::Intern(const std::string& token) {
+  auto it = tokens_.find(token);
+  if (it != tokens_.end()) return it->second;
+  Token id = token_names_.size();
+  tokens_.emplace(token, id);
+  token_names_.push_back(token);
+  token_rules_.emplace_back(RulesMatching(token));
+  return id;
+}
+
+void CompiledSelectors::Match(const std::vector<Token>& tag,
+                              std::vector<size_t>* matched) const {
+  // per selector: how many of its rules (from the right) remain unmatched
+  std::vector<uint32_t> remaining(selectors_.size());
+  for (size_t i = 0; i < selectors_.size(); i++) {
+    remaining[i] = selectors_[i].size();
+  }
+  std::vector<uint32_t> advanced;
+  for (auto t = tag.rbegin(); t != tag.rend(); ++t) {
+    // like SelectorMatches, a token matches at most one rule per selector:
+    // note which advance, then advance them
+    advanced.clear();
+    for (Rule r : token_rules_[*t]) {
+      for (const Use& use : uses_[r]) {
+        if (remaining[use.selector] == use.position + 1) {
+          advanced.push_back(use.selector);
+        }
+      }
+    }
+    for (uint32_t s : advanced) remaining[s]--;
+  }
+  matched->clear();
+  for (size_t i = 0; i < selectors_.size(); i++) {
+    if (remaining[i] == 0) matched->push_back(i);
+  }
+}
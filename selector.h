@@ -14,7 +14,10 @@
 #pragma once
 
 #include <stdint.h>
+#include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace selector_detail {
 
@@ -36,3 +39,48 @@ bool SelectorMatches(const TSel& selector, const TTag& tag) {
   return selector_detail::SelectorMatches(selector.begin(), selector.end(),
                                           tag.begin(), tag.end());
 }
+
+// Many selectors compiled to be matched against a tag at once, with the same
+// result as calling SelectorMatches on each. Rule strings are interned and
+// kept in a trie, so the rules a token matches are found in one walk of the
+// token (and remembered per interned token); each selector then advances
+// over the tag's tokens from the right as its next rule turns up.
+class CompiledSelectors {
+ public:
+  typedef std::vector<std::string> Selector;
+  typedef uint32_t Token;
+
+  // returns the index Match reports the selector by
+  size_t Add(const Selector& selector);
+  size_t size() const { return selectors_.size(); }
+
+  // the same string always gives the same token
+  Token Intern(const std::string& token);
+
+  // (ascending) indices of the selectors matching tag
+  void Match(const std::vector<Token>& tag, std::vector<size_t>* matched) const;
+
+ private:
+  typedef uint32_t Rule;
+  struct TrieNode {
+    std::map<char, uint32_t> next;
+    // the rule spelled by the path here, if any
+    int rule = -1;
+  };
+  struct Use {
+    uint32_t selector;
+    uint32_t position;
+  };
+
+  Rule InternRule(const std::string& rule);
+  // rules that token is a match for (i.e. that are prefixes of it)
+  std::vector<Rule> RulesMatching(const std::string& token) const;
+
+  std::vector<TrieNode> trie_{1};
+  // where each rule appears in selectors_
+  std::vector<std::vector<Use>> uses_;
+  std::vector<std::vector<Rule>> selectors_;
+  std::unordered_map<std::string, Token> tokens_;
+  std::vector<std::string> token_names_;
+  std::vector<std::vector<Rule>> token_rules_;
+};
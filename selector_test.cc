@@ -0,0 +1,67 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "selector.h"
+#include <gtest/gtest.h>
+#include <random>
+
+TEST(SelectorTest, Matches) {
+  typedef std::vector<std::string> V;
+  EXPECT_TRUE(SelectorMatches(V{}, V{"source.cpp"}));
+  EXPECT_TRUE(SelectorMatches(V{"source"}, V{"source.cpp"}));
+  EXPECT_TRUE(SelectorMatches(V{"source", "string"},
+                              V{"source.cpp", "string.quoted", "punct"}));
+  EXPECT_FALSE(SelectorMatches(V{"string", "source"},
+                               V{"source.cpp", "string.quoted"}));
+  EXPECT_FALSE(SelectorMatches(V{"comment"}, V{}));
+}
+
+TEST(CompiledSelectorsTest, AgreesWithSelectorMatches) {
+  const std::vector<std::string> words = {
+      "",        "s",            "source",  "source.cpp", "string",
+      "comment", "comment.line", "keyword", "key",        "string.quoted",
+  };
+  std::mt19937 rng(42);
+  auto random_list = [&](size_t max_len) {
+    std::vector<std::string> r;
+    size_t len = rng() % (max_len + 1);
+    for (size_t i = 0; i < len; i++) {
+      const auto& w = words[rng() % words.size()];
+      if (!w.empty()) r.push_back(w);
+    }
+    return r;
+  };
+  CompiledSelectors compiled;
+  std::vector<std::vector<std::string>> selectors;
+  for (int i = 0; i < 200; i++) {
+    selectors.push_back(random_list(3));
+    EXPECT_EQ(selectors.size() - 1, compiled.Add(selectors.back()));
+  }
+  // a token interned before a rule is added still finds it
+  compiled.Intern("zzz.early");
+  selectors.push_back({"zzz"});
+  compiled.Add(selectors.back());
+  std::vector<size_t> matched;
+  for (int i = 0; i < 1000; i++) {
+    auto tag = random_list(5);
+    if (i % 10 == 0) tag.push_back("zzz.early");
+    std::vector<CompiledSelectors::Token> tokens;
+    for (const auto& t : tag) tokens.push_back(compiled.Intern(t));
+    compiled.Match(tokens, &matched);
+    std::vector<size_t> expect;
+    for (size_t s = 0; s < selectors.size(); s++) {
+      if (SelectorMatches(selectors[s], tag)) expect.push_back(s);
+    }
+    EXPECT_EQ(expect, matched);
+  }
+}
@@ -15,22 +15,116 @@
 #include <grpc++/security/server_credentials.h>
 #include <grpc++/server.h>
 #include <grpc++/server_builder.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <map>
+#include <random>
 #include "absl/synchronization/mutex.h"
 #include "application.h"
+#include "async_call.h"
 #include "buffer.h"
+#include "buffer_cache.h"
+#include "buffer_registry.h"
+#include "clang_config.h"
+#include "command_batcher.h"
+#include "edit_trace.h"
 #include "log.h"
 #include "proto/project_service.grpc.pb.h"
 #include "run.h"
+#include "shm_channel.h"
 #include "src_hash.h"
+#include "trace.h"
 
-class ProjectServer : public Application, public ProjectService::Service {
+DEFINE_int32(buffer_memory_budget_mb, 1024,
+             "Evict idle buffers while the server's resident memory exceeds "
+             "this many megabytes");
+DEFINE_int32(idle_buffer_ttl_secs, 600,
+             "Evict buffers that have had no clients for this long");
+DEFINE_bool(cache_buffer_state, true,
+            "Keep the annotations of buffers the server closes (evicted, or "
+            "open when it exits) in the project, so reopening them is quick");
+DEFINE_int32(buffer_state_cache_days, 30,
+             "Drop cached buffer state unused for this many days");
+DEFINE_int32(server_cq_threads, 2,
+             "Threads serving edit and presence streams (however many are "
+             "open)");
+DEFINE_int32(shm_poll_threads, 2,
+             "Threads serving shared memory edit streams (however many are "
+             "open)");
+DEFINE_int32(edit_log_commands, 100000,
+             "Commands to keep per buffer so reconnecting clients can catch "
+             "up without a full snapshot (0 to always send snapshots)");
+
+// resident set size of this process, or 0 if unknown
+static int64_t ResidentMemoryBytes() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  int64_t size, resident;
+  if (statm >> size >> resident) return resident * sysconf(_SC_PAGESIZE);
+#endif
+  return 0;
+}
+
+// threads in this process, or 0 if unknown
+static int ThreadCount() {
+#ifdef __linux__
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    int threads;
+    if (sscanf(line.c_str(), "Threads: %d", &threads) == 1) return threads;
+  }
+#endif
+  return 0;
+}
+
+static void HistogramToProto(const Histogram::Snapshot& h, HistogramMsg* msg) {
+  msg->set_count(h.count());
+  msg->set_sum_us(absl::ToDoubleMicroseconds(h.sum()));
+  msg->set_p50_us(absl::ToDoubleMicroseconds(h.Percentile(0.5)));
+  msg->set_p90_us(absl::ToDoubleMicroseconds(h.Percentile(0.9)));
+  msg->set_p99_us(absl::ToDoubleMicroseconds(h.Percentile(0.99)));
+  msg->set_max_us(absl::ToDoubleMicroseconds(h.max()));
+  for (int i = 0; i < Histogram::kBuckets; i++) {
+    if (h.bucket(i) == 0) continue;
+    auto* bucket = msg->add_buckets();
+    bucket->set_upper_bound_us(Histogram::BucketLimit(i));
+    bucket->set_count(h.bucket(i));
+  }
+}
+
+// Edit and Presence streams are served from a few threads polling a
+// completion queue, so open streams don't each hold a thread; the unary
+// calls stay synchronous.
+typedef ProjectService::WithAsyncMethod_Edit<
+    ProjectService::WithAsyncMethod_Presence<ProjectService::Service>>
+    AsyncProjectService;
+
+class ProjectServer : public Application, public AsyncProjectService {
  public:
   ProjectServer(int argc, char** argv)
       : project_(PathFromArgs(argc, argv), false),
         active_requests_(0),
         last_activity_(absl::Now()),
-        quit_requested_(false) {
+        quit_requested_(false),
+        buffers_(project_.aspect<ProjectRoot>()->Path(),
+                 [this](const boost::filesystem::path& path) {
+                   return MakeBuffer(path);
+                 }) {
+    if (FLAGS_cache_buffer_state) {
+      state_cache_.reset(new BufferStateCache(
+          project_.aspect<ProjectRoot>()->Path() / ".cedcache",
+          [this](const boost::filesystem::path& path) {
+            std::vector<std::string> args;
+            if (IsClangSource(path)) ClangCompileArgs(&project_, path, &args);
+            return args;
+          },
+          absl::Hours(24) * FLAGS_buffer_state_cache_days));
+    }
     if (PathFromArgs(argc, argv) !=
         project_.aspect<ProjectRoot>()->LocalAddressPath()) {
       throw std::runtime_error(absl::StrCat(
@@ -38,15 +132,38 @@ class ProjectServer : public Application, public ProjectService::Service {
           project_.aspect<ProjectRoot>()->LocalAddressPath().string()));
     }
 
-    server_ =
-        grpc::ServerBuilder()
-            .RegisterService(this)
-            .AddListeningPort(project_.aspect<ProjectRoot>()->LocalAddress(),
-                              grpc::InsecureServerCredentials())
-            .BuildAndStart();
+    grpc::ServerBuilder builder;
+    builder.RegisterService(this).AddListeningPort(
+        project_.aspect<ProjectRoot>()->LocalAddress(),
+        grpc::InsecureServerCredentials());
+    cq_ = builder.AddCompletionQueue();
+    server_ = builder.BuildAndStart();
 
-    Log() << "Created server " << server_.get() << " @ "
-          << project_.aspect<ProjectRoot>()->LocalAddress();
+    LOG(INFO) << "Created server " << server_.get() << " @ "
+              << project_.aspect<ProjectRoot>()->LocalAddress();
+
+    // each waiting call makes the next when a client takes it
+    new EditCall(this);
+    new PresenceCall(this);
+    for (int i = 0; i < std::max(1, FLAGS_server_cq_threads); i++) {
+      cq_threads_.emplace_back([this]() { PollCompletionQueue(cq_.get()); });
+    }
+
+    if (FLAGS_shm_transport) {
+      try {
+        shm_poller_.reset(new ShmPoller(FLAGS_shm_poll_threads));
+        shm_listener_.reset(new ShmListener(
+            ShmAddressPath(project_.aspect<ProjectRoot>()->Path()),
+            [this](std::unique_ptr<ShmChannel> channel) {
+              ShmChannel* c = channel.get();
+              shm_poller_->Add(std::move(channel),
+                               std::unique_ptr<ShmPoller::Session>(
+                                   new ShmEditCall(this, c)));
+            }));
+      } catch (std::exception& e) {
+        LOG(ERROR) << "No shared memory transport: " << e.what();
+      }
+    }
   }
 
   int Run() override {
@@ -56,13 +173,38 @@ class ProjectServer : public Application, public ProjectService::Service {
              (quit_requested_ ||
               (absl::Now() - last_activity_ > absl::Hours(1)));
     };
+    for (;;) {
+      {
+        absl::MutexLock lock(&mu_);
+        if (mu_.AwaitWithTimeout(absl::Condition(&done),
+                                 absl::Duration(absl::Seconds(10)))) {
+          break;
+        }
+      }
+      EvictIdleBuffers();
+    }
+    // a shared memory session may have slipped in before the listener stops
+    shm_listener_.reset();
     {
       absl::MutexLock lock(&mu_);
-      while (!mu_.AwaitWithTimeout(absl::Condition(&done),
-                                   absl::Duration(absl::Minutes(1))))
-        ;
+      auto idle = [this]() {
+        mu_.AssertHeld();
+        return active_requests_ == 0;
+      };
+      mu_.Await(absl::Condition(&idle));
     }
+    shm_poller_.reset();
     server_->Shutdown();
+    cq_->Shutdown();
+    for (auto& t : cq_threads_) t.join();
+    // for the next server to start warm
+    if (state_cache_) {
+      buffers_.ForEach([this](const boost::filesystem::path& path,
+                              Buffer* buffer) {
+        state_cache_->Store(path, buffer->ContentSnapshot(),
+                            buffer->site()->site_id());
+      });
+    }
     return 0;
   }
 
@@ -80,121 +222,496 @@ class ProjectServer : public Application, public ProjectService::Service {
     return grpc::Status::OK;
   }
 
-  grpc::Status Edit(
-      grpc::ServerContext* context,
-      grpc::ServerReaderWriter<EditMessage, EditMessage>* stream) override {
-    ScopedRequest scoped_request(this);
-    EditMessage msg;
-    if (!stream->Read(&msg)) {
-      return grpc::Status(grpc::INVALID_ARGUMENT,
-                          "Stream closed with no greeting");
-    }
-    if (msg.type_case() != EditMessage::kClientHello) {
-      return grpc::Status(grpc::INVALID_ARGUMENT,
-                          "First message from client must be ClientHello");
-    }
-    Buffer* buffer = GetBuffer(msg.client_hello().buffer_name());
-    if (!buffer) {
-      return grpc::Status(grpc::INVALID_ARGUMENT,
-                          "Unable to access requested buffer");
-    }
-    Site site;
-    auto listener = buffer->Listen(
-        [stream, &site](const AnnotatedString& initial) {
-          EditMessage out;
-          auto body = out.mutable_server_hello();
-          body->set_site_id(site.site_id());
-          *body->mutable_current_state() = initial.AsProto();
-          stream->Write(out);
-        },
-        [stream](const CommandSet* commands) {
-          EditMessage out;
-          *out.mutable_commands() = *commands;
-          stream->Write(out);
-        });
-    while (stream->Read(&msg)) {
+  grpc::Status Stats(grpc::ServerContext* context, const StatsRequest* req,
+                     StatsResponse* rsp) override {
+    buffers_.ForEach([rsp](const boost::filesystem::path& path,
+                           Buffer* buffer) {
+      buffer->ForEachCollaborator([&](const Collaborator& c) {
+        auto* msg = rsp->add_collaborators();
+        msg->set_buffer(path.string());
+        msg->set_collaborator(c.name());
+        HistogramToProto(c.stats().queue_wait.Take(),
+                         msg->mutable_queue_wait());
+        HistogramToProto(c.stats().run.Take(), msg->mutable_run());
+        HistogramToProto(c.stats().integrate.Take(), msg->mutable_integrate());
+      });
+    });
+    rsp->set_threads(ThreadCount());
+    return grpc::Status::OK;
+  }
+
+ private:
+  class ScopedRequest {
+   public:
+    explicit ScopedRequest(ProjectServer* p) : p_(p) {
+      absl::MutexLock lock(&p_->mu_);
+      p_->active_requests_++;
+      p_->last_activity_ = absl::Now();
+    }
+
+    ~ScopedRequest() {
+      absl::MutexLock lock(&p_->mu_);
+      p_->active_requests_--;
+      p_->last_activity_ = absl::Now();
+    }
+
+   private:
+    ProjectServer* const p_;
+  };
+
+  // The part of an Edit stream that doesn't depend on how it's carried.
+  class EditSession {
+   public:
+    explicit EditSession(ProjectServer* server) : server_(server) {}
+    ~EditSession() { Close(); }
+
+    // msg is the client's hello: send_hello is called (under the buffer's
+    // lock) with the reply, and send_commands with everything integrated
+    // into the buffer from then on, until Close
+    grpc::Status Open(
+        const EditMessage& msg,
+        std::function<void(const EditMessage& hello)> send_hello,
+        std::function<void(const CommandSet& commands,
+                           const VersionVector& version)>
+            send_commands) {
+      if (msg.type_case() != EditMessage::kClientHello) {
+        return grpc::Status(grpc::INVALID_ARGUMENT,
+                            "First message from client must be ClientHello");
+      }
+      buffer_ = server_->buffers_.Get(msg.client_hello().buffer_name());
+      if (!buffer_) {
+        return grpc::Status(grpc::INVALID_ARGUMENT,
+                            "Unable to access requested buffer");
+      }
+      Resubscribe(msg.client_hello().subscriptions());
+      const EditMessage::ClientHello& client_hello = msg.client_hello();
+      // a client rejoining keeps its site, so its commands still count
+      // against the same entry in the log's versions; it proves the site is
+      // its own with the token it was given, on the same buffer
+      uint64_t presence_token;
+      const bool rejoined =
+          client_hello.rejoin_site_id() &&
+          server_->RejoinSite(client_hello.rejoin_site_id(),
+                              client_hello.rejoin_token(),
+                              buffer_->filename());
+      if (rejoined) {
+        site_.reset(
+            new Site(absl::optional<int>(client_hello.rejoin_site_id())));
+        presence_token = client_hello.rejoin_token();
+      } else {
+        if (client_hello.rejoin_site_id()) {
+          LOG(INFO) << "Refused rejoin as site "
+                    << client_hello.rejoin_site_id() << ": giving a new site";
+        }
+        site_.reset(new Site());
+        presence_token = server_->BindSite(site_->site_id(),
+                                           buffer_->filename());
+      }
+      const Site& site = *site_;
+      listener_ = buffer_->Listen(
+          [&site, &client_hello, &send_hello, presence_token, rejoined](
+              const AnnotatedString& initial, const CommandLog* log) {
+            EditMessage out;
+            auto body = out.mutable_server_hello();
+            body->set_site_id(site.site_id());
+            body->set_presence_token(presence_token);
+            if (log) {
+              body->set_log_id(log->id());
+              VersionVectorToProto(log->version(), out.mutable_version());
+            }
+            if (rejoined && log && client_hello.log_id() == log->id() &&
+                log->Since(VersionVectorFromProto(client_hello.known()),
+                           body->mutable_missing())) {
+              body->set_incremental(true);
+            } else {
+              if (rejoined) {
+                LOG(INFO) << "Site " << site.site_id()
+                          << " rejoining from outside the log: sending "
+                             "snapshot";
+              }
+              body->clear_missing();
+              *body->mutable_current_state() = initial.AsProto();
+            }
+            send_hello(out);
+          },
+          [send_commands](const CommandSet* commands,
+                          const VersionVector& version) {
+            send_commands(*commands, version);
+          });
+      return grpc::Status::OK;
+    }
+
+    grpc::Status Receive(const EditMessage& msg) {
+      if (msg.type_case() == EditMessage::kSubscriptions) {
+        Resubscribe(msg.subscriptions().outputs());
+        return grpc::Status::OK;
+      }
       if (msg.type_case() != EditMessage::kCommands) {
         return grpc::Status(grpc::INVALID_ARGUMENT,
                             "Expected commands after greetings");
       }
-      buffer->PushChanges(&msg.commands(), true);
+      buffer_->PushChanges(&msg.commands(), true, site_->site_id());
+      return grpc::Status::OK;
     }
-    CommandSet cleanup_commands;
-    buffer->ContentSnapshot().MakeDeleteAttributesBySite(&cleanup_commands,
-                                                         site);
-    buffer->PushChanges(&msg.commands(), false);
-    return grpc::Status::OK;
-  }
 
- private:
-  Project project_;
-  std::unique_ptr<grpc::Server> server_;
-
-  absl::Mutex mu_;
-  int active_requests_ GUARDED_BY(mu_);
-  absl::Time last_activity_ GUARDED_BY(mu_);
-  std::map<boost::filesystem::path, std::unique_ptr<Buffer>> buffers_
-      GUARDED_BY(mu_);
-  bool quit_requested_ GUARDED_BY(mu_);
+    // stops sending; the buffer is left to be evicted once idle
+    void Close() {
+      if (!buffer_) return;
+      listener_.reset();
+      buffer_->UpdatePresence(site_->site_id(), absl::nullopt);
+      server_->UnbindSite(site_->site_id());
+      server_->buffers_.MarkIdle(buffer_->filename());
+      subscriptions_.clear();
+      buffer_.reset();
+    }
 
-  static bool IsChildOf(boost::filesystem::path needle,
-                        boost::filesystem::path haystack) {
-    needle = boost::filesystem::absolute(needle);
-    haystack = boost::filesystem::absolute(haystack);
-    if (haystack.filename() == ".") {
-      haystack.remove_filename();
+   private:
+    // keeps what's still wanted subscribed throughout, so its collaborators
+    // don't park in between
+    void Resubscribe(
+        const google::protobuf::RepeatedPtrField<std::string>& outputs) {
+      std::map<std::string, std::unique_ptr<Buffer::Subscription>> kept;
+      for (const auto& output : outputs) {
+        if (kept.count(output)) continue;
+        auto it = subscriptions_.find(output);
+        kept.emplace(output, it != subscriptions_.end()
+                                 ? std::move(it->second)
+                                 : buffer_->Subscribe(output));
+      }
+      subscriptions_.swap(kept);
     }
-    if (!needle.has_filename()) return false;
-    needle.remove_filename();
 
-    std::string needle_str = needle.string();
-    std::string haystack_str = haystack.string();
-    if (needle_str.length() > haystack_str.length()) return false;
+    ProjectServer* const server_;
+    std::shared_ptr<Buffer> buffer_;
+    // by output
+    std::map<std::string, std::unique_ptr<Buffer::Subscription>>
+        subscriptions_;
+    std::unique_ptr<Site> site_;
+    std::unique_ptr<BufferListener> listener_;
+  };
 
-    return std::equal(haystack_str.begin(), haystack_str.end(),
-                      needle_str.begin());
+  static bool Compress(const google::protobuf::MessageLite& msg) {
+    return FLAGS_edit_compress_bytes > 0 &&
+           msg.ByteSizeLong() >= static_cast<size_t>(FLAGS_edit_compress_bytes);
   }
 
-  Buffer* GetBuffer(boost::filesystem::path path) {
-    path = boost::filesystem::absolute(path);
-    if (!IsChildOf(path, project_.aspect<ProjectRoot>()->Path())) {
-      Log() << "Attempt to access outside of project sandbox: " << path
-            << " in project root " << project_.aspect<ProjectRoot>()->Path();
-      return nullptr;
+  // An Edit stream over gRPC. Commands integrated while a write is out are
+  // merged into the next one.
+  class EditCall final : public AsyncBidiCall<EditMessage, EditMessage> {
+   public:
+    explicit EditCall(ProjectServer* server)
+        : server_(server), session_(server) {
+      server_->RequestEdit(&ctx_, &stream_, server_->cq_.get(),
+                           server_->cq_.get(), request_tag());
     }
-    absl::MutexLock lock(&mu_);
-    auto it = buffers_.find(path);
-    if (it != buffers_.end()) {
-      return it->second.get();
+
+   private:
+    void OnStart() override {
+      new EditCall(server_);
+      scoped_request_.reset(new ScopedRequest(server_));
+      // batches are compressed or not message by message
+      if (FLAGS_edit_compress_bytes > 0) {
+        ctx_.set_compression_algorithm(GRPC_COMPRESS_GZIP);
+      }
     }
-    if (!boost::filesystem::exists(path)) {
-      return nullptr;
+
+    grpc::Status OnRead(const EditMessage& msg) override {
+      if (opened_) return session_.Receive(msg);
+      opened_ = true;
+      return session_.Open(
+          msg,
+          [this](const EditMessage& hello) {
+            grpc::WriteOptions options;
+            if (!Compress(hello)) options.set_no_compression();
+            Write(hello, options);
+          },
+          [this](const CommandSet& commands, const VersionVector& version) {
+            Produce([&]() {
+              mu_.AssertHeld();
+              pending_.MergeFrom(commands);
+              pending_version_ = version;
+            });
+          });
     }
-    return buffers_
-        .emplace(
-            path,
-            Buffer::Builder().SetFilename(path).SetProject(&project_).Make())
-        .first->second.get();
-  }
 
-  class ScopedRequest {
+    void OnEnd() override {
+      session_.Close();
+      scoped_request_.reset();
+    }
+
+    bool NextWrite(EditMessage* msg, grpc::WriteOptions* options) override
+        EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      if (pending_.commands().empty()) return false;
+      msg->mutable_commands()->Swap(&pending_);
+      VersionVectorToProto(pending_version_, msg->mutable_version());
+      pending_version_.clear();
+      if (!Compress(*msg)) options->set_no_compression();
+      return true;
+    }
+
+    ProjectServer* const server_;
+    std::unique_ptr<ScopedRequest> scoped_request_;
+    EditSession session_;
+    bool opened_ = false;
+    CommandSet pending_ GUARDED_BY(mu_);
+    VersionVector pending_version_ GUARDED_BY(mu_);
+  };
+
+  // An Edit stream over shared memory, run from shm_poller_'s threads.
+  // Commands integrated while a write is still queued are merged into the
+  // next one.
+  class ShmEditCall final : public ShmPoller::Session {
    public:
-    explicit ScopedRequest(ProjectServer* p) : p_(p) {
-      absl::MutexLock lock(&p_->mu_);
-      p_->active_requests_++;
-      p_->last_activity_ = absl::Now();
+    // counted from here so Run can't finish before it starts
+    ShmEditCall(ProjectServer* server, ShmChannel* channel)
+        : scoped_request_(server), channel_(channel), session_(server) {}
+
+    bool OnReadable(ShmChannel* channel) override {
+      EditMessage msg;
+      bool closed;
+      while (channel->TryRead(&msg, &closed)) {
+        grpc::Status status = opened_ ? session_.Receive(msg) : Open(msg);
+        if (!status.ok()) {
+          LOG(ERROR) << "Edit stream: " << status.error_message();
+          return false;
+        }
+      }
+      return !closed;
     }
 
-    ~ScopedRequest() {
-      absl::MutexLock lock(&p_->mu_);
-      p_->active_requests_--;
-      p_->last_activity_ = absl::Now();
+    void OnSent(ShmChannel* channel) override {
+      absl::MutexLock lock(&mu_);
+      SendPending();
     }
 
    private:
-    ProjectServer* const p_;
+    grpc::Status Open(const EditMessage& msg) {
+      opened_ = true;
+      return session_.Open(
+          msg, [this](const EditMessage& hello) { channel_->Send(hello); },
+          [this](const CommandSet& commands, const VersionVector& version) {
+            absl::MutexLock lock(&mu_);
+            pending_.MergeFrom(commands);
+            pending_version_ = version;
+            SendPending();
+          });
+    }
+
+    void SendPending() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      if (pending_.commands().empty() || channel_->Sending()) return;
+      TraceSpan span("shm_write");
+      EditMessage out;
+      out.mutable_commands()->Swap(&pending_);
+      VersionVectorToProto(pending_version_, out.mutable_version());
+      pending_version_.clear();
+      channel_->Send(out);
+    }
+
+    ScopedRequest scoped_request_;
+    ShmChannel* const channel_;
+    bool opened_ = false;
+    absl::Mutex mu_;
+    CommandSet pending_ GUARDED_BY(mu_);
+    VersionVector pending_version_ GUARDED_BY(mu_);
+    // last, so it stops sending before the rest goes
+    EditSession session_;
+  };
+
+  class PresenceCall final
+      : public AsyncBidiCall<PresenceMessage, PresenceMessage> {
+   public:
+    explicit PresenceCall(ProjectServer* server) : server_(server) {
+      server_->RequestPresence(&ctx_, &stream_, server_->cq_.get(),
+                               server_->cq_.get(), request_tag());
+    }
+
+   private:
+    void OnStart() override {
+      new PresenceCall(server_);
+      scoped_request_.reset(new ScopedRequest(server_));
+    }
+
+    grpc::Status OnRead(const PresenceMessage& msg) override {
+      if (buffer_) {
+        if (msg.type_case() != PresenceMessage::kUpdate) {
+          return grpc::Status(grpc::INVALID_ARGUMENT,
+                              "Expected presence after greetings");
+        }
+        if (msg.update().site_id() != site_id_) {
+          return grpc::Status(grpc::PERMISSION_DENIED,
+                              "Presence is only taken for the stream's site");
+        }
+        // dropped while the site's Edit stream is away (say, rejoining):
+        // closing it cleared the site's presence
+        if (server_->SiteEditing(site_id_)) {
+          buffer_->UpdatePresence(site_id_, PresenceFromProto(msg.update()));
+        }
+        return grpc::Status::OK;
+      }
+      if (msg.type_case() != PresenceMessage::kHello) {
+        return grpc::Status(grpc::INVALID_ARGUMENT,
+                            "First message from client must be Hello");
+      }
+      std::shared_ptr<Buffer> buffer =
+          server_->buffers_.Get(msg.hello().buffer_name());
+      if (!buffer) {
+        return grpc::Status(grpc::INVALID_ARGUMENT,
+                            "Unable to access requested buffer");
+      }
+      if (!server_->SiteBound(msg.hello().site_id(),
+                              msg.hello().presence_token(),
+                              buffer->filename())) {
+        server_->buffers_.MarkIdle(buffer->filename());
+        return grpc::Status(grpc::PERMISSION_DENIED,
+                            "Presence hello doesn't match an Edit stream");
+      }
+      buffer_ = std::move(buffer);
+      site_id_ = msg.hello().site_id();
+      listener_ = buffer_->ListenPresence(
+          [this](int site_id, const absl::optional<SitePresence>& presence) {
+            PresenceMessage out;
+            *out.mutable_update() = PresenceToProto(site_id, presence);
+            Write(out, grpc::WriteOptions());
+          });
+      return grpc::Status::OK;
+    }
+
+    void OnEnd() override {
+      listener_.reset();
+      if (buffer_) server_->buffers_.MarkIdle(buffer_->filename());
+      buffer_.reset();
+      scoped_request_.reset();
+    }
+
+    ProjectServer* const server_;
+    std::unique_ptr<ScopedRequest> scoped_request_;
+    std::shared_ptr<Buffer> buffer_;
+    // the site this stream speaks for
+    int site_id_ = 0;
+    std::unique_ptr<BufferListener> listener_;
   };
 
+  // Sites with an Edit stream, and the token their presence streams must
+  // show. A site keeps its token once given, so a client that rejoins (which
+  // takes showing the token too) keeps using its presence stream.
+  struct SiteBinding {
+    // never zero once given
+    uint64_t presence_token = 0;
+    boost::filesystem::path buffer;
+    int edit_sessions = 0;
+  };
+
+  // a new site: returns its token
+  uint64_t BindSite(int site_id, const boost::filesystem::path& buffer) {
+    absl::MutexLock lock(&sites_mu_);
+    SiteBinding& binding = sites_[site_id];
+    std::random_device rd;
+    do {
+      binding.presence_token = (static_cast<uint64_t>(rd()) << 32) | rd();
+    } while (binding.presence_token == 0);
+    binding.buffer = buffer;
+    binding.edit_sessions = 1;
+    return binding.presence_token;
+  }
+
+  // an existing site, for a client that shows its token
+  bool RejoinSite(int site_id, uint64_t presence_token,
+                  const boost::filesystem::path& buffer) {
+    absl::MutexLock lock(&sites_mu_);
+    auto it = sites_.find(site_id);
+    if (it == sites_.end() || it->second.presence_token == 0 ||
+        it->second.presence_token != presence_token ||
+        it->second.buffer != buffer) {
+      return false;
+    }
+    it->second.edit_sessions++;
+    return true;
+  }
+
+  void UnbindSite(int site_id) {
+    absl::MutexLock lock(&sites_mu_);
+    auto it = sites_.find(site_id);
+    if (it != sites_.end()) it->second.edit_sessions--;
+  }
+
+  bool SiteBound(int site_id, uint64_t presence_token,
+                 const boost::filesystem::path& buffer) {
+    absl::MutexLock lock(&sites_mu_);
+    auto it = sites_.find(site_id);
+    return it != sites_.end() && it->second.presence_token == presence_token &&
+           it->second.buffer == buffer;
+  }
+
+  bool SiteEditing(int site_id) {
+    absl::MutexLock lock(&sites_mu_);
+    auto it = sites_.find(site_id);
+    return it != sites_.end() && it->second.edit_sessions > 0;
+  }
+
+  Project project_;
+  std::unique_ptr<grpc::Server> server_;
+  std::unique_ptr<grpc::ServerCompletionQueue> cq_;
+  std::vector<std::thread> cq_threads_;
+  std::unique_ptr<ShmPoller> shm_poller_;
+  std::unique_ptr<ShmListener> shm_listener_;
+
+  absl::Mutex mu_;
+  int active_requests_ GUARDED_BY(mu_);
+  absl::Time last_activity_ GUARDED_BY(mu_);
+  bool quit_requested_ GUARDED_BY(mu_);
+  absl::Mutex sites_mu_;
+  std::map<int, SiteBinding> sites_ GUARDED_BY(sites_mu_);
+  std::unique_ptr<BufferStateCache> state_cache_;
+  BufferRegistry buffers_;
+
+  // called by buffers_ to open a buffer
+  std::shared_ptr<Buffer> MakeBuffer(const boost::filesystem::path& path) {
+    Buffer::Builder builder;
+    builder.SetFilename(path).SetProject(&project_).SetCommandLog(
+        FLAGS_edit_log_commands);
+    if (state_cache_) {
+      if (auto cached = state_cache_->Load(path)) {
+        LOG(INFO) << "Restoring cached state of " << path;
+        builder.SetEvictedState(cached->content, cached->site_id);
+      }
+    }
+    return builder.Make();
+  }
+
+  // Drop buffers nobody is editing: any that have been idle longer than
+  // --idle_buffer_ttl_secs, and while over the memory budget, the least
+  // recently used one. Buffers are destroyed (joining their collaborator
+  // threads) outside any lock.
+  void EvictIdleBuffers() {
+    // memory is slow to be returned: drop one buffer per check
+    bool over_budget =
+        ResidentMemoryBytes() >
+        static_cast<int64_t>(FLAGS_buffer_memory_budget_mb) << 20;
+    std::vector<std::shared_ptr<Buffer>> evicted = buffers_.TakeIdle(
+        absl::Now() - absl::Seconds(FLAGS_idle_buffer_ttl_secs), over_budget);
+    for (auto& buffer : evicted) {
+      LOG(INFO) << "Evicting idle buffer " << buffer->filename();
+      auto path = buffer->filename();
+      int site_id = buffer->site()->site_id();
+      AnnotatedString content = buffer->ContentSnapshot();
+      buffer.reset();
+      if (state_cache_) state_cache_->Store(path, content, site_id);
+    }
+#ifdef __GLIBC__
+    if (!evicted.empty()) malloc_trim(0);
+#endif
+  }
+
+  // the files whose annotations depend on compile args
+  static bool IsClangSource(const boost::filesystem::path& path) {
+    auto ext = path.extension();
+    for (auto clang_ext :
+         {".c", ".cxx", ".cpp", ".C", ".cc", ".h", ".H", ".hpp", ".hxx"}) {
+      if (ext == clang_ext) return true;
+    }
+    return false;
+  }
+
   static boost::filesystem::path PathFromArgs(int argc, char** argv) {
     if (argc != 2) throw std::runtime_error("Expected path");
     return argv[1];
@@ -203,17 +720,58 @@ class ProjectServer : public Application, public ProjectService::Service {
 
 REGISTER_APPLICATION(ProjectServer);
 
+PresenceMsg PresenceToProto(int site_id,
+                            const absl::optional<SitePresence>& presence) {
+  PresenceMsg msg;
+  msg.set_site_id(site_id);
+  if (presence) {
+    msg.set_seq(presence->seq);
+    msg.set_cursor(presence->cursor.id);
+    msg.set_selection_anchor(presence->selection_anchor.id);
+  } else {
+    msg.set_gone(true);
+  }
+  return msg;
+}
+
+absl::optional<SitePresence> PresenceFromProto(const PresenceMsg& msg) {
+  if (msg.gone()) return absl::nullopt;
+  SitePresence presence;
+  presence.cursor = ID(msg.cursor());
+  presence.selection_anchor = ID(msg.selection_anchor());
+  presence.seq = msg.seq();
+  return presence;
+}
+
+void VersionVectorToProto(const VersionVector& version, VersionVectorMsg* msg) {
+  for (const auto& v : version) (*msg->mutable_sets())[v.first] = v.second;
+}
+
+VersionVector VersionVectorFromProto(const VersionVectorMsg& msg) {
+  VersionVector version;
+  for (const auto& v : msg.sets()) version[v.first] = v.second;
+  return version;
+}
+
 void SpawnServer(const boost::filesystem::path& ced_bin,
                  const Project& project) {
-  run_daemon(
-      ced_bin,
-      {
-          "-mode",
-          "ProjectServer",
-          "-logfile",
-          (project.aspect<ProjectRoot>()->LocalAddressPath().parent_path() /
-           absl::StrCat(".cedlog.server.", ced_src_hash))
-              .string(),
-          project.aspect<ProjectRoot>()->LocalAddressPath().string(),
-      });
+  std::vector<std::string> args{
+      "-mode",
+      "ProjectServer",
+      "-logfile",
+      (project.aspect<ProjectRoot>()->LocalAddressPath().parent_path() /
+       absl::StrCat(".cedlog.server.", ced_src_hash))
+          .string(),
+  };
+  if (!FLAGS_trace_file.empty()) {
+    args.push_back("-trace_file");
+    // the daemon may not share our working directory
+    args.push_back(boost::filesystem::absolute(FLAGS_trace_file).string());
+  }
+  if (!FLAGS_edit_trace_dir.empty()) {
+    args.push_back("-edit_trace_dir");
+    args.push_back(boost::filesystem::absolute(FLAGS_edit_trace_dir).string());
+  }
+  args.push_back(project.aspect<ProjectRoot>()->LocalAddressPath().string());
+  run_daemon(ced_bin, args);
 }
@@ -13,7 +13,17 @@
 // limitations under the License.
 #pragma once
 
+#include "buffer.h"
 #include "project.h"
+#include "proto/project_service.pb.h"
 
 void SpawnServer(const boost::filesystem::path& ced_bin,
                  const Project& project);
+
+// presence is empty if the site has gone
+PresenceMsg PresenceToProto(int site_id,
+                            const absl::optional<SitePresence>& presence);
+absl::optional<SitePresence> PresenceFromProto(const PresenceMsg& msg);
+
+void VersionVectorToProto(const VersionVector& version, VersionVectorMsg* msg);
+VersionVector VersionVectorFromProto(const VersionVectorMsg& msg);
@@ -0,0 +1,675 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "shm_channel.h"
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include "absl/strings/str_cat.h"
+#include "log.h"
+#include "wrap_syscall.h"
+
+DEFINE_bool(shm_transport, true,
+            "Carry edits between client and server through shared memory "
+            "instead of gRPC when they're on the same host");
+DEFINE_int32(shm_ring_kb, 1024,
+             "Buffering in each direction of a shared memory edit channel");
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared memory rings need lock free atomics");
+
+namespace {
+
+constexpr uint32_t kMagic = 0xcedc0de1;
+constexpr int kNumFDs = 5;  // memfd, then eventfds
+// spins before going to sleep on an eventfd: a reply to a keystroke usually
+// turns up well inside this
+constexpr int kSpins = 2000;
+// the largest message either end takes, so a bad size from the peer can't
+// have us allocate gigabytes
+constexpr uint32_t kMaxMessageBytes = 256 << 20;
+
+// read before mapping, and never from the mapping: the peer can rewrite the
+// header at any time, so the size checked on setup is the one used
+uint64_t ReadCapacity(int memfd) {
+  uint32_t prefix[2];
+  if (pread(memfd, prefix, sizeof(prefix), 0) != sizeof(prefix)) {
+    throw std::runtime_error("Shared memory channel too small");
+  }
+  return prefix[1];
+}
+
+size_t PageRound(size_t n) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  return (n + page - 1) / page * page;
+}
+
+void DrainEventFD(int eventfd) {
+  uint64_t count;
+  if (read(eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    LOG(ERROR) << "eventfd read failed: errno=" << errno;
+  }
+}
+
+}  // namespace
+
+// positions count bytes ever written/read, so head - tail is what's queued
+struct ShmChannel::Ring {
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) std::atomic<uint32_t> reader_waiting;
+  std::atomic<uint32_t> writer_waiting;
+  std::atomic<uint32_t> closed;
+};
+
+struct ShmChannel::Header {
+  uint32_t magic;
+  uint32_t capacity;
+  // to the server, then from it
+  Ring rings[2];
+};
+
+ShmChannel::ShmChannel(int sock, int memfd, const int* eventfds, bool client)
+    : sock_(sock),
+      memfd_(memfd),
+      header_(nullptr),
+      mapped_bytes_(0),
+      capacity_(ReadCapacity(memfd)) {
+  std::copy(eventfds, eventfds + 4, eventfds_);
+  struct stat st;
+  WrapSyscall("fstat", [&]() { return fstat(memfd_, &st); });
+  mapped_bytes_ = st.st_size;
+  if (mapped_bytes_ < PageRound(sizeof(Header))) {
+    throw std::runtime_error("Shared memory channel too small");
+  }
+  void* p = mmap(nullptr, mapped_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 memfd_, 0);
+  if (p == MAP_FAILED) {
+    throw std::runtime_error(
+        absl::StrCat("mmap failed: errno=", errno, " ", strerror(errno)));
+  }
+  header_ = static_cast<Header*>(p);
+  const size_t data_offset = PageRound(sizeof(Header));
+  if (header_->magic != kMagic || capacity_ == 0 ||
+      data_offset + 2 * capacity_ != mapped_bytes_) {
+    throw std::runtime_error("Malformed shared memory channel");
+  }
+  char* data = static_cast<char*>(p) + data_offset;
+  const int out = client ? 0 : 1;
+  const int in = 1 - out;
+  out_ = &header_->rings[out];
+  in_ = &header_->rings[in];
+  out_data_ = data + out * capacity_;
+  in_data_ = data + in * capacity_;
+  out_data_efd_ = eventfds_[2 * out];
+  out_space_efd_ = eventfds_[2 * out + 1];
+  in_data_efd_ = eventfds_[2 * in];
+  in_space_efd_ = eventfds_[2 * in + 1];
+}
+
+ShmChannel::~ShmChannel() {
+  if (header_) {
+    Close();
+    munmap(header_, mapped_bytes_);
+  }
+  for (int fd : eventfds_) close(fd);
+  close(memfd_);
+  close(sock_);
+}
+
+std::unique_ptr<ShmChannel> ShmChannel::Connect(
+    const boost::filesystem::path& address, size_t ring_bytes) {
+  const size_t capacity = PageRound(ring_bytes);
+  const size_t data_offset = PageRound(sizeof(Header));
+  int fds[kNumFDs];
+  fds[0] = WrapSyscall("memfd_create", []() {
+    return syscall(SYS_memfd_create, "ced-edits", MFD_CLOEXEC);
+  });
+  for (int i = 1; i < kNumFDs; i++) {
+    fds[i] = WrapSyscall("eventfd", []() { return eventfd(0, EFD_CLOEXEC); });
+  }
+  WrapSyscall("ftruncate", [&]() {
+    return ftruncate(fds[0], data_offset + 2 * capacity);
+  });
+  // the rest starts zeroed; this is filled in before mapping it so the
+  // constructor can check it
+  static_assert(offsetof(Header, capacity) == sizeof(uint32_t),
+                "header starts magic, capacity");
+  const uint32_t prefix[2] = {kMagic, static_cast<uint32_t>(capacity)};
+  WrapSyscall("pwrite",
+              [&]() { return pwrite(fds[0], prefix, sizeof(prefix), 0); });
+
+  int sock = WrapSyscall("socket", []() {
+    return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  });
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, address.string().c_str(), sizeof(addr.sun_path) - 1);
+  std::unique_ptr<ShmChannel> channel(
+      new ShmChannel(sock, fds[0], fds + 1, true));
+  WrapSyscall("connect", [&]() {
+    return connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  });
+
+  char byte = 0;
+  iovec iov{&byte, 1};
+  char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  WrapSyscall("sendmsg", [&]() { return sendmsg(sock, &msg, MSG_NOSIGNAL); });
+  return channel;
+}
+
+std::unique_ptr<ShmChannel> ShmChannel::Accept(int sock) {
+  char byte;
+  iovec iov{&byte, 1};
+  int fds[kNumFDs];
+  char control[CMSG_SPACE(sizeof(fds))];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  int n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  cmsghdr* cmsg = n == 1 ? CMSG_FIRSTHDR(&msg) : nullptr;
+  if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    close(sock);
+    throw std::runtime_error("Bad shared memory channel handshake");
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  return std::unique_ptr<ShmChannel>(
+      new ShmChannel(sock, fds[0], fds + 1, false));
+}
+
+bool ShmChannel::Write(const google::protobuf::MessageLite& msg) {
+  std::string bytes = msg.SerializeAsString();
+  if (bytes.size() > kMaxMessageBytes) {
+    LOG(ERROR) << "Shared memory message too large: " << bytes.size();
+    return false;
+  }
+  uint32_t size = bytes.size();
+  absl::MutexLock lock(&write_mu_);
+  return WriteBytes(&size, sizeof(size)) &&
+         WriteBytes(bytes.data(), bytes.size());
+}
+
+bool ShmChannel::Read(google::protobuf::MessageLite* msg) {
+  absl::MutexLock lock(&read_mu_);
+  uint32_t size;
+  if (!ReadBytes(&size, sizeof(size))) return false;
+  if (size > kMaxMessageBytes) {
+    LOG(ERROR) << "Shared memory peer sent an oversized message: " << size;
+    Close();
+    return false;
+  }
+  std::string bytes(size, '\0');
+  if (!ReadBytes(&bytes[0], size)) return false;
+  return msg->ParseFromString(bytes);
+}
+
+void ShmChannel::CloseWrites() {
+  out_->closed.store(1);
+  Signal(out_data_efd_);
+}
+
+void ShmChannel::Close() {
+  CloseWrites();
+  in_->closed.store(1);
+  Signal(in_space_efd_);
+  Signal(in_data_efd_);
+  Signal(out_space_efd_);
+}
+
+bool ShmChannel::TryRead(google::protobuf::MessageLite* msg, bool* closed) {
+  absl::MutexLock lock(&read_mu_);
+  *closed = false;
+  for (;;) {
+    // the size, then that many bytes
+    const size_t have = read_partial_.size();
+    size_t want = sizeof(uint32_t);
+    if (have >= want) {
+      uint32_t size;
+      memcpy(&size, read_partial_.data(), sizeof(size));
+      if (size > kMaxMessageBytes) {
+        LOG(ERROR) << "Shared memory peer sent an oversized message: "
+                   << size;
+        read_partial_.clear();
+        Close();
+        *closed = true;
+        return false;
+      }
+      want += size;
+      if (have == want) {
+        bool ok = msg->ParseFromArray(read_partial_.data() + sizeof(size),
+                                      size);
+        read_partial_.clear();
+        *closed = !ok;
+        return ok;
+      }
+    }
+    read_partial_.resize(want);
+    const size_t n = ReadAvailable(&read_partial_[have], want - have);
+    read_partial_.resize(have + n);
+    if (n == 0) {
+      // anything written before closing is still read
+      *closed = in_->closed.load() && in_->head.load() == in_->tail.load();
+      return false;
+    }
+  }
+}
+
+bool ShmChannel::Send(const google::protobuf::MessageLite& msg) {
+  std::string bytes = msg.SerializeAsString();
+  if (bytes.size() > kMaxMessageBytes) {
+    LOG(ERROR) << "Shared memory message too large: " << bytes.size();
+    return false;
+  }
+  uint32_t size = bytes.size();
+  absl::MutexLock lock(&write_mu_);
+  if (out_->closed.load()) return false;
+  send_queue_.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  send_queue_ += bytes;
+  SendQueued();
+  return true;
+}
+
+bool ShmChannel::Sending() {
+  absl::MutexLock lock(&write_mu_);
+  return !send_queue_.empty();
+}
+
+void ShmChannel::SendQueued() {
+  for (;;) {
+    send_done_ += WriteAvailable(send_queue_.data() + send_done_,
+                                 send_queue_.size() - send_done_);
+    if (send_done_ == send_queue_.size() || out_->closed.load()) {
+      send_queue_.clear();
+      send_done_ = 0;
+      out_->writer_waiting.store(0);
+      return;
+    }
+    out_->writer_waiting.store(1);
+    // the reader may have made room before it could see the flag
+    if (out_->head.load() - out_->tail.load() == capacity_) return;
+  }
+}
+
+size_t ShmChannel::ReadAvailable(char* dst, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    uint64_t tail = in_->tail.load(std::memory_order_relaxed);
+    uint64_t head = in_->head.load(std::memory_order_acquire);
+    if (head == tail) break;
+    size_t chunk = std::min<uint64_t>(
+        {n - done, head - tail, capacity_ - tail % capacity_});
+    memcpy(dst + done, in_data_ + tail % capacity_, chunk);
+    in_->tail.store(tail + chunk);
+    done += chunk;
+    if (in_->writer_waiting.load()) Signal(in_space_efd_);
+  }
+  return done;
+}
+
+size_t ShmChannel::WriteAvailable(const char* src, size_t n) {
+  size_t done = 0;
+  while (done < n && !out_->closed.load(std::memory_order_relaxed)) {
+    uint64_t head = out_->head.load(std::memory_order_relaxed);
+    uint64_t tail = out_->tail.load(std::memory_order_acquire);
+    if (head - tail == capacity_) break;
+    size_t chunk = std::min<uint64_t>(
+        {n - done, capacity_ - (head - tail), capacity_ - head % capacity_});
+    memcpy(out_data_ + head % capacity_, src + done, chunk);
+    out_->head.store(head + chunk);
+    done += chunk;
+    if (out_->reader_waiting.load()) Signal(out_data_efd_);
+  }
+  return done;
+}
+
+bool ShmChannel::ReadBytes(void* dst, size_t n) {
+  char* p = static_cast<char*>(dst);
+  int spins = 0;
+  while (n > 0) {
+    uint64_t tail = in_->tail.load(std::memory_order_relaxed);
+    uint64_t head = in_->head.load(std::memory_order_acquire);
+    if (head == tail) {
+      if (in_->closed.load()) {
+        // anything written before closing is still read
+        if (in_->head.load() == tail) return false;
+        continue;
+      }
+      if (spins++ < kSpins) continue;
+      in_->reader_waiting.store(1);
+      bool ok = in_->head.load() != tail || in_->closed.load() ||
+                Wait(in_data_efd_);
+      in_->reader_waiting.store(0);
+      if (!ok) return false;
+      continue;
+    }
+    spins = 0;
+    size_t chunk = std::min<uint64_t>(
+        {n, head - tail, capacity_ - tail % capacity_});
+    memcpy(p, in_data_ + tail % capacity_, chunk);
+    in_->tail.store(tail + chunk);
+    p += chunk;
+    n -= chunk;
+    if (in_->writer_waiting.load()) Signal(in_space_efd_);
+  }
+  return true;
+}
+
+bool ShmChannel::WriteBytes(const void* src, size_t n) {
+  const char* p = static_cast<const char*>(src);
+  int spins = 0;
+  while (n > 0) {
+    if (out_->closed.load(std::memory_order_relaxed)) return false;
+    uint64_t head = out_->head.load(std::memory_order_relaxed);
+    uint64_t tail = out_->tail.load(std::memory_order_acquire);
+    if (head - tail == capacity_) {
+      if (spins++ < kSpins) continue;
+      out_->writer_waiting.store(1);
+      bool ok = out_->tail.load() != tail || out_->closed.load() ||
+                Wait(out_space_efd_);
+      out_->writer_waiting.store(0);
+      if (!ok) return false;
+      continue;
+    }
+    spins = 0;
+    size_t chunk = std::min<uint64_t>(
+        {n, capacity_ - (head - tail), capacity_ - head % capacity_});
+    memcpy(out_data_ + head % capacity_, p, chunk);
+    out_->head.store(head + chunk);
+    p += chunk;
+    n -= chunk;
+    if (out_->reader_waiting.load()) Signal(out_data_efd_);
+  }
+  return true;
+}
+
+bool ShmChannel::Wait(int eventfd) {
+  pollfd fds[2] = {{eventfd, POLLIN, 0}, {sock_, POLLIN | POLLRDHUP, 0}};
+  WrapSyscall("poll", [&]() { return poll(fds, 2, -1); });
+  // nothing more is ever sent on the socket: it being readable means EOF
+  if (fds[1].revents) {
+    LOG(INFO) << "Shared memory channel peer went away";
+    return false;
+  }
+  uint64_t count;
+  if (read(eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    return false;
+  }
+  return true;
+}
+
+void ShmChannel::Signal(int eventfd) {
+  uint64_t one = 1;
+  if (write(eventfd, &one, sizeof(one)) < 0) {
+    LOG(ERROR) << "eventfd write failed: errno=" << errno;
+  }
+}
+
+boost::filesystem::path ShmAddressPath(const boost::filesystem::path& root) {
+  return root / ".cedshm";
+}
+
+ShmListener::ShmListener(const boost::filesystem::path& address,
+                         Handler handler)
+    : address_(address), handler_(std::move(handler)) {
+  sock_ = WrapSyscall("socket", []() {
+    return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  });
+  unlink(address_.string().c_str());
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, address_.string().c_str(), sizeof(addr.sun_path) - 1);
+  WrapSyscall("bind", [&]() {
+    return bind(sock_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  });
+  WrapSyscall("listen", [&]() { return listen(sock_, 16); });
+  WrapSyscall("pipe", [&]() { return pipe2(wake_, O_CLOEXEC); });
+  thread_ = std::thread([this]() { Run(); });
+}
+
+ShmListener::~ShmListener() {
+  char byte = 0;
+  if (write(wake_[1], &byte, 1) < 0) abort();
+  thread_.join();
+  close(wake_[0]);
+  close(wake_[1]);
+  close(sock_);
+  unlink(address_.string().c_str());
+}
+
+void ShmListener::Run() {
+  for (;;) {
+    pollfd fds[2] = {{sock_, POLLIN, 0}, {wake_[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      LOG(ERROR) << "Shared memory listener poll failed: errno=" << errno;
+      return;
+    }
+    if (fds[1].revents) return;
+    int conn = accept4(sock_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0) continue;
+    // a client that connects and then says nothing mustn't wedge us
+    timeval timeout{1, 0};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    try {
+      handler_(ShmChannel::Accept(conn));
+    } catch (std::exception& e) {
+      LOG(ERROR) << "Rejected shared memory channel: " << e.what();
+    }
+  }
+}
+
+struct ShmPoller::Watch {
+  enum Kind { kData, kSpace, kPeer };
+  Entry* entry;
+  Kind kind;
+  int fd;
+};
+
+struct ShmPoller::Entry {
+  std::unique_ptr<ShmChannel> channel;
+  std::unique_ptr<Session> session;
+  Watch watches[3];
+  bool ended = false;
+};
+
+ShmPoller::ShmPoller(int threads) {
+  for (int i = 0; i < std::max(1, threads); i++) {
+    std::unique_ptr<Thread> thread(new Thread);
+    thread->epoll_fd = WrapSyscall(
+        "epoll_create1", []() { return epoll_create1(EPOLL_CLOEXEC); });
+    thread->wake_fd = WrapSyscall(
+        "eventfd", []() { return eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); });
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    WrapSyscall("epoll_ctl", [&]() {
+      return epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->wake_fd, &ev);
+    });
+    Thread* t = thread.get();
+    thread->thread = std::thread([this, t]() { Run(t); });
+    threads_.emplace_back(std::move(thread));
+  }
+}
+
+ShmPoller::~ShmPoller() {
+  for (auto& thread : threads_) {
+    {
+      absl::MutexLock lock(&thread->mu);
+      thread->stopping = true;
+    }
+    uint64_t one = 1;
+    if (write(thread->wake_fd, &one, sizeof(one)) < 0) abort();
+    thread->thread.join();
+  }
+  for (auto& thread : threads_) {
+    std::set<Entry*> entries;
+    {
+      absl::MutexLock lock(&thread->mu);
+      entries = thread->entries;
+    }
+    for (Entry* entry : entries) End(thread.get(), entry);
+    close(thread->epoll_fd);
+    close(thread->wake_fd);
+  }
+}
+
+void ShmPoller::Add(std::unique_ptr<ShmChannel> channel,
+                    std::unique_ptr<Session> session) {
+  Thread* thread;
+  {
+    absl::MutexLock lock(&mu_);
+    thread = threads_[next_thread_++ % threads_.size()].get();
+  }
+  Entry* entry = new Entry;
+  entry->channel = std::move(channel);
+  entry->session = std::move(session);
+  ShmChannel* c = entry->channel.get();
+  entry->watches[0] = {entry, Watch::kData, c->in_data_efd_};
+  entry->watches[1] = {entry, Watch::kSpace, c->out_space_efd_};
+  entry->watches[2] = {entry, Watch::kPeer, c->sock_};
+  {
+    absl::MutexLock lock(&thread->mu);
+    thread->entries.insert(entry);
+    thread->added.push_back(entry);
+  }
+  uint64_t one = 1;
+  if (write(thread->wake_fd, &one, sizeof(one)) < 0) {
+    LOG(ERROR) << "eventfd write failed: errno=" << errno;
+  }
+}
+
+void ShmPoller::Run(Thread* thread) {
+  epoll_event events[64];
+  for (;;) {
+    int n = epoll_wait(thread->epoll_fd, events, 64, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      LOG(ERROR) << "Shared memory poller epoll_wait failed: errno=" << errno;
+      return;
+    }
+    // ended after the batch, which may have more events for them
+    std::vector<Entry*> ended;
+    auto end = [&ended](Entry* entry) {
+      entry->ended = true;
+      ended.push_back(entry);
+    };
+    for (int i = 0; i < n; i++) {
+      Watch* watch = static_cast<Watch*>(events[i].data.ptr);
+      if (watch == nullptr) {
+        DrainEventFD(thread->wake_fd);
+        std::vector<Entry*> added;
+        {
+          absl::MutexLock lock(&thread->mu);
+          if (thread->stopping) return;
+          added.swap(thread->added);
+        }
+        for (Entry* entry : added) {
+          if (!Start(thread, entry)) end(entry);
+        }
+        continue;
+      }
+      Entry* entry = watch->entry;
+      if (entry->ended) continue;
+      ShmChannel* channel = entry->channel.get();
+      switch (watch->kind) {
+        case Watch::kData:
+          DrainEventFD(watch->fd);
+          if (!entry->session->OnReadable(channel)) end(entry);
+          break;
+        case Watch::kSpace: {
+          DrainEventFD(watch->fd);
+          bool sent;
+          {
+            absl::MutexLock lock(&channel->write_mu_);
+            channel->SendQueued();
+            sent = channel->send_queue_.empty();
+          }
+          if (sent) entry->session->OnSent(channel);
+          break;
+        }
+        case Watch::kPeer:
+          // nothing more is ever sent on the socket: it being readable means
+          // EOF. What was written before then is still read.
+          LOG(INFO) << "Shared memory channel peer went away";
+          entry->session->OnReadable(channel);
+          end(entry);
+          break;
+      }
+    }
+    for (Entry* entry : ended) End(thread, entry);
+  }
+}
+
+bool ShmPoller::Start(Thread* thread, Entry* entry) {
+  for (Watch& watch : entry->watches) {
+    if (watch.kind != Watch::kPeer) {
+      fcntl(watch.fd, F_SETFL, fcntl(watch.fd, F_GETFL) | O_NONBLOCK);
+    }
+    epoll_event ev;
+    ev.events = watch.kind == Watch::kPeer ? EPOLLIN | EPOLLRDHUP : EPOLLIN;
+    ev.data.ptr = &watch;
+    if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, watch.fd, &ev) < 0) {
+      LOG(ERROR) << "Shared memory poller epoll_ctl failed: errno=" << errno;
+      return false;
+    }
+  }
+  // from here the writer signals whenever it writes
+  ShmChannel* channel = entry->channel.get();
+  channel->in_->reader_waiting.store(1);
+  // anything that arrived before then
+  return entry->session->OnReadable(channel);
+}
+
+void ShmPoller::End(Thread* thread, Entry* entry) {
+  for (const Watch& watch : entry->watches) {
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, watch.fd, nullptr);
+  }
+  {
+    absl::MutexLock lock(&thread->mu);
+    thread->entries.erase(entry);
+  }
+  // the session stops sending before the channel goes
+  entry->session.reset();
+  delete entry;
+}
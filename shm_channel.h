@@ -0,0 +1,200 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <gflags/gflags.h>
+#include <google/protobuf/message_lite.h>
+#include <boost/filesystem/path.hpp>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "absl/synchronization/mutex.h"
+
+DECLARE_bool(shm_transport);
+DECLARE_int32(shm_ring_kb);
+
+// A bidirectional message channel between two processes on the same host:
+// a pair of single producer/single consumer byte rings in a shared memfd
+// mapping, with eventfds to wake a blocked reader or writer. Messages are
+// copied into the ring once and read straight out of it, without a trip
+// through the kernel; the eventfds are only touched when the other end is
+// actually asleep.
+//
+// The client end creates the memory and eventfds and hands them to the
+// server over a unix socket, which then stays open so either end notices if
+// the other dies.
+//
+// Setup throws std::runtime_error; Read and Write return false once the
+// channel is closed (or the peer has gone).
+//
+// A server end run by a ShmPoller uses TryRead and Send, which never block,
+// instead of Read and Write.
+class ShmChannel {
+ public:
+  ~ShmChannel();
+
+  ShmChannel(const ShmChannel&) = delete;
+  ShmChannel& operator=(const ShmChannel&) = delete;
+
+  // client end: connect to the server listening at address, with
+  // ring_bytes of buffering in each direction
+  static std::unique_ptr<ShmChannel> Connect(
+      const boost::filesystem::path& address, size_t ring_bytes);
+  // server end: take over the channel offered on a newly accepted socket
+  static std::unique_ptr<ShmChannel> Accept(int sock);
+
+  // each may be called from any thread; messages are read in the order
+  // they were written
+  bool Write(const google::protobuf::MessageLite& msg);
+  bool Read(google::protobuf::MessageLite* msg);
+
+  // no more writes from this end: the peer reads what's left, then fails
+  void CloseWrites();
+  // stop both directions, waking anything blocked at either end
+  void Close();
+
+  // Read without blocking: false if a whole message hasn't arrived yet, with
+  // *closed set if none ever will (or what came was malformed)
+  bool TryRead(google::protobuf::MessageLite* msg, bool* closed);
+  // Write without blocking: what doesn't fit in the ring is queued, and goes
+  // out as the poller finds room; false once the channel is closed
+  bool Send(const google::protobuf::MessageLite& msg);
+  // whether an earlier Send is still queued
+  bool Sending();
+
+ private:
+  friend class ShmPoller;
+  struct Ring;
+  struct Header;
+
+  ShmChannel(int sock, int memfd, const int* eventfds, bool client);
+
+  bool ReadBytes(void* dst, size_t n);
+  bool WriteBytes(const void* src, size_t n);
+  // copy what's there (or what there's room for) and return how much
+  size_t ReadAvailable(char* dst, size_t n);
+  size_t WriteAvailable(const char* src, size_t n);
+  // write what's queued until the ring fills, then have the reader signal
+  // once it's made room
+  void SendQueued() EXCLUSIVE_LOCKS_REQUIRED(write_mu_);
+  // block until eventfd is signalled; false if the peer has gone
+  bool Wait(int eventfd);
+  void Signal(int eventfd);
+
+  const int sock_;
+  const int memfd_;
+  // data then space eventfds, for the ring to the server then from it
+  int eventfds_[4];
+  Header* header_;
+  size_t mapped_bytes_;
+  // of each ring, as checked on setup
+  const uint64_t capacity_;
+  Ring* in_;
+  Ring* out_;
+  char* in_data_;
+  char* out_data_;
+  int in_data_efd_, in_space_efd_, out_data_efd_, out_space_efd_;
+  absl::Mutex read_mu_;
+  absl::Mutex write_mu_;
+  // TryRead: the part of a message that's arrived so far
+  std::string read_partial_ GUARDED_BY(read_mu_);
+  // Send: bytes queued, of which the first send_done_ are written
+  std::string send_queue_ GUARDED_BY(write_mu_);
+  size_t send_done_ GUARDED_BY(write_mu_) = 0;
+};
+
+// the unix socket the server takes shared memory channels on
+boost::filesystem::path ShmAddressPath(const boost::filesystem::path& root);
+
+// accepts channels on a unix socket from its own thread
+class ShmListener {
+ public:
+  typedef std::function<void(std::unique_ptr<ShmChannel> channel)> Handler;
+
+  // handler is called on the listener's thread: it should hand the channel
+  // off quickly
+  ShmListener(const boost::filesystem::path& address, Handler handler);
+  // stops accepting (channels already handed off are left alone)
+  ~ShmListener();
+
+  ShmListener(const ShmListener&) = delete;
+  ShmListener& operator=(const ShmListener&) = delete;
+
+ private:
+  void Run();
+
+  const boost::filesystem::path address_;
+  const Handler handler_;
+  int sock_;
+  int wake_[2];
+  std::thread thread_;
+};
+
+// Runs the server ends of many channels from a fixed set of threads, so an
+// open channel costs no thread of its own: each thread sleeps in epoll on the
+// eventfds of the channels given to it, and on their sockets to notice a
+// peer going away.
+class ShmPoller {
+ public:
+  // What's carried over one channel. Its methods are called on a poller
+  // thread, one at a time; it may Send on the channel from any thread.
+  class Session {
+   public:
+    virtual ~Session() {}
+    // something may have arrived: take it with TryRead, and return false
+    // once the channel is finished with
+    virtual bool OnReadable(ShmChannel* channel) = 0;
+    // everything queued by Send has been written
+    virtual void OnSent(ShmChannel* channel) {}
+  };
+
+  explicit ShmPoller(int threads);
+  // ends any sessions still running
+  ~ShmPoller();
+
+  ShmPoller(const ShmPoller&) = delete;
+  ShmPoller& operator=(const ShmPoller&) = delete;
+
+  // session runs until it's finished or the peer goes; then it's destroyed,
+  // and the channel is closed
+  void Add(std::unique_ptr<ShmChannel> channel,
+           std::unique_ptr<Session> session);
+
+ private:
+  struct Entry;
+  struct Watch;
+  struct Thread {
+    int epoll_fd;
+    // signalled when there's something in added, or to stop
+    int wake_fd;
+    absl::Mutex mu;
+    // every session the thread is running, and those not yet started
+    std::set<Entry*> entries GUARDED_BY(mu);
+    std::vector<Entry*> added GUARDED_BY(mu);
+    bool stopping GUARDED_BY(mu) = false;
+    std::thread thread;
+  };
+
+  void Run(Thread* thread);
+  // on the entry's thread: false if it's already over
+  static bool Start(Thread* thread, Entry* entry);
+  static void End(Thread* thread, Entry* entry);
+
+  std::vector<std::unique_ptr<Thread>> threads_;
+  absl::Mutex mu_;
+  size_t next_thread_ GUARDED_BY(mu_) = 0;
+};
@@ -0,0 +1,192 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "shm_channel.h"
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <atomic>
+#include "absl/strings/str_cat.h"
+#include "proto/annotation.pb.h"
+
+namespace {
+
+class ShmChannelTest : public ::testing::Test {
+ protected:
+  ShmChannelTest()
+      : address_(absl::StrCat(testing::TempDir(), "/shm_test.", getpid())),
+        listener_(address_, [this](std::unique_ptr<ShmChannel> channel) {
+          absl::MutexLock lock(&mu_);
+          server_ = std::move(channel);
+        }) {}
+
+  // the server end of the last channel connected
+  std::unique_ptr<ShmChannel> TakeServer() {
+    absl::MutexLock lock(&mu_);
+    auto accepted = [this]() {
+      mu_.AssertHeld();
+      return server_ != nullptr;
+    };
+    mu_.Await(absl::Condition(&accepted));
+    return std::move(server_);
+  }
+
+  const std::string address_;
+  absl::Mutex mu_;
+  std::unique_ptr<ShmChannel> server_ GUARDED_BY(mu_);
+  ShmListener listener_;
+};
+
+CommandSet Insert(const std::string& chars) {
+  CommandSet commands;
+  commands.add_commands()->mutable_insert()->set_characters(chars);
+  return commands;
+}
+
+int CountThreads() {
+  int n = 0;
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr) return -1;
+  while (dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') n++;
+  }
+  closedir(dir);
+  return n;
+}
+
+// sends back whatever it's sent
+class Echo final : public ShmPoller::Session {
+ public:
+  explicit Echo(std::atomic<int>* ended) : ended_(ended) {}
+  ~Echo() { (*ended_)++; }
+
+  bool OnReadable(ShmChannel* channel) override {
+    CommandSet msg;
+    bool closed;
+    while (channel->TryRead(&msg, &closed)) {
+      if (!channel->Send(msg)) return false;
+    }
+    return !closed;
+  }
+
+ private:
+  std::atomic<int>* const ended_;
+};
+
+}  // namespace
+
+TEST_F(ShmChannelTest, RoundTrip) {
+  auto client = ShmChannel::Connect(address_, 4096);
+  auto server = TakeServer();
+  ASSERT_TRUE(client->Write(Insert("x")));
+  CommandSet got;
+  ASSERT_TRUE(server->Read(&got));
+  EXPECT_EQ("x", got.commands(0).insert().characters());
+  ASSERT_TRUE(server->Write(Insert("y")));
+  ASSERT_TRUE(client->Read(&got));
+  EXPECT_EQ("y", got.commands(0).insert().characters());
+}
+
+TEST_F(ShmChannelTest, MessagesLargerThanTheRing) {
+  auto client = ShmChannel::Connect(address_, 4096);
+  auto server = TakeServer();
+  const std::string big(100000, 'z');
+  std::thread writer([&]() {
+    for (int i = 0; i < 10; i++) ASSERT_TRUE(client->Write(Insert(big)));
+  });
+  for (int i = 0; i < 10; i++) {
+    CommandSet got;
+    ASSERT_TRUE(server->Read(&got));
+    EXPECT_EQ(big, got.commands(0).insert().characters());
+  }
+  writer.join();
+}
+
+TEST_F(ShmChannelTest, CloseWritesDrainsThenFails) {
+  auto client = ShmChannel::Connect(address_, 4096);
+  auto server = TakeServer();
+  ASSERT_TRUE(client->Write(Insert("last")));
+  client->CloseWrites();
+  CommandSet got;
+  EXPECT_TRUE(server->Read(&got));
+  EXPECT_FALSE(server->Read(&got));
+}
+
+TEST_F(ShmChannelTest, PeerGoingAwayWakesReader) {
+  auto client = ShmChannel::Connect(address_, 4096);
+  auto server = TakeServer();
+  std::thread reader([&]() {
+    CommandSet got;
+    EXPECT_FALSE(client->Read(&got));
+  });
+  absl::SleepFor(absl::Milliseconds(50));
+  server.reset();
+  reader.join();
+}
+
+TEST_F(ShmChannelTest, PollerRunsManyChannelsOnItsOwnThreads) {
+  std::atomic<int> ended{0};
+  ShmPoller poller(2);
+  const int threads = CountThreads();
+  std::vector<std::unique_ptr<ShmChannel>> clients;
+  for (int i = 0; i < 200; i++) {
+    clients.emplace_back(ShmChannel::Connect(address_, 4096));
+    poller.Add(TakeServer(),
+               std::unique_ptr<ShmPoller::Session>(new Echo(&ended)));
+  }
+  // messages bigger than the ring go out a piece at a time either way
+  const std::string big(20000, 'z');
+  for (int round = 0; round < 3; round++) {
+    for (size_t i = 0; i < clients.size(); i++) {
+      ASSERT_TRUE(clients[i]->Write(Insert(absl::StrCat(round, ":", i))));
+    }
+    for (size_t i = 0; i < clients.size(); i++) {
+      CommandSet got;
+      ASSERT_TRUE(clients[i]->Read(&got));
+      EXPECT_EQ(absl::StrCat(round, ":", i),
+                got.commands(0).insert().characters());
+    }
+  }
+  std::thread writer([&]() { ASSERT_TRUE(clients[0]->Write(Insert(big))); });
+  CommandSet got;
+  ASSERT_TRUE(clients[0]->Read(&got));
+  EXPECT_EQ(big, got.commands(0).insert().characters());
+  writer.join();
+  EXPECT_EQ(threads, CountThreads());
+  EXPECT_EQ(0, ended);
+}
+
+TEST_F(ShmChannelTest, PollerEndsSessionsAsTheirChannelsClose) {
+  std::atomic<int> ended{0};
+  ShmPoller poller(1);
+  auto closes = ShmChannel::Connect(address_, 4096);
+  poller.Add(TakeServer(),
+             std::unique_ptr<ShmPoller::Session>(new Echo(&ended)));
+  auto goes = ShmChannel::Connect(address_, 4096);
+  poller.Add(TakeServer(),
+             std::unique_ptr<ShmPoller::Session>(new Echo(&ended)));
+  auto stays = ShmChannel::Connect(address_, 4096);
+  poller.Add(TakeServer(),
+             std::unique_ptr<ShmPoller::Session>(new Echo(&ended)));
+  // what's written before closing is still answered
+  ASSERT_TRUE(closes->Write(Insert("last")));
+  closes->CloseWrites();
+  CommandSet got;
+  EXPECT_TRUE(closes->Read(&got));
+  EXPECT_FALSE(closes->Read(&got));
+  goes.reset();
+  while (ended < 2) absl::SleepFor(absl::Milliseconds(1));
+  ASSERT_TRUE(stays->Write(Insert("still here")));
+  EXPECT_TRUE(stays->Read(&got));
+  EXPECT_EQ(2, ended);
+}
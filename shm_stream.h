@@ -0,0 +1,73 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <grpc++/support/sync_stream.h>
+#include "shm_channel.h"
+
+// gRPC's bidirectional stream interfaces over a ShmChannel, so code written
+// against a gRPC stream can run over shared memory unchanged. Write options
+// (compression) have no meaning here and are ignored.
+
+template <class W, class R>
+class ShmClientReaderWriter final
+    : public grpc::ClientReaderWriterInterface<W, R> {
+ public:
+  explicit ShmClientReaderWriter(std::unique_ptr<ShmChannel> channel)
+      : channel_(std::move(channel)) {}
+
+  void WaitForInitialMetadata() override {}
+  bool NextMessageSize(uint32_t* sz) override {
+    *sz = UINT32_MAX;
+    return true;
+  }
+  bool Read(R* msg) override { return channel_->Read(msg); }
+  bool Write(const W& msg, grpc::WriteOptions options) override {
+    return channel_->Write(msg);
+  }
+  bool WritesDone() override {
+    channel_->CloseWrites();
+    return true;
+  }
+  grpc::Status Finish() override {
+    channel_->Close();
+    return grpc::Status::OK;
+  }
+
+ private:
+  std::unique_ptr<ShmChannel> channel_;
+};
+
+template <class W, class R>
+class ShmServerReaderWriter final
+    : public grpc::ServerReaderWriterInterface<W, R> {
+ public:
+  explicit ShmServerReaderWriter(std::unique_ptr<ShmChannel> channel)
+      : channel_(std::move(channel)) {}
+  // the client sees the stream end once the handler returns
+  ~ShmServerReaderWriter() { channel_->Close(); }
+
+  void SendInitialMetadata() override {}
+  bool NextMessageSize(uint32_t* sz) override {
+    *sz = UINT32_MAX;
+    return true;
+  }
+  bool Read(R* msg) override { return channel_->Read(msg); }
+  bool Write(const W& msg, grpc::WriteOptions options) override {
+    return channel_->Write(msg);
+  }
+
+ private:
+  std::unique_ptr<ShmChannel> channel_;
+};
@@ -0,0 +1,46 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <iostream>
+#include "application.h"
+#include "client.h"
+
+// prints the project server's collaborator latency histograms
+class StatsDump : public Application {
+ public:
+  StatsDump(int argc, char** argv)
+      : client_(argv[0], PathFromCmdLine(argc, argv)) {}
+
+  int Run() override {
+    StatsResponse stats;
+    auto status = client_.GetStats(&stats);
+    if (!status.ok()) {
+      std::cerr << "Stats failed: " << status.error_message() << "\n";
+      return 1;
+    }
+    std::cout << stats.DebugString();
+    return 0;
+  }
+
+ private:
+  Client client_;
+
+  static boost::filesystem::path PathFromCmdLine(int argc, char** argv) {
+    if (argc != 2) {
+      throw std::runtime_error("Expected a path inside the project");
+    }
+    return argv[1];
+  }
+};
+
+REGISTER_APPLICATION(StatsDump);
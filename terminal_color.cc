@@ -4,8 +4,8 @@
 
 TerminalColor::TerminalColor(std::unique_ptr<::Theme> theme)
     : theme_(std::move(theme)) {
-  Log() << "CAN_CHANGE_COLOR: " << can_change_color();
-  Log() << "HAS_COLORS: " << has_colors();
+  LOG(INFO) << "CAN_CHANGE_COLOR: " << can_change_color();
+  LOG(INFO) << "HAS_COLORS: " << has_colors();
 }
 
 TerminalColor::LAB TerminalColor::RGB2LAB(RGB rgb) {
@@ -52,13 +52,14 @@ int TerminalColor::ColorToIndex(Color c) {
     int n = next_color_++;
     short r, g, b;
     color_content(n, &r, &g, &b);
-    Log() << "crrent to " << r << "," << g << "," << b;
-    Log() << "COLOR[" << n << "]: " << (int)(c.r * 1000 / 255) << " "
-          << (int)(c.g * 1000 / 255) << " " << (int)(c.b * 1000 / 255);
-    Log() << init_color(n, c.r * 1000 / 255, c.g * 1000 / 255,
-                        c.b * 1000 / 255);
+    LOG(INFO) << "crrent to " << r << "," << g << "," << b;
+    LOG(INFO) << "COLOR[" << n << "]: " << (int)(c.r * 1000 / 255) << " "
+              << (int)(c.g * 1000 / 255) << " " << (int)(c.b * 1000 / 255);
+    int rc =
+        init_color(n, c.r * 1000 / 255, c.g * 1000 / 255, c.b * 1000 / 255);
+    LOG(INFO) << rc;
     color_content(n, &r, &g, &b);
-    Log() << "set to " << r << "," << g << "," << b;
+    LOG(INFO) << "set to " << r << "," << g << "," << b;
     color_cache_.insert(std::make_pair(rgb, n));
     return n;
   } else {
@@ -69,8 +70,8 @@ int TerminalColor::ColorToIndex(Color c) {
       color_content(i, &r, &g, &b);
       RGB sys(r * 255 / 1000, g * 255 / 1000, b * 255 / 1000);
       float diff = RGBDistance(rgb, sys);
-      Log() << "color[" << i << " is " << r << "," << g << "," << b
-            << " ; diff=" << diff;
+      LOG(INFO) << "color[" << i << " is " << r << "," << g << "," << b
+                << " ; diff=" << diff;
       if (i == 0 || best_diff > diff) {
         best_diff = diff;
         best_clr = i;
@@ -100,8 +101,9 @@ chtype TerminalColor::Lookup(CharFmt fmt) {
   auto pit = pair_cache_.find(std::make_pair(fg, bg));
   if (pit == pair_cache_.end()) {
     int n = next_pair_++;
-    Log() << "PAIR[" << n << "]: " << fg << "," << bg;
-    Log() << init_pair(n, fg, bg);
+    LOG(INFO) << "PAIR[" << n << "]: " << fg << "," << bg;
+    int rc = init_pair(n, fg, bg);
+    LOG(INFO) << rc;
     pit = pair_cache_.insert(std::make_pair(std::make_pair(fg, bg), n)).first;
   }
   return cfcache_.insert(std::make_pair(fmt, COLOR_PAIR(pit->second)))
@@ -0,0 +1,194 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "text_search.h"
+#include <string.h>
+#include <set>
+
+void TextSearch::FindAll(absl::string_view text, absl::string_view query,
+                         std::vector<size_t>* at) {
+  at->clear();
+  if (query.empty() || query.size() > text.size()) return;
+  // memchr for the first character is vectorized by libc; only where it
+  // lands do we compare the rest
+  const char first = query[0];
+  const char* p = text.data();
+  const char* const last = text.data() + text.size() - query.size();
+  while (p <= last) {
+    p = static_cast<const char*>(memchr(p, first, last - p + 1));
+    if (p == nullptr) break;
+    if (memcmp(p + 1, query.data() + 1, query.size() - 1) == 0) {
+      at->push_back(p - text.data());
+      p += query.size();
+    } else {
+      p++;
+    }
+  }
+}
+
+void TextSearch::SetQuery(const std::string& query, ID from) {
+  query_ = query.substr(0, query.find('\n'));
+  found_.clear();
+  matches_ = 0;
+  first_match_.reset();
+  from_ = from;
+  scan_start_ = AnnotatedString::LineIterator(content_, from).id();
+  scan_start_column_ = Column(scan_start_, from);
+  scan_wrapped_ = false;
+  scan_next_ = query_.empty() ? ID() : scan_start_;
+}
+
+void TextSearch::Update(const AnnotatedString& content) {
+  if (content.SameContentIdentity(content_)) return;
+  AnnotatedString prev = content_;
+  content_ = content;
+  if (query_.empty() ||
+      (scan_next_ == scan_start_ && !scan_wrapped_ && found_.empty())) {
+    // nothing searched yet: the scan will see the new text
+    return;
+  }
+  std::set<ID> lines;
+  content_.ForEachTextChange(prev, [this, &lines](ID id) {
+    // a deleted newline no longer starts a line
+    if (found_.count(id.id)) Forget(id);
+    lines.insert(AnnotatedString::LineIterator(content_, id).id());
+  });
+  const ID first_match_line =
+      first_match_
+          ? AnnotatedString::LineIterator(content_, first_match_->first).id()
+          : ID();
+  for (ID line : lines) {
+    SearchLine(line);
+    if (line == first_match_line) first_match_.reset();
+  }
+}
+
+bool TextSearch::Scan(absl::Duration budget) {
+  if (done()) return true;
+  const absl::Time deadline = absl::Now() + budget;
+  // lines are gathered into a chunk so FindAll runs over many at a time
+  std::string chunk;
+  std::vector<std::pair<size_t, ID>> starts;
+  std::vector<size_t> at;
+  AnnotatedString::LineIterator lit(content_, scan_next_);
+  while (scan_next_ != ID()) {
+    chunk.clear();
+    starts.clear();
+    for (int i = 0; i < 256 && scan_next_ != ID(); i++) {
+      starts.emplace_back(chunk.size(), lit.id());
+      Forget(lit.id());
+      chunk += LineText(lit.id());
+      chunk += '\n';
+      if (!lit.MoveNext() || lit.is_end()) {
+        // at the end twice if the line it started on has been deleted
+        if (scan_wrapped_) {
+          scan_next_ = ID();
+          break;
+        }
+        scan_wrapped_ = true;
+        lit = AnnotatedString::LineIterator(content_, AnnotatedString::Begin());
+      }
+      scan_next_ = lit.id() == scan_start_ ? ID() : lit.id();
+    }
+    FindAll(chunk, query_, &at);
+    auto line = starts.begin();
+    for (size_t offset : at) {
+      while (line + 1 != starts.end() && (line + 1)->first <= offset) ++line;
+      const size_t column = offset - line->first;
+      found_[line->second.id].push_back(column);
+      matches_++;
+      // the scan sees its first line once, first: what's on it before from_
+      // comes after everything else
+      const bool before_from =
+          line->second == scan_start_ && column < scan_start_column_;
+      if (!first_match_ && !before_from) {
+        first_match_ = MatchAt(line->second, column);
+      }
+    }
+    if (absl::Now() > deadline) break;
+  }
+  return done();
+}
+
+absl::optional<std::pair<ID, ID>> TextSearch::NextMatch(ID from) {
+  if (query_.empty() || !done()) return absl::nullopt;
+  const AnnotatedString::LineIterator start(content_, from);
+  // matches at columns from here on start after from
+  const size_t column = Column(start.id(), from);
+  AnnotatedString::LineIterator lit = start;
+  bool wrapped = false;
+  for (;;) {
+    auto f = found_.find(lit.id().id);
+    if (f != found_.end()) {
+      for (size_t c : f->second) {
+        if (!wrapped && lit.id() == start.id() && c < column) continue;
+        return MatchAt(lit.id(), c);
+      }
+    }
+    if (wrapped) return absl::nullopt;
+    if (!lit.MoveNext() || lit.is_end()) {
+      lit = AnnotatedString::LineIterator(content_, AnnotatedString::Begin());
+    }
+    // back where we started: all that's left is the start of this line
+    wrapped = lit.id() == start.id();
+  }
+}
+
+absl::optional<std::pair<ID, ID>> TextSearch::FirstMatch() {
+  if (first_match_) return first_match_;
+  // none after from_, or edited away: look again now everything is known
+  return NextMatch(from_);
+}
+
+size_t TextSearch::Column(ID line_start, ID at) const {
+  size_t column = 0;
+  for (AnnotatedString::Iterator it(content_, line_start); it.id() != at;) {
+    it.MoveNext();
+    if (it.is_end() || it.value() == '\n') break;
+    column++;
+  }
+  return column;
+}
+
+std::pair<ID, ID> TextSearch::MatchAt(ID line_start, size_t column) const {
+  AnnotatedString::Iterator it(content_, line_start);
+  for (size_t i = 0; i <= column; i++) it.MoveNext();
+  ID first = it.id();
+  for (size_t i = 1; i < query_.size(); i++) it.MoveNext();
+  return std::make_pair(first, it.id());
+}
+
+std::string TextSearch::LineText(ID line_start) const {
+  std::string text;
+  AnnotatedString::Iterator it(content_, line_start);
+  for (it.MoveNext(); !it.is_end() && it.value() != '\n'; it.MoveNext()) {
+    text += it.value();
+  }
+  return text;
+}
+
+void TextSearch::SearchLine(ID line_start) {
+  Forget(line_start);
+  std::vector<size_t> at;
+  FindAll(LineText(line_start), query_, &at);
+  if (at.empty()) return;
+  matches_ += at.size();
+  found_[line_start.id] = std::move(at);
+}
+
+void TextSearch::Forget(ID line_start) {
+  auto it = found_.find(line_start.id);
+  if (it == found_.end()) return;
+  matches_ -= it->second.size();
+  found_.erase(it);
+}
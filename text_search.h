@@ -0,0 +1,87 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "annotated_string.h"
+
+// Finds a (single line, literal) query in an AnnotatedString as it's
+// edited. Lines are searched in order, a time-limited slice at a time, and
+// after an edit only the lines whose characters changed are searched again.
+class TextSearch {
+ public:
+  // forget what was found and search for query (empty: nothing) instead,
+  // starting from the line holding from (in the content last updated to) and
+  // wrapping round, so the match after from is found first
+  void SetQuery(const std::string& query,
+                ID from = AnnotatedString::Begin());
+  const std::string& query() const { return query_; }
+
+  // follow content to its latest version
+  void Update(const AnnotatedString& content);
+
+  // search unsearched lines for up to budget; returns done()
+  bool Scan(absl::Duration budget);
+  bool done() const { return query_.empty() || scan_next_ == ID(); }
+
+  // matches found so far
+  size_t matches() const { return matches_; }
+
+  // the first and last characters of the first match starting after the
+  // character from (wrapping around to the start), if there is one: only
+  // known once done(), so nothing until then
+  absl::optional<std::pair<ID, ID>> NextMatch(ID from);
+
+  // NextMatch of the from the query was set with, known as soon as the scan
+  // reaches it (nothing before then, or if there's no match)
+  absl::optional<std::pair<ID, ID>> FirstMatch();
+
+  // offsets of the (non-overlapping) occurrences of query in text
+  static void FindAll(absl::string_view text, absl::string_view query,
+                      std::vector<size_t>* at);
+
+ private:
+  // the text of the line starting at line_start (without its newline)
+  std::string LineText(ID line_start) const;
+  // characters from line_start up to (not counting) the character at
+  size_t Column(ID line_start, ID at) const;
+  // the first and last characters of the match at column of a line
+  std::pair<ID, ID> MatchAt(ID line_start, size_t column) const;
+  void SearchLine(ID line_start);
+  void Forget(ID line_start);
+
+  std::string query_;
+  AnnotatedString content_;
+  // line start -> columns of the matches in it, for lines with any
+  std::unordered_map<uint64_t, std::vector<size_t>> found_;
+  size_t matches_ = 0;
+  // the next line the scan will look at, or ID() once it's back round to
+  // scan_start_
+  ID scan_next_;
+  // the line the scan started on, and where on it: the scan runs from there
+  // to the end, then from the start round to there
+  ID scan_start_;
+  size_t scan_start_column_ = 0;
+  bool scan_wrapped_ = false;
+  ID from_;
+  // the first match the scan found after from_ (cleared if its line is
+  // edited)
+  absl::optional<std::pair<ID, ID>> first_match_;
+};
@@ -0,0 +1,133 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "text_search.h"
+#include <gtest/gtest.h>
+
+TEST(TextSearchTest, FindAll) {
+  std::vector<size_t> at;
+  TextSearch::FindAll("abcabcab", "ab", &at);
+  EXPECT_EQ((std::vector<size_t>{0, 3, 6}), at);
+  TextSearch::FindAll("aaaa", "aa", &at);
+  EXPECT_EQ((std::vector<size_t>{0, 2}), at);
+  TextSearch::FindAll("ab", "abc", &at);
+  EXPECT_TRUE(at.empty());
+  TextSearch::FindAll("abc", "", &at);
+  EXPECT_TRUE(at.empty());
+}
+
+TEST(TextSearchTest, ScansAndFollowsEdits) {
+  Site site;
+  AnnotatedString str;
+  ID last =
+      str.Insert(&site, "foo bar\nbaz foo\nqux", AnnotatedString::Begin());
+  TextSearch search;
+  search.Update(str);
+  search.SetQuery("foo");
+  EXPECT_FALSE(search.done());
+  EXPECT_TRUE(search.Scan(absl::Seconds(10)));
+  EXPECT_EQ(2u, search.matches());
+  // typing a match on the last line
+  str.Insert(&site, " foo", last);
+  search.Update(str);
+  EXPECT_EQ(3u, search.matches());
+  // deleting the first newline joins "bar" and "baz": still three
+  AnnotatedString::Iterator nl(str, AnnotatedString::Begin());
+  while (nl.value() != '\n') nl.MoveNext();
+  CommandSet del;
+  AnnotatedString::MakeDelete(&del, nl.id());
+  str = str.Integrate(del);
+  search.Update(str);
+  EXPECT_EQ("foo barbaz foo\nqux foo", str.Render());
+  EXPECT_EQ(3u, search.matches());
+  search.SetQuery("barbaz");
+  search.Scan(absl::Seconds(10));
+  EXPECT_EQ(1u, search.matches());
+}
+
+TEST(TextSearchTest, NextMatchWraps) {
+  Site site;
+  AnnotatedString str;
+  str.Insert(&site, "ab\nxab\n\nab", AnnotatedString::Begin());
+  TextSearch search;
+  search.Update(str);
+  search.SetQuery("ab");
+  // nothing's known until the scan is done
+  EXPECT_FALSE(search.NextMatch(AnnotatedString::Begin()));
+  search.Scan(absl::Seconds(10));
+  ID at = AnnotatedString::Begin();
+  std::vector<std::pair<ID, ID>> found;
+  for (int i = 0; i < 4; i++) {
+    auto m = search.NextMatch(at);
+    ASSERT_TRUE(m);
+    found.push_back(*m);
+    ID after = AnnotatedString::Iterator(str, m->second).Next().id();
+    EXPECT_EQ("ab", str.Render(m->first, after));
+    at = m->second;
+  }
+  EXPECT_NE(found[0].first, found[1].first);
+  EXPECT_NE(found[1].first, found[2].first);
+  EXPECT_EQ(found[0], found[3]);
+  search.SetQuery("zz");
+  search.Scan(absl::Seconds(10));
+  EXPECT_FALSE(search.NextMatch(at));
+}
+
+TEST(TextSearchTest, FirstMatchIsKnownOnceTheScanReachesIt) {
+  Site site;
+  AnnotatedString str;
+  std::string text = "needle\n";
+  for (int i = 0; i < 2000; i++) text += "hay\n";
+  text += "needle\n";
+  str.Insert(&site, text, AnnotatedString::Begin());
+  // from the start of line 10
+  AnnotatedString::LineIterator line(str, AnnotatedString::Begin());
+  for (int i = 0; i < 9; i++) line.MoveNext();
+  TextSearch search;
+  search.Update(str);
+  search.SetQuery("needle", line.id());
+  EXPECT_FALSE(search.FirstMatch());
+  // a slice, from line 10, that doesn't get round to the first line
+  search.Scan(absl::ZeroDuration());
+  EXPECT_FALSE(search.done());
+  EXPECT_EQ(0u, search.matches());
+  EXPECT_FALSE(search.FirstMatch());
+  while (!search.Scan(absl::ZeroDuration())) {
+  }
+  EXPECT_EQ(2u, search.matches());
+  // the last line's, found before the scan wrapped round to the first
+  auto first = search.FirstMatch();
+  ASSERT_TRUE(first);
+  EXPECT_EQ(first, search.NextMatch(line.id()));
+  EXPECT_NE(str.Render().find("needle"),
+            str.Render(AnnotatedString::Begin(), first->first).size());
+}
+
+TEST(TextSearchTest, FirstMatchBeforeTheScanIsDone) {
+  Site site;
+  AnnotatedString str;
+  std::string text;
+  for (int i = 0; i < 2000; i++) text += i == 20 ? "needle\n" : "hay\n";
+  str.Insert(&site, text, AnnotatedString::Begin());
+  TextSearch search;
+  search.Update(str);
+  search.SetQuery("needle");
+  search.Scan(absl::ZeroDuration());
+  EXPECT_FALSE(search.done());
+  // NextMatch waits for the whole scan, FirstMatch doesn't
+  EXPECT_FALSE(search.NextMatch(AnnotatedString::Begin()));
+  auto first = search.FirstMatch();
+  ASSERT_TRUE(first);
+  ID after = AnnotatedString::Iterator(str, first->second).Next().id();
+  EXPECT_EQ("needle", str.Render(first->first, after));
+}
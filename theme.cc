@@ -57,23 +57,51 @@ static absl::optional<Color> Merge(absl::optional<Color> a,
                blend(a->b, b->b, a->a), 255};
 }
 
-CharFmt Theme::ThemeToken(Tag token, uint32_t flags) {
-  auto key = std::make_pair(token, flags);
-  auto it = theme_cache_.find(key);
-  if (it != theme_cache_.end()) return it->second;
+uint64_t Theme::Hash(const Tag& token, uint32_t flags) {
+  // FNV-1a over the scope names, each followed by a separator
+  uint64_t h = 14695981039346656037ull ^ flags;
+  for (const auto& t : token) {
+    for (char c : t) {
+      h ^= static_cast<uint8_t>(c);
+      h *= 1099511628211ull;
+    }
+    h ^= 0xff;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
 
-  Log() << "Theme: " << absl::StrJoin(token, ":") << " flags=" << flags;
+CharFmt Theme::ThemeToken(const Tag& token, uint32_t flags) {
+  const uint64_t hash = Hash(token, flags);
+  auto it = theme_cache_.find(hash);
+  if (it != theme_cache_.end() && it->second.flags == flags &&
+      it->second.token == token) {
+    return it->second.fmt;
+  }
+  CharFmt fmt = Compute(token, flags);
+  theme_cache_[hash] = CacheEntry{token, flags, fmt};
+  return fmt;
+}
 
-  Setting composite;
-  for (auto sit = settings_.crbegin(); sit != settings_.crend(); ++sit) {
-    bool matches = false;
-    for (const auto& sel : sit->scopes) {
-      if (SelectorMatches(sel, token)) {
-        matches = true;
-        break;
-      }
+CharFmt Theme::Compute(const Tag& token, uint32_t flags) {
+  LOG(VERBOSE) << "Theme: " << absl::StrJoin(token, ":") << " flags=" << flags;
+
+  std::vector<CompiledSelectors::Token> tokens;
+  for (const auto& t : token) tokens.push_back(selectors_.Intern(t));
+  std::vector<size_t> matched;
+  selectors_.Match(tokens, &matched);
+  // settings with a matching scope, last first
+  std::vector<size_t> matched_settings;
+  for (auto m = matched.rbegin(); m != matched.rend(); ++m) {
+    size_t setting = selector_setting_[*m];
+    if (matched_settings.empty() || matched_settings.back() != setting) {
+      matched_settings.push_back(setting);
     }
-    if (!matches) continue;
+  }
+
+  Setting composite;
+  for (size_t setting : matched_settings) {
+    const Setting* sit = &settings_[setting];
     composite.font_style = Merge(composite.font_style, sit->font_style);
     composite.bracket_contents_options = Merge(
         composite.bracket_contents_options, sit->bracket_contents_options);
@@ -125,11 +153,17 @@ CharFmt Theme::ThemeToken(Tag token, uint32_t flags) {
   if (flags & SELECTED) {
     background = Merge(composite.selection, background);
   }
+  if (flags & FIND_HIGHLIGHT) {
+    // themes without a find highlight show matches as selected
+    background = Merge(composite.find_highlight ? composite.find_highlight
+                                                : composite.selection,
+                       background);
+    foreground = Merge(composite.find_highlight_foreground, foreground);
+  }
 
   CharFmt result{foreground ? *foreground : Color{255, 255, 255, 255},
                  background ? *background : Color{0, 0, 0, 255},
                  highlight != Highlight::UNSET ? highlight : Highlight::NONE};
-  theme_cache_.insert(std::make_pair(key, result));
   return result;
 }
 
@@ -229,6 +263,10 @@ void Theme::Load(const std::string& src) {
     } catch (std::exception& e) {
       throw std::runtime_error("Parsing " + name + ": " + e.what());
     }
+    for (const auto& sel : s.scopes) {
+      selectors_.Add(sel);
+      selector_setting_.push_back(settings_.size());
+    }
     settings_.push_back(s);
   }
 }
@@ -13,8 +13,8 @@
 // limitations under the License.
 #pragma once
 
-#include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "absl/types/optional.h"
@@ -33,10 +33,11 @@ class Theme {
 
   static constexpr uint32_t HIGHLIGHT_LINE = 1;
   static constexpr uint32_t SELECTED = 2;
+  static constexpr uint32_t FIND_HIGHLIGHT = 4;
 
   typedef std::vector<std::string> Tag;
 
-  CharFmt ThemeToken(Tag token, uint32_t flags);
+  CharFmt ThemeToken(const Tag& token, uint32_t flags);
 
  private:
   void Load(const std::string& src);
@@ -130,6 +131,18 @@ class Theme {
 
   std::vector<Selector> ParseScopes(const plist::Dict* d);
 
+  CharFmt Compute(const Tag& token, uint32_t flags);
+  static uint64_t Hash(const Tag& token, uint32_t flags);
+
   std::vector<Setting> settings_;
-  std::map<std::pair<Tag, uint32_t>, CharFmt> theme_cache_;
+  // every scope of every setting, and the setting each came from
+  CompiledSelectors selectors_;
+  std::vector<size_t> selector_setting_;
+  struct CacheEntry {
+    Tag token;
+    uint32_t flags;
+    CharFmt fmt;
+  };
+  // by Hash(); an entry for a colliding token is replaced
+  std::unordered_map<uint64_t, CacheEntry> theme_cache_;
 };
@@ -0,0 +1,183 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "timer_wheel.h"
+
+constexpr int TimerWheel::kLevelBits;
+constexpr uint64_t TimerWheel::kSlots;
+constexpr uint64_t TimerWheel::kSlotMask;
+constexpr int TimerWheel::kLevels;
+constexpr uint64_t TimerWheel::kMaxDelta;
+
+static const absl::Duration kTick = absl::Milliseconds(1);
+
+TimerWheel* TimerWheel::Get() {
+  // leaked so the thread can outlive static destruction
+  static TimerWheel* wheel = new TimerWheel;
+  return wheel;
+}
+
+TimerWheel::TimerWheel() : epoch_(absl::Now()), thread_([this]() { Run(); }) {}
+
+TimerWheel::~TimerWheel() {
+  mu_.Lock();
+  shutdown_ = true;
+  mu_.Unlock();
+  thread_.join();
+}
+
+uint64_t TimerWheel::TickFor(absl::Time t) const {
+  // round up: a timer must never fire before its deadline
+  int64_t us = absl::ToInt64Microseconds(t - epoch_);
+  int64_t tick_us = absl::ToInt64Microseconds(kTick);
+  if (us <= 0) return 0;
+  return (us + tick_us - 1) / tick_us;
+}
+
+absl::Time TimerWheel::TimeFor(uint64_t tick) const {
+  return epoch_ + kTick * static_cast<int64_t>(tick);
+}
+
+TimerWheel::Handle TimerWheel::Schedule(absl::Time deadline,
+                                        std::function<void()> fn) {
+  absl::MutexLock lock(&mu_);
+  Handle handle = next_handle_++;
+  uint64_t tick = TickFor(deadline);
+  timers_.emplace(handle, Timer{tick, std::move(fn)});
+  Place(handle, tick);
+  if (tick < wake_tick_) kicked_ = true;
+  return handle;
+}
+
+bool TimerWheel::Cancel(Handle handle) {
+  absl::MutexLock lock(&mu_);
+  if (timers_.erase(handle)) return true;
+  auto done = [this, handle]() {
+    mu_.AssertHeld();
+    return running_ != handle;
+  };
+  mu_.Await(absl::Condition(&done));
+  return false;
+}
+
+void TimerWheel::Place(Handle handle, uint64_t tick) {
+  if (tick <= current_tick_) tick = current_tick_ + 1;
+  uint64_t delta = tick - current_tick_;
+  if (delta >= kMaxDelta) {
+    // park in the outermost level; re-placed by its real tick on cascade
+    delta = kMaxDelta - 1;
+    tick = current_tick_ + delta;
+  }
+  for (int level = 0;; level++) {
+    if (delta < (uint64_t(1) << (kLevelBits * (level + 1)))) {
+      slots_[level][(tick >> (kLevelBits * level)) & kSlotMask].push_back(
+          handle);
+      return;
+    }
+  }
+}
+
+void TimerWheel::Cascade(int level) {
+  std::vector<Handle> handles;
+  handles.swap(
+      slots_[level][(current_tick_ >> (kLevelBits * level)) & kSlotMask]);
+  for (auto handle : handles) {
+    auto it = timers_.find(handle);
+    if (it == timers_.end()) continue;
+    Place(handle, it->second.tick);
+  }
+}
+
+uint64_t TimerWheel::NextEventTick() {
+  uint64_t next = ~uint64_t(0);
+  for (int level = 0; level < kLevels; level++) {
+    int shift = kLevelBits * level;
+    uint64_t base = current_tick_ >> shift;
+    for (uint64_t k = 1; k <= kSlots; k++) {
+      if (!slots_[level][(base + k) & kSlotMask].empty()) {
+        next = std::min(next, (base + k) << shift);
+        break;
+      }
+    }
+  }
+  return next;
+}
+
+void TimerWheel::Advance(uint64_t to_tick, std::vector<Handle>* expired) {
+  while (current_tick_ < to_tick) {
+    uint64_t next = NextEventTick();
+    if (next > to_tick) {
+      // nothing lives in the skipped ticks
+      current_tick_ = to_tick;
+      return;
+    }
+    current_tick_ = next;
+    for (int level = kLevels - 1; level > 0; level--) {
+      if ((current_tick_ & ((uint64_t(1) << (kLevelBits * level)) - 1)) == 0) {
+        Cascade(level);
+      }
+    }
+    std::vector<Handle> handles;
+    handles.swap(slots_[0][current_tick_ & kSlotMask]);
+    for (auto handle : handles) {
+      auto it = timers_.find(handle);
+      if (it == timers_.end()) continue;
+      if (it->second.tick <= current_tick_) {
+        expired->push_back(handle);
+      } else {
+        Place(handle, it->second.tick);
+      }
+    }
+  }
+}
+
+void TimerWheel::Run() {
+  auto woken = [this]() {
+    mu_.AssertHeld();
+    return kicked_ || shutdown_;
+  };
+  std::vector<Handle> expired;
+  mu_.Lock();
+  while (!shutdown_) {
+    // TickFor rounds up; only ticks that are wholly in the past are due
+    absl::Time now = absl::Now();
+    uint64_t now_tick = TickFor(now);
+    if (now_tick > 0 && TimeFor(now_tick) > now) now_tick--;
+    Advance(now_tick, &expired);
+    for (auto handle : expired) {
+      auto it = timers_.find(handle);
+      if (it == timers_.end()) continue;
+      std::function<void()> fn = std::move(it->second.fn);
+      timers_.erase(it);
+      running_ = handle;
+      mu_.Unlock();
+      fn();
+      mu_.Lock();
+      running_ = 0;
+    }
+    expired.clear();
+    kicked_ = false;
+    if (timers_.empty()) {
+      // only cancelled handles remain: drop them rather than sweep later
+      for (auto& level : slots_) {
+        for (auto& slot : level) slot.clear();
+      }
+      wake_tick_ = ~uint64_t(0);
+      mu_.Await(absl::Condition(&woken));
+    } else {
+      wake_tick_ = NextEventTick();
+      mu_.AwaitWithDeadline(absl::Condition(&woken), TimeFor(wake_tick_));
+    }
+  }
+  mu_.Unlock();
+}
@@ -0,0 +1,81 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+
+// Hierarchical timer wheel: a single thread owns a set of deadlines and runs
+// each callback once its deadline passes
+class TimerWheel {
+ public:
+  typedef uint64_t Handle;
+
+  // process wide instance
+  static TimerWheel* Get();
+
+  TimerWheel();
+  ~TimerWheel();
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // run fn on the timer thread once deadline has passed
+  Handle Schedule(absl::Time deadline, std::function<void()> fn);
+
+  // returns true if the timer was removed before it fired; if its callback is
+  // running, waits for it to finish (so must not be called from a callback)
+  bool Cancel(Handle handle);
+
+ private:
+  static constexpr int kLevelBits = 6;
+  static constexpr uint64_t kSlots = 1 << kLevelBits;
+  static constexpr uint64_t kSlotMask = kSlots - 1;
+  static constexpr int kLevels = 4;
+  static constexpr uint64_t kMaxDelta = uint64_t(1) << (kLevelBits * kLevels);
+
+  struct Timer {
+    uint64_t tick;
+    std::function<void()> fn;
+  };
+
+  uint64_t TickFor(absl::Time t) const;
+  absl::Time TimeFor(uint64_t tick) const;
+
+  void Place(Handle handle, uint64_t tick) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void Cascade(int level) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  uint64_t NextEventTick() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void Advance(uint64_t to_tick, std::vector<Handle>* expired)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void Run();
+
+  const absl::Time epoch_;
+  absl::Mutex mu_;
+  bool shutdown_ GUARDED_BY(mu_) = false;
+  bool kicked_ GUARDED_BY(mu_) = false;
+  // every tick <= current_tick_ has been processed
+  uint64_t current_tick_ GUARDED_BY(mu_) = 0;
+  uint64_t wake_tick_ GUARDED_BY(mu_) = 0;
+  Handle next_handle_ GUARDED_BY(mu_) = 1;
+  Handle running_ GUARDED_BY(mu_) = 0;
+  std::unordered_map<Handle, Timer> timers_ GUARDED_BY(mu_);
+  // slots hold handles lazily: cancelled timers are skipped when reached
+  std::vector<Handle> slots_[kLevels][kSlots] GUARDED_BY(mu_);
+  std::thread thread_;
+};
@@ -0,0 +1,91 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "timer_wheel.h"
+#include <gtest/gtest.h>
+#include "absl/synchronization/notification.h"
+
+TEST(TimerWheelTest, NoOp) { TimerWheel wheel; }
+
+TEST(TimerWheelTest, FiresAfterDeadline) {
+  TimerWheel wheel;
+  absl::Notification fired;
+  absl::Time deadline = absl::Now() + absl::Milliseconds(20);
+  absl::Time fired_at;
+  wheel.Schedule(deadline, [&]() {
+    fired_at = absl::Now();
+    fired.Notify();
+  });
+  fired.WaitForNotification();
+  EXPECT_GE(fired_at, deadline);
+}
+
+TEST(TimerWheelTest, FiresInDeadlineOrder) {
+  TimerWheel wheel;
+  absl::Mutex mu;
+  std::vector<int> order;
+  absl::Notification done;
+  absl::Time now = absl::Now();
+  for (int i : {5, 1, 3, 2, 4}) {
+    wheel.Schedule(now + absl::Milliseconds(10 * i), [&, i]() {
+      absl::MutexLock lock(&mu);
+      order.push_back(i);
+      if (order.size() == 5) done.Notify();
+    });
+  }
+  done.WaitForNotification();
+  EXPECT_EQ(order, (std::vector<int>{1, 2, 3, 4, 5}));
+}
+
+TEST(TimerWheelTest, PastDeadlineFiresPromptly) {
+  TimerWheel wheel;
+  absl::Notification fired;
+  wheel.Schedule(absl::Now() - absl::Seconds(1), [&]() { fired.Notify(); });
+  EXPECT_TRUE(fired.WaitForNotificationWithTimeout(absl::Seconds(5)));
+}
+
+TEST(TimerWheelTest, CascadesFromOuterLevels) {
+  // far enough out to be placed beyond the innermost level
+  TimerWheel wheel;
+  absl::Notification fired;
+  absl::Time deadline = absl::Now() + absl::Milliseconds(150);
+  absl::Time fired_at;
+  wheel.Schedule(deadline, [&]() {
+    fired_at = absl::Now();
+    fired.Notify();
+  });
+  fired.WaitForNotification();
+  EXPECT_GE(fired_at, deadline);
+  EXPECT_LT(fired_at, deadline + absl::Seconds(1));
+}
+
+TEST(TimerWheelTest, CancelPreventsFiring) {
+  TimerWheel wheel;
+  bool cancelled_fired = false;
+  absl::Notification later_fired;
+  absl::Time now = absl::Now();
+  auto handle = wheel.Schedule(now + absl::Milliseconds(10),
+                               [&]() { cancelled_fired = true; });
+  wheel.Schedule(now + absl::Milliseconds(30), [&]() { later_fired.Notify(); });
+  EXPECT_TRUE(wheel.Cancel(handle));
+  later_fired.WaitForNotification();
+  EXPECT_FALSE(cancelled_fired);
+}
+
+TEST(TimerWheelTest, CancelAfterFiring) {
+  TimerWheel wheel;
+  absl::Notification fired;
+  auto handle = wheel.Schedule(absl::Now(), [&]() { fired.Notify(); });
+  fired.WaitForNotification();
+  EXPECT_FALSE(wheel.Cancel(handle));
+}
@@ -0,0 +1,273 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "trace.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+
+DEFINE_string(trace_file, "",
+              "Append Chrome trace events to this file (client and server)");
+
+std::atomic<bool> Trace::enabled_{false};
+
+namespace {
+
+struct Event {
+  const char* name;
+  char phase;
+  int64_t ts_us;
+  int64_t dur_us;
+};
+
+// single producer (the owning thread), single consumer (the flusher)
+class ThreadBuffer {
+ public:
+  static constexpr size_t kCapacity = 4096;
+
+  explicit ThreadBuffer(int64_t tid) : tid_(tid), head_(0), tail_(0) {}
+
+  int64_t tid() const { return tid_; }
+
+  void Push(const Event& e) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == kCapacity) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    events_[head % kCapacity] = e;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  template <class F>
+  void Drain(F f) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    for (; tail != head; tail++) f(events_[tail % kCapacity]);
+    tail_.store(tail, std::memory_order_release);
+  }
+
+  uint64_t TakeDropped() { return dropped_.exchange(0); }
+
+  std::atomic<bool> retired{false};
+  std::string thread_name;  // guarded by Registry::mu
+
+ private:
+  const int64_t tid_;
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+  std::atomic<uint64_t> dropped_{0};
+  Event events_[kCapacity];
+};
+
+struct Registry {
+  absl::Mutex mu;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers GUARDED_BY(mu);
+  std::vector<std::shared_ptr<ThreadBuffer>> renamed GUARDED_BY(mu);
+  std::string process_name GUARDED_BY(mu);
+  bool process_named GUARDED_BY(mu) = false;
+  bool stop GUARDED_BY(mu) = false;
+  int fd GUARDED_BY(mu) = -1;
+  std::unique_ptr<std::thread> flusher;
+};
+
+Registry* registry() {
+  static Registry* r = new Registry;
+  return r;
+}
+
+// owns the calling thread's buffer; marks it retired on thread exit so the
+// flusher can release it once drained
+class ThreadBufferRef {
+ public:
+  ThreadBufferRef()
+      : buffer_(std::make_shared<ThreadBuffer>(syscall(SYS_gettid))) {
+    Registry* r = registry();
+    absl::MutexLock lock(&r->mu);
+    r->buffers.push_back(buffer_);
+  }
+  ~ThreadBufferRef() { buffer_->retired = true; }
+
+  ThreadBuffer* get() const { return buffer_.get(); }
+
+ private:
+  std::shared_ptr<ThreadBuffer> buffer_;
+};
+
+ThreadBuffer* CurrentThreadBuffer() {
+  thread_local ThreadBufferRef ref;
+  return ref.get();
+}
+
+int64_t ToMicros(absl::Time t) { return absl::ToUnixMicros(t); }
+
+void AppendEscaped(std::string* out, const std::string& s) {
+  for (char c : s) {
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          out->push_back(' ');
+        } else {
+          out->push_back(c);
+        }
+    }
+  }
+}
+
+void AppendMetadata(std::string* out, const char* kind, int64_t tid,
+                    const std::string& name) {
+  absl::StrAppend(out, "{\"ph\":\"M\",\"name\":\"", kind,
+                  "\",\"pid\":", getpid(), ",\"tid\":", tid,
+                  ",\"args\":{\"name\":\"");
+  AppendEscaped(out, name);
+  out->append("\"}},\n");
+}
+
+void AppendEvent(std::string* out, int64_t tid, const Event& e) {
+  absl::StrAppend(out, "{\"ph\":\"", std::string(1, e.phase),
+                  "\",\"name\":\"");
+  AppendEscaped(out, e.name);
+  absl::StrAppend(out, "\",\"pid\":", getpid(), ",\"tid\":", tid,
+                  ",\"ts\":", e.ts_us);
+  if (e.phase == 'X') {
+    absl::StrAppend(out, ",\"dur\":", e.dur_us);
+  } else {
+    out->append(",\"s\":\"t\"");
+  }
+  out->append("},\n");
+}
+
+void Flush(Registry* r) EXCLUSIVE_LOCKS_REQUIRED(r->mu) {
+  std::string out;
+  if (!r->process_named) {
+    AppendMetadata(&out, "process_name", 0, r->process_name);
+    r->process_named = true;
+  }
+  for (auto& b : r->renamed) {
+    AppendMetadata(&out, "thread_name", b->tid(), b->thread_name);
+  }
+  r->renamed.clear();
+  for (auto it = r->buffers.begin(); it != r->buffers.end();) {
+    ThreadBuffer* b = it->get();
+    bool retired = b->retired;
+    b->Drain([&](const Event& e) { AppendEvent(&out, b->tid(), e); });
+    if (uint64_t dropped = b->TakeDropped()) {
+      absl::StrAppend(&out, "{\"ph\":\"C\",\"name\":\"trace_dropped\",\"pid\":",
+                      getpid(), ",\"tid\":", b->tid(),
+                      ",\"ts\":", ToMicros(absl::Now()),
+                      ",\"args\":{\"events\":", dropped, "}},\n");
+    }
+    // events pushed after the retired check will be picked up next round
+    if (retired) {
+      it = r->buffers.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (r->fd == -1 || out.empty()) return;
+  const char* p = out.data();
+  size_t n = out.size();
+  while (n > 0) {
+    ssize_t w = write(r->fd, p, n);
+    if (w <= 0) break;
+    p += w;
+    n -= w;
+  }
+}
+
+void FlusherLoop(Registry* r) {
+  absl::MutexLock lock(&r->mu);
+  while (!r->stop) {
+    r->mu.AwaitWithTimeout(absl::Condition(&r->stop), absl::Milliseconds(100));
+    Flush(r);
+  }
+}
+
+}  // namespace
+
+void Trace::Start(const std::string& process_name) {
+  if (FLAGS_trace_file.empty()) return;
+  Registry* r = registry();
+  {
+    absl::MutexLock lock(&r->mu);
+    if (r->fd != -1) return;
+    r->fd = open(FLAGS_trace_file.c_str(), O_WRONLY | O_CREAT | O_APPEND,
+                 0644);
+    if (r->fd == -1) return;
+    struct stat st;
+    // the JSON array format tolerates a missing ']' and trailing commas, so
+    // several processes can append to one file without coordination
+    if (fstat(r->fd, &st) == 0 && st.st_size == 0) {
+      if (write(r->fd, "[\n", 2) != 2) {
+        close(r->fd);
+        r->fd = -1;
+        return;
+      }
+    }
+    r->process_name = process_name;
+    r->process_named = false;
+    r->stop = false;
+  }
+  enabled_ = true;
+  r->flusher.reset(new std::thread([r]() { FlusherLoop(r); }));
+}
+
+void Trace::Stop() {
+  if (!enabled()) return;
+  enabled_ = false;
+  Registry* r = registry();
+  {
+    absl::MutexLock lock(&r->mu);
+    r->stop = true;
+  }
+  r->flusher->join();
+  r->flusher.reset();
+  absl::MutexLock lock(&r->mu);
+  Flush(r);
+  close(r->fd);
+  r->fd = -1;
+}
+
+void Trace::Complete(const char* name, absl::Time start, absl::Time end) {
+  if (!enabled()) return;
+  int64_t ts = ToMicros(start);
+  CurrentThreadBuffer()->Push(Event{name, 'X', ts, ToMicros(end) - ts});
+}
+
+void Trace::Instant(const char* name) {
+  if (!enabled()) return;
+  CurrentThreadBuffer()->Push(Event{name, 'i', ToMicros(absl::Now()), 0});
+}
+
+void Trace::SetThreadName(const std::string& name) {
+  if (!enabled()) return;
+  ThreadBuffer* b = CurrentThreadBuffer();
+  Registry* r = registry();
+  absl::MutexLock lock(&r->mu);
+  b->thread_name = name;
+  for (auto& p : r->buffers) {
+    if (p.get() == b) r->renamed.push_back(p);
+  }
+}
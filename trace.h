@@ -0,0 +1,65 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <gflags/gflags.h>
+#include <atomic>
+#include <string>
+#include "absl/time/clock.h"
+
+DECLARE_string(trace_file);
+
+// Records Chrome trace events (load the file in chrome://tracing or
+// ui.perfetto.dev). Each thread appends to its own lock-free buffer; a
+// background thread drains them into --trace_file. The client and the
+// server it spawns append to the same file, so one trace covers both.
+//
+// Event names must outlive the process (string literals, collaborator names).
+class Trace {
+ public:
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // begin recording if --trace_file is set
+  static void Start(const std::string& process_name);
+  // drain everything recorded so far and stop
+  static void Stop();
+
+  static void Complete(const char* name, absl::Time start, absl::Time end);
+  static void Instant(const char* name);
+  // label the calling thread in the trace viewer
+  static void SetThreadName(const std::string& name);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+// records a complete event covering its lifetime
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name)
+      : name_(name),
+        enabled_(Trace::enabled()),
+        start_(enabled_ ? absl::Now() : absl::InfinitePast()) {}
+  ~TraceSpan() {
+    if (enabled_) Trace::Complete(name_, start_, absl::Now());
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  const char* const name_;
+  const bool enabled_;
+  const absl::Time start_;
+};
@@ -0,0 +1,74 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "trace.h"
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream in(path);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+int Count(const std::string& haystack, const std::string& needle) {
+  int n = 0;
+  for (size_t p = haystack.find(needle); p != std::string::npos;
+       p = haystack.find(needle, p + 1)) {
+    n++;
+  }
+  return n;
+}
+
+}  // namespace
+
+TEST(TraceTest, DisabledRecordsNothing) {
+  EXPECT_FALSE(Trace::enabled());
+  TraceSpan span("nothing");
+  Trace::Instant("nothing");
+}
+
+TEST(TraceTest, WritesEventsFromAllThreads) {
+  std::string path = ::testing::TempDir() + "/trace_test.json";
+  remove(path.c_str());
+  FLAGS_trace_file = path;
+  Trace::Start("trace_test");
+  ASSERT_TRUE(Trace::enabled());
+  { TraceSpan span("main_span"); }
+  std::thread t([]() {
+    Trace::SetThreadName("worker");
+    for (int i = 0; i < 10; i++) {
+      TraceSpan span("worker_span");
+    }
+    Trace::Instant("worker_instant");
+  });
+  t.join();
+  Trace::Stop();
+  EXPECT_FALSE(Trace::enabled());
+  FLAGS_trace_file = "";
+
+  std::string trace = ReadFile(path);
+  EXPECT_EQ(0, trace.find("[\n"));
+  EXPECT_EQ(1, Count(trace, "\"name\":\"trace_test\""));
+  EXPECT_EQ(1, Count(trace, "\"name\":\"worker\""));
+  EXPECT_EQ(1, Count(trace, "\"name\":\"main_span\""));
+  EXPECT_EQ(10, Count(trace, "\"name\":\"worker_span\""));
+  EXPECT_EQ(1, Count(trace, "\"name\":\"worker_instant\""));
+  EXPECT_EQ(0, Count(trace, "trace_dropped"));
+}